@@ -1,6 +1,9 @@
 #!/bin/bash
 
-make -C test test
+make -C test test && \
+    make -C test test FIXED_REGISTERS=Y && \
+    make -C test test PRESCALE_1=Y && \
+    make -C test test TRACE=N TIMESTAMPS=N
 rc=$?
 
 if [ $rc -ne 0 ]; then
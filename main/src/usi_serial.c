@@ -1,49 +1,270 @@
+#include <stddef.h>
+
 #include <avr/interrupt.h>
 #include <util/parity.h>
 
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+
+// there's no sleep instruction on the host; whatever's simulating the MCU
+// provides one
+void sleep_cpu(void);
+
+// nor an atomic.h.  The simulated ISRs only run between the driver's calls,
+// or from sleep_cpu(), so the block's just run once.
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for (uint8_t atomic_once = 1; atomic_once; atomic_once = 0)
+#endif
+
 #include <8bit_tiny_timer0.h>
 
 #include "usi_serial.h"
 #define USI_COUNTER_MAX_COUNT 16
 #define HALF_FRAME 5
+#define MAX_DATA_BITS 8
+#define PARITY_BITS 1
+#define TX_BUFFER_MASK (USI_SERIAL_TX_BUFFER_SIZE - 1)
+#define RX_BUFFER_MASK (USI_SERIAL_RX_BUFFER_SIZE - 1)
+#define RX_HANDOFF_MASK (USI_SERIAL_RX_HANDOFF_SIZE - 1)
+
+// the registers, through the port's register structs or, with
+// USI_SERIAL_FIXED_REGISTERS, bound at compile time
+#ifdef USI_SERIAL_FIXED_REGISTERS
+#define USI_REG(port, r) USI_SERIAL_IO(r)
+#define TIMER1_REG(port, r) USI_SERIAL_IO(r)
+#else
+#define USI_REG(port, r) (*(port)->reg->p##r)
+#define TIMER1_REG(port, r) (*(port)->timer1_reg->p##r)
+#endif
+
+// the values the ISRs derive from a format's data bits, parity and stop bits
+#define FORMAT_PARITY_BITS(parity) (((parity) != USI_SERIAL_PARITY_NONE) ? PARITY_BITS : 0)
+#define FORMAT_DATA_MASK(data_bits) (0xff >> (MAX_DATA_BITS - (data_bits)))
+#define FORMAT_RX_SHIFT(data_bits) (MAX_DATA_BITS - (data_bits))
+#define FORMAT_RX_TRAILER_BITS(parity) (FORMAT_PARITY_BITS(parity) + 1)
+
+// the second half-frame image starts with the 4th data bit, already on the
+// line; what's left of the data follows it, then the parity bit
+#define FORMAT_TX_TRAILER(data_bits) (0xff >> ((data_bits) - 3))
+#define FORMAT_TX_PARITY_BIT(data_bits) \
+    (FORMAT_TX_TRAILER(data_bits) & ~(FORMAT_TX_TRAILER(data_bits) >> 1))
+
+// the rest of the data bits, the parity bit and the stop bits; the overflow
+// comes as the last stop bit goes on the line
+#define FORMAT_SECOND_HALF_USISR(data_bits, parity, stop_bits) \
+    usisr_image(((data_bits) - 4) + FORMAT_PARITY_BITS(parity) + (stop_bits))
+
+#define FORMAT_FRAME_BITS(data_bits, parity, stop_bits) \
+    (1 + (data_bits) + FORMAT_PARITY_BITS(parity) + (stop_bits))
+
+// the port's format or, with USI_SERIAL_FIXED_FORMAT, the build's, as
+// constants, so the branches on it fold away
+#ifdef USI_SERIAL_FIXED_FORMAT
+#define FIXED_FRAME_FORMAT(data_bits, parity, stop_bits) \
+    USI_SERIAL_FRAME_FORMAT(data_bits, parity, stop_bits)
+#define FIXED_PARITY(parity) FIXED_PARITY_(parity)
+#define FIXED_PARITY_(parity) USI_SERIAL_PARITY_##parity
+
+static const USISerialFrameFormat fixed_format = FIXED_FRAME_FORMAT(
+    USI_SERIAL_FIXED_DATA_BITS, USI_SERIAL_FIXED_PARITY, USI_SERIAL_FIXED_STOP_BITS
+);
+
+#define DATA_BITS(port) USI_SERIAL_FIXED_DATA_BITS
+#define PARITY(port) FIXED_PARITY(USI_SERIAL_FIXED_PARITY)
+#define DATA_MASK(port) FORMAT_DATA_MASK(USI_SERIAL_FIXED_DATA_BITS)
+#define RX_SHIFT(port) FORMAT_RX_SHIFT(USI_SERIAL_FIXED_DATA_BITS)
+#define RX_TRAILER_BITS(port) FORMAT_RX_TRAILER_BITS(PARITY(port))
+#define TX_TRAILER(port) FORMAT_TX_TRAILER(USI_SERIAL_FIXED_DATA_BITS)
+#define TX_PARITY_BIT(port) FORMAT_TX_PARITY_BIT(USI_SERIAL_FIXED_DATA_BITS)
+#define SECOND_HALF_USISR(port) \
+    FORMAT_SECOND_HALF_USISR(USI_SERIAL_FIXED_DATA_BITS, PARITY(port), USI_SERIAL_FIXED_STOP_BITS)
+#define FRAME_BITS(port) \
+    FORMAT_FRAME_BITS(USI_SERIAL_FIXED_DATA_BITS, PARITY(port), USI_SERIAL_FIXED_STOP_BITS)
+#else
+#define DATA_BITS(port) ((port)->data_bits)
+#define PARITY(port) ((port)->parity)
+#define DATA_MASK(port) ((port)->data_mask)
+#define RX_SHIFT(port) ((port)->rx_shift)
+#define RX_TRAILER_BITS(port) ((port)->rx_trailer_bits)
+#define TX_TRAILER(port) ((port)->tx_trailer)
+#define TX_PARITY_BIT(port) ((port)->tx_parity_bit)
+#define SECOND_HALF_USISR(port) ((port)->second_half_usisr)
+#define FRAME_BITS(port) ((port)->frame_bits)
+#endif
+
+// fail the build for any rate that can't be used at F_CPU
+#define CHECK_BAUD_TIMING(baud) \
+    typedef char baud_##baud##_timing_out_of_range[USI_SERIAL_TIMING_OK(baud) ? 1 : -1];
+
+USI_SERIAL_BAUD_RATES(CHECK_BAUD_TIMING)
+
+// the rates auto-baud detection can settle on: each one's bit period, in
+// 1/256ths of a tick, and how far from it a measurement can be.  Only rates
+// with the port's prescaler, identified by its timer1 clock select, apply.
+typedef struct __auto_baud_rate {
+    uint32_t baud;
+    uint16_t bit_ticks_256;
+    uint16_t tolerance_256;
+    uint8_t clock_select;
+} AutoBaudRate;
+
+#define AUTO_BAUD_RATE(baud) \
+    { \
+        baud, \
+        USI_SERIAL_BIT_TICKS_256(baud), \
+        (USI_SERIAL_BIT_TICKS_256(baud) * USI_SERIAL_AUTO_BAUD_TOLERANCE) / 10000, \
+        USI_SERIAL_TIMER1_CLOCK_SELECT(baud) \
+    },
+
+static const AutoBaudRate auto_baud_rates[] PROGMEM = {
+    USI_SERIAL_BAUD_RATES(AUTO_BAUD_RATE)
+};
+
+#undef AUTO_BAUD_RATE
+
+#define AUTO_BAUD_RATE_COUNT (sizeof(auto_baud_rates) / sizeof(auto_baud_rates[0]))
+
+// the ports the interrupt vectors belong to.  usi_port has the USI, timer0
+// and PCINT0; timer1_port has timer1 and its RX pin's PCINT, and is either
+// a bit-banged port or usi_port in full duplex.
+static USISerialPort *usi_port;
+static USISerialPort *timer1_port;
+
+// see usi_serial_sleep()
+static volatile uint16_t idle_sleep_entries;
+static volatile uint16_t power_down_sleep_entries;
+
+#ifdef USI_SERIAL_TRACE
+#define TRACE_MASK (USI_SERIAL_TRACE_SIZE - 1)
+
+// trace_head is only written by trace(), trace_tail by usi_trace_read() and,
+// when the buffer's full, trace()
+static USITraceEntry trace_buffer[USI_SERIAL_TRACE_SIZE];
+static volatile uint8_t trace_head;
+static volatile uint8_t trace_tail;
+static volatile uint16_t trace_lost_count;
+
+// records an event, overwriting the oldest if the buffer's full.  Called from
+// the ISRs, or with interrupts disabled.
+static void trace(const USISerialPort *port, const USITraceEvent event, const uint8_t value) {
+    USITraceEntry *entry = &trace_buffer[trace_head & TRACE_MASK];
+    
+    entry->tcnt0 = USI_REG(port, TCNT0);
+    entry->event = event;
+    entry->value = value;
+    
+    if ((uint8_t)(trace_head - trace_tail) == USI_SERIAL_TRACE_SIZE) {
+        trace_tail += 1;
+        trace_lost_count += 1;
+    }
+    
+    trace_head += 1;
+}
+
+#define TRACE(port, event, value) trace(port, event, value)
+#else
+#define TRACE(port, event, value)
+#endif
+
+#ifdef USI_SERIAL_TIMESTAMPS
+static inline USISerialTimestamp timestamp_now(const USISerialPort *port) {
+    return port->clock ? port->clock() : 0;
+}
 
-typedef enum __usi_rx_state {
-    USIRX_STATE_IDLE,
-    USIRX_STATE_RECEIVING,
-    USIRX_STATE_WAITING_FOR_PARITY_BIT,
-} USIRxState;
+// records when a frame was sent, overwriting the oldest if there's no room.
+// Called from the ISRs.
+static void stamp_tx_frame(USISerialPort *port) {
+    const uint8_t head = port->tx_time_head;
+    
+    if ((uint8_t)(head - port->tx_time_tail) == USI_SERIAL_TX_BUFFER_SIZE) {
+        port->tx_time_tail += 1;
+        port->tx_time_lost_count += 1;
+    }
+    
+    port->tx_time[head & TX_BUFFER_MASK] = timestamp_now(port);
+    port->tx_time_head = head + 1;
+}
 
-typedef enum __usi_tx_state {
-    USITX_STATE_IDLE,
-    USITX_STATE_READY_FOR_FIRST_HALF_FRAME,
-    USITX_STATE_READY_FOR_SECOND_HALF_FRAME,
-    USITX_STATE_COMPLETE,
-} USITxState;
+// keeps the longest a handler's taken, from when it was called
+static void handler_returned(USISerialPort *port, const USISerialTimestamp called) {
+    const USISerialTimestamp taken = timestamp_now(port) - called;
+    
+    if (taken > port->max_handler_time) {
+        port->max_handler_time = taken;
+    }
+}
 
-static const USISerialRegisters *reg;
-static void (*received_byte_handler)(uint8_t);
+#define STAMP_RX_START(port) ((port)->rx_start_time = timestamp_now(port))
+#define STAMP_TX_FRAME(port) stamp_tx_frame(port)
+#else
+#define STAMP_RX_START(port)
+#define STAMP_TX_FRAME(port)
+#endif
 
-static bool even_parity_enabled;
-static uint8_t timer0_seed;
-static uint8_t initial_timer0_seed;
+// counts, and with USI_SERIAL_TIMESTAMPS stamps, a frame that's been sent
+static inline void tx_frame_sent(USISerialPort *port) {
+    port->tx_frame_count += 1;
+    STAMP_TX_FRAME(port);
+}
 
-static uint8_t pending_tx_byte;
-static volatile USIRxState rxState;
-static volatile USITxState txState;
+// counts a frame that's arrived while the RX PCINT was off for transmitting
+// in half duplex, if the line's low now it's going back on.  One that's on
+// a 1 bit goes unnoticed.
+static inline void check_missed_rx(USISerialPort *port) {
+    if ((USI_REG(port, PINB) & port->rx_pin_mask) == 0) {
+        port->rx_missed_count += 1;
+    }
+}
 
 // not part of the public interface
 static void usi_handle_ocra_reload(void);
 
+static inline void set_rx_state(USISerialPort *port, const USIRxState state) {
+    port->rxState = state;
+    TRACE(port, USI_TRACE_RX_STATE, state);
+}
+
+static inline void set_tx_state(USISerialPort *port, const USITxState state) {
+    port->txState = state;
+    TRACE(port, USI_TRACE_TX_STATE, state);
+}
+
+#ifdef USI_SERIAL_REVERSE_TABLE
+// every byte, reversed; 256 bytes of flash
+#define R2(n) (n), (n) + 2*64, (n) + 1*64, (n) + 3*64
+#define R4(n) R2(n), R2((n) + 2*16), R2((n) + 1*16), R2((n) + 3*16)
+#define R6(n) R4(n), R4((n) + 2*4), R4((n) + 1*4), R4((n) + 3*4)
+
+static const uint8_t reversed_bytes[256] PROGMEM = {
+    R6(0), R6(2), R6(1), R6(3)
+};
+
+#undef R2
+#undef R4
+#undef R6
+#endif
+
 // Reverses the order of bits in a byte.
 // i.e. MSB is swapped with LSB, etc.
 static inline uint8_t reverse_bits(const uint8_t to_swap) {
+    #ifdef USI_SERIAL_REVERSE_TABLE
+    return pgm_read_byte(&reversed_bytes[to_swap]);
+    #else
     uint8_t x = to_swap;
     
     x = ((x >> 1) & 0x55) | ((x << 1) & 0xaa);
     x = ((x >> 2) & 0x33) | ((x << 2) & 0xcc);
     x = ((x >> 4) & 0x0f) | ((x << 4) & 0xf0);
     
-    return x;    
+    return x;
+    #endif
 }
 
 /*
@@ -51,203 +272,1844 @@ static inline uint8_t reverse_bits(const uint8_t to_swap) {
  * Pass in the offset from the max value, or the number of increments before
  * overflowing.
  */
-static inline void set_usi_counter_and_clear_flags(const uint8_t count_until_overflow) {
-    *reg->pUSISR = 0xF0 | (USI_COUNTER_MAX_COUNT - count_until_overflow);
+static inline uint8_t usisr_image(const uint8_t count_until_overflow) {
+    return 0xF0 | (USI_COUNTER_MAX_COUNT - count_until_overflow);
+}
+
+static inline void set_usi_counter_and_clear_flags(const USISerialPort *port,
+                                                   const uint8_t count_until_overflow)
+{
+    USI_REG(port, USISR) = usisr_image(count_until_overflow);
 }
 
-static inline void enable_3wire_usi(const uint8_t count_until_overflow) {
-    set_usi_counter_and_clear_flags(count_until_overflow);
+static inline void enable_3wire_usi(const USISerialPort *port,
+                                    const uint8_t count_until_overflow)
+{
+    set_usi_counter_and_clear_flags(port, count_until_overflow);
     
     // enable USI overflow interrupt
     // set USI 3-wire mode
-    // set USI clock source to timer0 compare
-    *reg->pUSICR = _BV(USIOIE) | _BV(USIWM0) | _BV(USICS0);
+    // set USI clock source to timer0 compare, or to the software strobe the
+    // timer1 compare ISR gives it
+    USI_REG(port, USICR) = _BV(USIOIE) | _BV(USIWM0) |
+        ((port->bit_clock == USI_SERIAL_CLOCK_TIMER0) ? _BV(USICS0) : 0);
 }
 
-static inline void disable_usi(void) {
-    *reg->pUSICR = 0;
+static inline void disable_usi(const USISerialPort *port) {
+    USI_REG(port, USICR) = 0;
 }
 
-void usi_serial_init(const USISerialRegisters *_reg,
-                     void (*_handler)(uint8_t),
-                     const BaudRate baud_rate,
-                     const bool enable_even_parity)
+// the value of the parity bit for the given data bits.  Without a parity bit
+// the stop bit takes its place, so it's 1.
+static inline bool parity_bit(const USISerialPort *port, const uint8_t data) {
+    switch (PARITY(port)) {
+        case USI_SERIAL_PARITY_EVEN:
+            return parity_even_bit(data);
+        
+        case USI_SERIAL_PARITY_ODD:
+            return ! parity_even_bit(data);
+        
+        case USI_SERIAL_PARITY_SPACE:
+            return false;
+        
+        default: // USI_SERIAL_PARITY_NONE, USI_SERIAL_PARITY_MARK
+            return true;
+    }
+}
+
+// the whole frame for the given data bits, LSB first: the start bit, the
+// data, the parity bit and the stop bits
+static inline uint16_t frame_image(const USISerialPort *port, const uint8_t data) {
+    uint16_t frame = ((uint16_t) 0xffff << (1 + DATA_BITS(port))) | (data << 1);
+    
+    if (! parity_bit(port, data)) {
+        frame &= ~(1 << (1 + DATA_BITS(port)));
+    }
+    
+    return frame;
+}
+
+// builds the images the ISRs send a frame from: for the USI, both halves;
+// bit-banged, the whole frame, split in two
+static void build_frame(const USISerialPort *port, const uint8_t data,
+                        uint8_t *first_half, uint8_t *second_half)
 {
-    reg = _reg;
-    received_byte_handler = _handler;
-    even_parity_enabled = enable_even_parity;
+    if (port->bit_banged) {
+        const uint16_t frame = frame_image(port, data);
+        
+        *first_half = frame & 0xff;
+        *second_half = frame >> 8;
+        
+        return;
+    }
     
-    /*
-    F_CPU = 8000000 Hz => 0.125 µS / cycle
+    // the USI shifts out MSB first, so the byte's reversed
+    const uint8_t reversed = reverse_bits(data);
+    
+    // the bit on the line, the start bit and the first 4 data bits
+    *first_half = 0x80 | (reversed >> 2);
+    
+    // the 4th data bit, now on the line, the rest of the data, then the
+    // parity and stop bits
+    *second_half = (reversed << 3) | TX_TRAILER(port);
+    
+    if (! parity_bit(port, data)) {
+        *second_half &= ~TX_PARITY_BIT(port);
+    }
+}
 
-    F_CPU/8 = 1000000 Hz => 1 µS / cycle
+static inline bool tx_queue_empty(const USISerialPort *port) {
+    return port->tx_head == port->tx_tail;
+}
 
-    baud rate = 9600
-    9600 bits/1 second
-    104.16667 µS/1 bit
-    52.083 µS/0.5 bit
+// true if the peer's asked us to pause, by XOFF or with CTS high
+static inline bool peer_stopped(const USISerialPort *port) {
+    return port->tx_stopped || (USI_REG(port, PINB) & port->cts_pin_mask);
+}
 
-    cycles/bit = F_CPU/(baud * prescale)
+// true if there's a frame to send next: XON or XOFF, or a queued byte the
+// peer's ready for
+static inline bool tx_ready(const USISerialPort *port) {
+    return (port->tx_control != 0) || (! tx_queue_empty(port) && ! peer_stopped(port));
+}
 
-                  Timer Seed   % err    
-    F_CPU (kHz)   ====== 8000 ======     
-    prescale                             
-       1                --       --      
-       8           104.167    0.160      
-      64            13.021    0.161      
-     256             3.255    7.834      
-    1024                --       --      
-    */
+// true if a frame can be started now: TX is idle, there's one ready and, in
+// half duplex, RX is idle
+static inline bool tx_startable(const USISerialPort *port) {
+    if ((port->txState != USITX_STATE_IDLE) || ! tx_ready(port)) {
+        return false;
+    }
+    
+    if (port->full_duplex) {
+        return port->rxState != USIRX_STATE_DETECTING_BAUD;
+    }
     
-    // cycles/bit = F_CPU/(baud * prescale)
-    timer0_seed = (F_CPU / baud_rate) / 8;
+    return (port->rxState == USIRX_STATE_IDLE) && ! port->rx_idle_timing;
+}
+
+// removes the next frame from the transmit queue for the ISRs; XON or XOFF
+// go first
+static inline void dequeue_pending_tx_byte(USISerialPort *port) {
+    if (port->tx_control != 0) {
+        const uint8_t *image =
+            (port->tx_control == USI_SERIAL_XON) ? port->xon_image : port->xoff_image;
+        
+        port->pending_first_half = image[0];
+        port->pending_second_half = image[1];
+        port->tx_control = 0;
+    }
+    else {
+        port->pending_first_half = port->tx_first_half[port->tx_tail & TX_BUFFER_MASK];
+        port->pending_second_half = port->tx_second_half[port->tx_tail & TX_BUFFER_MASK];
+        port->tx_tail += 1;
+    }
     
-    // 1.5 times timer0_seed
-    initial_timer0_seed = ((timer0_seed * 3) / 2) - PCINT_STARTUP_DELAY;
+    port->active_bit_count += FRAME_BITS(port);
+}
 
-    rxState = USIRX_STATE_IDLE;
-    txState = USITX_STATE_IDLE;
+// load USIDR with a 1, the start bit, and the first 5 bits of the byte; the 1
+// is the bit currently on the line, either idle or the previous stop bit
+static inline void load_first_half_frame(USISerialPort *port) {
+    USI_REG(port, USIDR) = port->pending_first_half;
     
-    // yes, we're configuring TX as *input* as well, so that the internal
-    // pull-up keeps the line high.  This will be overridden by the USI when
-    // switching to 3-wire mode
-    *reg->pDDRB  &= ~(_BV(PB0) | _BV(PB1)); // set RX *and* TX pins as inputs
-    *reg->pPORTB |= _BV(PB0) | _BV(PB1);    // enable pull-up on RX *and* TX pins
+    // set up next overflow to reload USIDR with the remaining
+    // half of the byte
+    set_usi_counter_and_clear_flags(port, HALF_FRAME);
+    
+    set_tx_state(port, USITX_STATE_READY_FOR_SECOND_HALF_FRAME);
+}
+
+// dithered rates need the OCR0A compare interrupt for every bit of a frame
+static inline void start_dithering(USISerialPort *port) {
+    // start half-way, so the error's spread evenly either side
+    port->timer0_fraction_acc = 0x80;
     
-    disable_usi();
+    if (port->bit_seed_fraction != 0) {
+        timer0_enable_ocra_interrupt();
+    }
+}
+
+// the bit period, in 1/256ths of a tick
+static inline uint16_t bit_ticks_256(const USISerialPort *port) {
+    return (((uint16_t) port->bit_seed + 1) << 8) + port->bit_seed_fraction;
+}
+
+// the bit period in 1/256ths of a tick at timer0's prescaler, as calculated
+// at compile time, whether or not timer0 dithers it
+static uint16_t exact_bit_ticks_256(const BaudRate baud_rate) {
+    switch (baud_rate) {
+        #define BAUD_TICKS_CASE(baud) \
+            case BAUD_##baud: \
+                return USI_SERIAL_BIT_TICKS_256(baud);
+        
+        USI_SERIAL_BAUD_RATES(BAUD_TICKS_CASE)
+        
+        #undef BAUD_TICKS_CASE
         
-    *reg->pGIFR  &= ~_BV(PCIF);  // clear PCI flag, just because
-    *reg->pGIMSK |= _BV(PCIE);   // enable PCIs
-    *reg->pPCMSK |= _BV(PCINT0); // enable PCINT0
+        default:
+            return 0;
+    }
+}
+
+// true if timer1's ISR can take every bit at the rate, behind the USI port's
+// ISRs; see USI_SERIAL_TIMER1_MIN_BIT_CYCLES
+static inline bool timer1_keeps_up(const uint32_t baud) {
+    return (baud * USI_SERIAL_TIMER1_MIN_BIT_CYCLES) <= F_CPU;
+}
+
+// sets the start-bit seeds from the bit period and start-bit delay, when
+// either's been measured or rescaled rather than calculated at compile time:
+// the middle of the first data bit is 1.5 bit periods after the start bit's
+// falling edge
+static void set_initial_seeds(USISerialPort *port) {
+    const uint32_t ticks_256 = (((uint32_t) bit_ticks_256(port) * 3) >> 1) - port->startup_ticks_256;
     
-    // prepare timer0; not started until PCINT0 fires or a byte is transmitted
-    timer0_set_ocra_interrupt_handler(&usi_handle_ocra_reload);
-    timer0_enable_ctc();
-    timer0_stop();
+    port->initial_timer0_seed = ((ticks_256 + 128) >> 8) - 1;
+    port->initial_timer1_seed =
+        (port->initial_timer0_seed > port->timer1_sample_ticks) ?
+            (port->initial_timer0_seed - port->timer1_sample_ticks) : 0;
+}
+
+// the idle timeout, in ticks from the sample point of a frame's stop bit:
+// the rest of the stop bit, then idle_bits bit periods
+static void set_idle_ticks(USISerialPort *port) {
+    port->idle_ticks =
+        (((uint32_t) bit_ticks_256(port) * ((2 * port->idle_bits) + 1)) + 256) >> 9;
+}
+
+// times the next chunk of the idle timeout, as much as timer0 can count.  The
+// timer's just been cleared, or has been counting since the stop bit's sample.
+static inline void set_idle_chunk(USISerialPort *port) {
+    port->idle_chunk = (port->idle_ticks_left > 256) ? 256 : port->idle_ticks_left;
+    
+    timer0_set_ocra(port->idle_chunk - 1);
 }
 
-uint8_t usi_tx_byte(const uint8_t b) {
-    // wait for tx- or rx-in-progress to complete
+// starts timing the idle line after the stop bit, with timer0 still running
+static void start_idle_timeout(USISerialPort *port) {
+    port->idle_ticks_left = port->idle_ticks;
+    port->rx_idle_timing = true;
     
-    while ((rxState != USIRX_STATE_IDLE) || (txState != USITX_STATE_IDLE));
+    set_idle_chunk(port);
+    timer0_enable_ocra_interrupt();
+}
 
-    *reg->pPCMSK &= ~_BV(PCINT0); // disable PCINT0
-    *reg->pUSIDR = 0xff;          // drive line high until data provided
-    *reg->pDDRB |= _BV(PB1);      // configure PB1 as output
+// starts timer1 clocking bits, the first compare after first_seed+1 ticks
+static void start_timer1(USISerialPort *port, const uint8_t first_seed) {
+    TIMER1_REG(port, TCNT1) = 0;
+    TIMER1_REG(port, OCR1A) = first_seed;
+    TIMER1_REG(port, OCR1C) = first_seed;
+    TIMER1_REG(port, TIFR) = _BV(OCF1A);
+    TIMER1_REG(port, TIMSK) |= _BV(OCIE1A);
+    TIMER1_REG(port, TCCR1) = _BV(CTC1) | port->timer1_clock_select;
     
-    txState = USITX_STATE_READY_FOR_FIRST_HALF_FRAME;
+    port->timer1_fraction_acc = 0x80;
+}
+
+static inline void stop_timer1(const USISerialPort *port) {
+    TIMER1_REG(port, TCCR1) = 0;
+    TIMER1_REG(port, TIMSK) &= ~_BV(OCIE1A);
+}
+
+// starts the USI's bit clock, the first bit after first_seed+1 ticks:
+// timer0's compare match, dithered by its ISR if need be, or the timer1
+// compare ISR, which always dithers
+static inline void start_bit_clock(USISerialPort *port, const uint8_t first_seed) {
+    if (port->bit_clock == USI_SERIAL_CLOCK_TIMER1) {
+        start_timer1(port, first_seed);
+        return;
+    }
     
-    // reverse byte
-    pending_tx_byte = reverse_bits(b);
+    timer0_set_counter(0);
+    timer0_set_ocra(first_seed);
+    timer0_start();
     
-    enable_3wire_usi(1); // timer to just-about-to-overflow
+    start_dithering(port);
+}
+
+// starts the USI's bit clock for a frame coming in, the first bit in the
+// middle of the first data bit, less the start-bit delay.  Timer0's compare
+// ISR then sets the bit period; timer1's is brought forward by the time its
+// ISR takes to strobe the USI.
+static inline void start_rx_bit_clock(USISerialPort *port) {
+    if (port->bit_clock == USI_SERIAL_CLOCK_TIMER1) {
+        start_timer1(port, port->initial_timer1_seed);
+        return;
+    }
     
     timer0_set_counter(0);
-    timer0_set_ocra(timer0_seed);
+    timer0_set_ocra(port->initial_timer0_seed);
+    timer0_enable_ocra_interrupt();
     timer0_start();
+}
 
-    return 0;
+static inline void stop_bit_clock(const USISerialPort *port) {
+    if (port->bit_clock == USI_SERIAL_CLOCK_TIMER1) {
+        stop_timer1(port);
+        return;
+    }
+    
+    timer0_stop();
+    timer0_disable_ocra_interrupt();
 }
 
-// @todo refactor this so that the PCINT0 ISR is configured in main()
-ISR(PCINT0_vect) {
-    if ((*reg->pPINB & _BV(PB0)) == 0) {
-        // PB0 is low; start bit received
-        // do the time-critical stuff first
+// loads the next frame's image for the timer1 compare ISR to shift out,
+// after an extra idle bit unless streaming
+static inline void load_bit_banged_frame(USISerialPort *port) {
+    dequeue_pending_tx_byte(port);
+    
+    port->tx_frame = port->pending_first_half | (port->pending_second_half << 8);
+    port->tx_bits_left = FRAME_BITS(port);
+    
+    if (! port->tx_streaming_enabled && (port->txState != USITX_STATE_IDLE)) {
+        port->tx_frame = (port->tx_frame << 1) | 1;
+        port->tx_bits_left += 1;
+    }
+}
+
+// shifts the next bit of a bit-banged port's frame onto the TX pin, starting
+// the next frame or stopping once the last stop bit's had its full time
+static inline void send_next_bit(USISerialPort *port) {
+    if (port->tx_bits_left == 0) {
+        // the last frame's stop bits are done
+        tx_frame_sent(port);
         
-        // configure the timer to fire the OCR0A compare interrupt in the
-        // middle of the first data bit
-        timer0_set_counter(0);
-        timer0_set_ocra(initial_timer0_seed);
-        timer0_enable_ocra_interrupt();
-        timer0_start();
+        if (! tx_ready(port)) {
+            stop_timer1(port);
+            check_missed_rx(port);
+            USI_REG(port, PCMSK) |= port->rx_pin_mask; // re-enable the RX PCINT
+            
+            set_tx_state(port, USITX_STATE_IDLE);
+            
+            return;
+        }
         
-        // ----- configure the USI
-        // overflow should occur when all data bits are received
-        enable_3wire_usi(DATA_BITS);
+        load_bit_banged_frame(port);
+    }
+    
+    if (port->tx_frame & 1) {
+        USI_REG(port, PORTB) |= port->tx_pin_mask;
+    }
+    else {
+        USI_REG(port, PORTB) &= ~port->tx_pin_mask;
+    }
+    
+    port->tx_frame >>= 1;
+    port->tx_bits_left -= 1;
+}
+
+// begins transmitting the byte at the head of the queue.  Must be called with
+// interrupts disabled, or from an ISR, with TX idle and, in half duplex, RX
+// idle.
+static void start_tx(USISerialPort *port) {
+    if (! port->full_duplex) {
+        USI_REG(port, PCMSK) &= ~port->rx_pin_mask; // disable the RX PCINT
+    }
+    
+    if (port->bit_banged) {
+        load_bit_banged_frame(port);
+        set_tx_state(port, USITX_STATE_SENDING_BITS);
         
-        // ----- time-critical stuff done
-        *reg->pPCMSK &= ~_BV(PCINT0); // disable PCINT0
+        // the start bit goes out now, the rest on each compare.  Starting
+        // the timer with a seed of 0 instead would match again before the
+        // ISR had set the bit's length.
+        send_next_bit(port);
+        start_timer1(port, port->bit_seed);
         
-        rxState = USIRX_STATE_RECEIVING;
+        return;
     }
+    
+    USI_REG(port, USIDR) = 0xff;          // drive line high until data provided
+    USI_REG(port, DDRB) |= _BV(PB1);      // configure PB1 as output
+    
+    set_tx_state(port, USITX_STATE_READY_FOR_FIRST_HALF_FRAME);
+    
+    dequeue_pending_tx_byte(port);
+    
+    enable_3wire_usi(port, 1); // timer to just-about-to-overflow
+    
+    start_bit_clock(port, port->bit_seed);
 }
 
-static void usi_handle_ocra_reload() {
-    // set the OCR0A match to the bit duration and disable the OCR0A compare
-    // interrupt; with CTC mode, the timer's reset, and the OCR0A match clocks
-    // the USI in hardware
+// the state common to both kinds of port
+static void init_port(USISerialPort *port,
+                      const USISerialRegisters *reg,
+                      void (*handler)(uint8_t, uint8_t),
+                      const BaudRate baud_rate,
+                      const USISerialFrameFormat *format)
+{
+    port->reg = reg;
+    port->received_byte_handler = handler;
+    port->timer1_reg = NULL;
+    port->bit_clock = USI_SERIAL_CLOCK_TIMER0;
+    port->bit_banged = false;
+    port->full_duplex = false;
     
-    timer0_set_ocra(timer0_seed);
-    timer0_disable_ocra_interrupt();
+    #ifdef USI_SERIAL_FIXED_FORMAT
+    // the build's, whatever's passed
+    format = &fixed_format;
+    #endif
+    
+    // anything unsupported falls back to 8 data bits and 1 stop bit
+    port->data_bits = (format->data_bits == 7) ? 7 : MAX_DATA_BITS;
+    port->parity = format->parity;
+    
+    const uint8_t stop_bits = (format->stop_bits == 2) ? 2 : 1;
+    
+    port->data_mask = FORMAT_DATA_MASK(port->data_bits);
+    port->rx_shift = FORMAT_RX_SHIFT(port->data_bits);
+    port->rx_trailer_bits = FORMAT_RX_TRAILER_BITS(port->parity);
+    port->tx_trailer = FORMAT_TX_TRAILER(port->data_bits);
+    port->tx_parity_bit = FORMAT_TX_PARITY_BIT(port->data_bits);
+    port->second_half_usisr = FORMAT_SECOND_HALF_USISR(port->data_bits, port->parity, stop_bits);
+    
+    // the whole frame, for bit-banged ports
+    port->frame_bits = FORMAT_FRAME_BITS(port->data_bits, port->parity, stop_bits);
+    
+    port->tx_streaming_enabled = false;
+    
+    port->baud_rate = baud_rate;
+    port->calibration_frames_left = 0;
+    
+    // seeds are calculated at compile time; see usi_serial_timing.h
+    switch (baud_rate) {
+        #define BAUD_TIMING_CASE(baud) \
+            case BAUD_##baud: \
+                port->bit_seed = USI_SERIAL_TIMER0_SEED(baud); \
+                port->bit_seed_fraction = USI_SERIAL_TIMER0_FRACTION(baud); \
+                port->initial_timer0_seed = USI_SERIAL_INITIAL_TIMER0_SEED(baud); \
+                port->timer1_clock_select = USI_SERIAL_TIMER1_CLOCK_SELECT(baud); \
+                port->initial_timer1_seed = USI_SERIAL_INITIAL_TIMER1_SEED(baud); \
+                port->startup_ticks_256 = USI_SERIAL_CYCLES_TICKS_256(baud, USI_SERIAL_PCINT_STARTUP_CYCLES); \
+                port->entry_ticks_256 = USI_SERIAL_CYCLES_TICKS_256(baud, USI_SERIAL_PCINT_ENTRY_CYCLES); \
+                port->timer1_sample_ticks = USI_SERIAL_TIMER1_SAMPLE_TICKS(baud); \
+                break;
+        
+        USI_SERIAL_BAUD_RATES(BAUD_TIMING_CASE)
+        
+        #undef BAUD_TIMING_CASE
+        
+        default:
+            break;
+    }
+    
+    port->rxState = USIRX_STATE_IDLE;
+    port->txState = USITX_STATE_IDLE;
+    
+    #ifdef USI_SERIAL_TRACE
+    trace_head = 0;
+    trace_tail = 0;
+    trace_lost_count = 0;
+    #endif
+    
+    port->tx_head = 0;
+    port->tx_tail = 0;
+    
+    port->rx_head = 0;
+    port->rx_tail = 0;
+    port->rx_overrun_count = 0;
+    port->rx_parity_error_count = 0;
+    port->rx_framing_error_count = 0;
+    port->active_bit_count = 0;
+    
+    port->rx_frame_count = 0;
+    port->tx_frame_count = 0;
+    port->tx_sleep_entry_count = 0;
+    port->tx_held_by_rx_count = 0;
+    port->rx_missed_count = 0;
+    
+    port->rx_handoff_head = 0;
+    port->rx_handoff_tail = 0;
+    port->rx_delivering = false;
+    
+    #ifdef USI_SERIAL_TIMESTAMPS
+    port->clock = NULL;
+    port->rx_delivered_time = 0;
+    port->max_handler_time = 0;
+    port->tx_time_head = 0;
+    port->tx_time_tail = 0;
+    port->tx_time_lost_count = 0;
+    #endif
+    
+    port->idle_bits = 0;
+    port->rx_idle_timing = false;
+    port->message_delivering = false;
+    
+    port->flow_control = USI_SERIAL_FLOW_NONE;
+    port->rts_pin_mask = 0;
+    port->cts_pin_mask = 0;
+    port->rx_throttled = false;
+    port->tx_stopped = false;
+    port->tx_control = 0;
 }
 
-// USI overflow interrupt.  Configured to occur when the desired number of bits
-// have been shifted in (in reverse order!)
-ISR(USI_OVF_vect) {
-    if (txState != USITX_STATE_IDLE) {
-        if (txState == USITX_STATE_READY_FOR_FIRST_HALF_FRAME) {
-            // load USIDR with a 1, the start bit, and the first 5 bits of the byte
-            *reg->pUSIDR = 0x80 | (pending_tx_byte >> 2);
-
-            // set up next overflow to reload USIDR with the remaining
-            // half of the byte
-            set_usi_counter_and_clear_flags(HALF_FRAME);
-            
-            txState = USITX_STATE_READY_FOR_SECOND_HALF_FRAME;
-        }
-        else if (txState == USITX_STATE_READY_FOR_SECOND_HALF_FRAME) {
-            // load USIDR with the last 5 bits of the byte and pad with 1s
-            *reg->pUSIDR = (pending_tx_byte << 3) | 0x07;
-            
-            if (even_parity_enabled) {
-                if (parity_even_bit(pending_tx_byte)) {
-                    *reg->pUSIDR |= _BV(2);
-                }
-                else {
-                    *reg->pUSIDR &= ~_BV(2);
-                }
-
-                // set up next overflow to shut down USI; additional tick for
-                // parity bit
-                set_usi_counter_and_clear_flags(HALF_FRAME + 1);
-            }
-            else {
-                // set up next overflow to shut down USI
-                set_usi_counter_and_clear_flags(HALF_FRAME);
-            }
+// the state common to USI-backed ports on either timer
+static void init_usi_port(USISerialPort *port,
+                          const USISerialRegisters *reg,
+                          void (*handler)(uint8_t, uint8_t),
+                          const BaudRate baud_rate,
+                          const USISerialFrameFormat *format)
+{
+    init_port(port, reg, handler, baud_rate, format);
+    
+    port->rx_pin_mask = _BV(PB0);
+    port->tx_pin_mask = _BV(PB1);
+    
+    if (timer1_port && ! timer1_port->bit_banged) {
+        // the USI's last port, in full duplex or on timer1
+        timer1_port = NULL;
+    }
+    
+    usi_port = port;
+    
+    // yes, we're configuring TX as *input* as well, so that the internal
+    // pull-up keeps the line high.  This will be overridden by the USI when
+    // switching to 3-wire mode
+    USI_REG(port, DDRB)  &= ~(_BV(PB0) | _BV(PB1)); // set RX *and* TX pins as inputs
+    USI_REG(port, PORTB) |= _BV(PB0) | _BV(PB1);    // enable pull-up on RX *and* TX pins
+    
+    disable_usi(port);
+    
+    USI_REG(port, GIFR)  &= ~_BV(PCIF);  // clear PCI flag, just because
+    USI_REG(port, GIMSK) |= _BV(PCIE);   // enable PCIs
+    USI_REG(port, PCMSK) |= _BV(PCINT0); // enable PCINT0
+}
 
-            txState = USITX_STATE_COMPLETE;
-        }
-        else /* USITX_STATE_COMPLETE */ {
-            disable_usi();
-            *reg->pPCMSK |= _BV(PCINT0); // re-enable PCINT
-            *reg->pDDRB &= ~_BV(PB1);    // PB1 as input
-            *reg->pPORTB |= _BV(PB1);    // PB1 internal pull-up enabled
-            
-            txState = USITX_STATE_IDLE;
-        }
+void usi_serial_init(USISerialPort *port,
+                     const USISerialRegisters *reg,
+                     void (*handler)(uint8_t, uint8_t),
+                     const BaudRate baud_rate,
+                     const USISerialFrameFormat *format)
+{
+    init_usi_port(port, reg, handler, baud_rate, format);
+    
+    // prepare timer0; not started until PCINT0 fires or a byte is transmitted
+    timer0_set_ocra_interrupt_handler(&usi_handle_ocra_reload);
+    timer0_enable_ctc();
+    timer0_stop();
+}
+
+bool usi_serial_init_timer1(USISerialPort *port,
+                            const USISerialRegisters *reg,
+                            const USISerialTimer1Registers *timer1_reg,
+                            void (*handler)(uint8_t, uint8_t),
+                            const BaudRate baud_rate,
+                            const USISerialFrameFormat *format)
+{
+    if (timer1_port && timer1_port->bit_banged) {
+        // timer1's a bit-banged port's
+        return false;
     }
-    else {
-        if (rxState == USIRX_STATE_RECEIVING) {
-            // WARNING! this is being called in an ISR and MUST be very fast!
-            received_byte_handler(reverse_bits(*reg->pUSIBR));
-        }
+    
+    init_usi_port(port, reg, handler, baud_rate, format);
+    
+    port->timer1_reg = timer1_reg;
+    port->bit_clock = USI_SERIAL_CLOCK_TIMER1;
+    
+    // the compile-time timing's at timer0's prescaler.  Timer1's has every
+    // power of two, so halve it for as long as 1.5 bit periods still fit in
+    // 8 bits, doubling the ticks in each period.  The 1/256ths of a tick
+    // kept by the timing shift up into whole ticks, without dividing, even
+    // where timer0 rounds the period to a whole tick.
+    uint16_t ticks_256 = exact_bit_ticks_256(baud_rate);
+    
+    while ((port->timer1_clock_select > 1) &&
+           (((uint32_t) ticks_256 * 3) <= (255UL << 8)))
+    {
+        ticks_256 <<= 1;
+        port->startup_ticks_256 <<= 1;
+        port->entry_ticks_256 <<= 1;
+        port->timer1_clock_select -= 1;
+    }
+    
+    port->bit_seed = (ticks_256 >> 8) - 1;
+    port->bit_seed_fraction = ticks_256 & 0xff;
+    
+    // the compare ISR strobes the USI as it starts, so only its entry's
+    // brought forward, not a transmit ISR as in full duplex
+    port->timer1_sample_ticks = (port->entry_ticks_256 + 128) >> 8;
+    
+    set_initial_seeds(port);
+    
+    timer1_port = port;
+    
+    stop_timer1(port);
+    
+    return true;
+}
 
-        if (even_parity_enabled && (rxState == USIRX_STATE_RECEIVING)) {
-            // clear interrupt flags, prepare for parity bit count
-            // overflow should occur when all parity bits are received
-            set_usi_counter_and_clear_flags(PARITY_BITS);
-            rxState = USIRX_STATE_WAITING_FOR_PARITY_BIT;
-        }
-        else {
-            // disable timer
-            timer0_stop();
-            
-            disable_usi();
-            *reg->pPCMSK |= _BV(PCINT0); // re-enable PCINT
+bool usi_serial_enable_full_duplex(USISerialPort *port,
+                                   const USISerialTimer1Registers *timer1_reg)
+{
+    if (port->bit_clock == USI_SERIAL_CLOCK_TIMER1) {
+        // timer1's the USI's clock, and timer0's not ours
+        return false;
+    }
+    
+    if (! timer1_keeps_up(port->baud_rate)) {
+        return false;
+    }
+    
+    port->timer1_reg = timer1_reg;
+    port->full_duplex = true;
+    
+    timer1_port = port;
+    
+    // timer0's needed for transmitting now
+    port->idle_bits = 0;
+    
+    // stopped until a start bit arrives
+    stop_timer1(port);
+    
+    return true;
+}
 
-            rxState = USIRX_STATE_IDLE;
+bool usi_serial_set_idle_timeout(USISerialPort *port,
+                                 const uint8_t idle_bits,
+                                 uint8_t *buf,
+                                 const uint8_t size,
+                                 void (*message_handler)(uint8_t *, uint8_t, uint8_t))
+{
+    if (port->timer1_reg != NULL) {
+        // bit-banged, or in full duplex
+        return false;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        port->message_buf = buf;
+        port->message_size = size;
+        port->message_len = 0;
+        port->message_status = 0;
+        port->message_handler = message_handler;
+        
+        port->idle_bits = idle_bits;
+        set_idle_ticks(port);
+    }
+    
+    return true;
+}
+
+bool usi_serial_set_flow_control(USISerialPort *port,
+                                 const USISerialFlowControl flow_control,
+                                 const uint8_t rts_pin,
+                                 const uint8_t cts_pin,
+                                 const uint8_t high_watermark,
+                                 const uint8_t low_watermark)
+{
+    if ((high_watermark > USI_SERIAL_RX_BUFFER_SIZE) || (low_watermark >= high_watermark)) {
+        return false;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        port->flow_control = flow_control;
+        port->rx_high_watermark = high_watermark;
+        port->rx_low_watermark = low_watermark;
+        port->rx_throttled = false;
+        port->tx_stopped = false;
+        port->tx_control = 0;
+        port->rts_pin_mask = 0;
+        port->cts_pin_mask = 0;
+        
+        if (flow_control == USI_SERIAL_FLOW_RTS_CTS) {
+            port->rts_pin_mask = _BV(rts_pin);
+            port->cts_pin_mask = _BV(cts_pin);
+            
+            // RTS driven low, ready; CTS pulled up, so a peer that's not there
+            // holds us off
+            USI_REG(port, PORTB) &= ~port->rts_pin_mask;
+            USI_REG(port, DDRB) |= port->rts_pin_mask;
+            USI_REG(port, DDRB) &= ~port->cts_pin_mask;
+            USI_REG(port, PORTB) |= port->cts_pin_mask;
+            
+            USI_REG(port, GIMSK) |= _BV(PCIE);
+            USI_REG(port, PCMSK) |= port->cts_pin_mask;
+        }
+        else if (flow_control == USI_SERIAL_FLOW_XON_XOFF) {
+            build_frame(port, USI_SERIAL_XON, &port->xon_image[0], &port->xon_image[1]);
+            build_frame(port, USI_SERIAL_XOFF, &port->xoff_image[0], &port->xoff_image[1]);
+        }
+    }
+    
+    return true;
+}
+
+bool usi_serial_rx_throttled(USISerialPort *port) {
+    return port->rx_throttled;
+}
+
+bool usi_serial_tx_stopped(USISerialPort *port) {
+    return peer_stopped(port);
+}
+
+void usi_serial_start_auto_baud(USISerialPort *port) {
+    if (port->bit_clock == USI_SERIAL_CLOCK_TIMER1) {
+        // the edges are timed with timer0
+        return;
+    }
+    
+    // count the falling edges of the sync frame in this format.  The first
+    // four are always two bits apart; the fifth, if the frame has one,
+    // follows them at the same spacing.
+    uint16_t frame = frame_image(port, USI_SERIAL_AUTO_BAUD_SYNC & DATA_MASK(port));
+    uint8_t last = 1;
+    uint8_t edges = 0;
+    
+    for (uint8_t i = 0; i < FRAME_BITS(port); i++) {
+        if (last && ! (frame & 1)) {
+            edges += 1;
+        }
+        
+        last = frame & 1;
+        frame >>= 1;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        port->sync_edges = edges;
+        
+        // measure over 8 bits if there are 4 whole intervals, else 4 bits;
+        // both are a power of two, so the bit period's found with a shift
+        port->sync_intervals = (edges >= 5) ? 4 : 2;
+        
+        port->auto_baud_edges = 0;
+        port->baud_rate = 0;
+        
+        set_rx_state(port, USIRX_STATE_DETECTING_BAUD);
+    }
+}
+
+BaudRate usi_serial_baud_rate(USISerialPort *port) {
+    BaudRate baud_rate;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        baud_rate = port->baud_rate;
+    }
+    
+    return baud_rate;
+}
+
+void usi_serial_calibrate(USISerialPort *port) {
+    if (port->bit_clock == USI_SERIAL_CLOCK_TIMER1) {
+        // the first data bit's timed with timer0
+        return;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        port->calibration_ticks = 0;
+        port->calibration_frames_left = USI_SERIAL_CALIBRATION_FRAMES;
+    }
+}
+
+bool usi_serial_calibrating(USISerialPort *port) {
+    bool calibrating;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        calibrating = (port->calibration_frames_left != 0);
+    }
+    
+    return calibrating;
+}
+
+uint16_t usi_serial_startup_cycles(USISerialPort *port) {
+    uint16_t ticks_256;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks_256 = port->startup_ticks_256;
+    }
+    
+    // timer1's clock select is one more than the log2 of the prescaler
+    return (((uint32_t) ticks_256 << (port->timer1_clock_select - 1)) + 128) >> 8;
+}
+
+// true if the port needs a timer clocked: mid-frame, timing the idle line or
+// timing the sync character's edges after the first
+static bool needs_clock(const USISerialPort *port) {
+    if (port == NULL) {
+        return false;
+    }
+    
+    if (port->rxState == USIRX_STATE_DETECTING_BAUD) {
+        return port->auto_baud_edges != 0;
+    }
+    
+    if (port->rx_idle_timing) {
+        return true;
+    }
+    
+    return (port->rxState != USIRX_STATE_IDLE) || (port->txState != USITX_STATE_IDLE);
+}
+
+// sleeps until the next interrupt, powering down only if allowed and no
+// port needs a clock
+static void sleep_until_interrupt(USISerialPort *port, const bool power_down) {
+    volatile uint8_t *mcucr = &USI_REG(port, MCUCR);
+    uint8_t mode = 0; // idle
+    
+    cli();
+    
+    if (! power_down ||
+        needs_clock(usi_port) || needs_clock(timer1_port) || needs_clock(port))
+    {
+        idle_sleep_entries += 1;
+    }
+    else {
+        mode = _BV(SM1); // power-down
+        power_down_sleep_entries += 1;
+    }
+    
+    *mcucr = (*mcucr & ~(_BV(SM1) | _BV(SM0))) | mode | _BV(SE);
+    
+    // the instruction after sei() always runs before any interrupt, so one
+    // that's come in since the check above wakes the MCU straight away
+    sei();
+    sleep_cpu();
+    
+    *mcucr &= ~_BV(SE);
+}
+
+void usi_serial_sleep(USISerialPort *port) {
+    sleep_until_interrupt(port, true);
+}
+
+void usi_serial_idle(USISerialPort *port) {
+    sleep_until_interrupt(port, false);
+}
+
+uint16_t usi_serial_idle_sleep_entries(void) {
+    uint16_t count;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = idle_sleep_entries;
+    }
+    
+    return count;
+}
+
+uint16_t usi_serial_power_down_sleep_entries(void) {
+    uint16_t count;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = power_down_sleep_entries;
+    }
+    
+    return count;
+}
+
+uint32_t usi_serial_active_bits(USISerialPort *port) {
+    uint32_t bits;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        bits = port->active_bit_count;
+    }
+    
+    return bits;
+}
+
+bool usi_serial_init_bit_banged(USISerialPort *port,
+                                const USISerialRegisters *reg,
+                                const USISerialTimer1Registers *timer1_reg,
+                                const uint8_t rx_pin,
+                                const uint8_t tx_pin,
+                                void (*handler)(uint8_t, uint8_t),
+                                const BaudRate baud_rate,
+                                const USISerialFrameFormat *format)
+{
+    if (usi_port && (usi_port->bit_clock == USI_SERIAL_CLOCK_TIMER1)) {
+        // timer1's the USI port's bit clock, and timer0 may not be ours to
+        // move it back to
+        return false;
+    }
+    
+    if (! timer1_keeps_up(baud_rate)) {
+        return false;
+    }
+    
+    init_port(port, reg, handler, baud_rate, format);
+    
+    port->timer1_reg = timer1_reg;
+    port->bit_banged = true;
+    port->rx_pin_mask = _BV(rx_pin);
+    port->tx_pin_mask = _BV(tx_pin);
+    
+    if (usi_port && (timer1_port == usi_port)) {
+        // timer1's ours now
+        usi_port->full_duplex = false;
+        usi_port->timer1_reg = NULL;
+    }
+    
+    timer1_port = port;
+    
+    stop_timer1(port);
+    
+    // RX as input with the pull-up, and TX driven high
+    USI_REG(port, DDRB) &= ~port->rx_pin_mask;
+    USI_REG(port, PORTB) |= port->rx_pin_mask | port->tx_pin_mask;
+    USI_REG(port, DDRB) |= port->tx_pin_mask;
+    
+    USI_REG(port, GIMSK) |= _BV(PCIE);
+    USI_REG(port, PCMSK) |= port->rx_pin_mask;
+    
+    return true;
+}
+
+void usi_serial_close_bit_banged(USISerialPort *port) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // its pin changes, RX and any CTS, are no longer watched
+        USI_REG(port, PCMSK) &= ~(port->rx_pin_mask | port->cts_pin_mask);
+        
+        if (timer1_port == port) {
+            stop_timer1(port);
+            timer1_port = NULL;
+        }
+    }
+}
+
+void usi_tx_set_streaming(USISerialPort *port, const bool enable) {
+    port->tx_streaming_enabled = enable;
+}
+
+uint8_t usi_tx_space_available(USISerialPort *port) {
+    return USI_SERIAL_TX_BUFFER_SIZE - (uint8_t)(port->tx_head - port->tx_tail);
+}
+
+bool usi_tx_enqueue(USISerialPort *port, const uint8_t b) {
+    bool queued = false;
+    uint8_t first_half;
+    uint8_t second_half;
+    
+    // build the frame now, rather than in the ISR, and before disabling
+    // interrupts, so the reversal and parity don't hold off the start bit's
+    // PCINT
+    build_frame(port, b & DATA_MASK(port), &first_half, &second_half);
+    
+    // the slot's claimed with interrupts disabled, as a handler may be
+    // queueing too
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (usi_tx_space_available(port) != 0) {
+            port->tx_first_half[port->tx_head & TX_BUFFER_MASK] = first_half;
+            port->tx_second_half[port->tx_head & TX_BUFFER_MASK] = second_half;
+            
+            port->tx_head += 1;
+            queued = true;
+            
+            // kick off the transmission if nothing's in progress; otherwise
+            // the byte's picked up when the current TX or, in half duplex, RX
+            // or the idle timeout completes, when auto-baud detection has
+            // found the rate, or when the peer's ready for it
+            if (tx_startable(port)) {
+                start_tx(port);
+            }
+            else if ((port->txState == USITX_STATE_IDLE) && ! port->full_duplex &&
+                     ((port->rxState != USIRX_STATE_IDLE) || port->rx_idle_timing))
+            {
+                // held until the frame coming in, or the message, is done
+                port->tx_held_by_rx_count += 1;
+            }
+        }
+    }
+    
+    return queued;
+}
+
+uint8_t usi_tx_byte(USISerialPort *port, const uint8_t b) {
+    // wait for room in the queue, idle until the ISRs have made some
+    while (! usi_tx_enqueue(port, b)) {
+        port->tx_sleep_entry_count += 1;
+        usi_serial_idle(port);
+    }
+    
+    return 0;
+}
+
+// true once nothing's left to send, not even the stop bit on the line
+static inline bool tx_drained(const USISerialPort *port) {
+    return tx_queue_empty(port) && (port->tx_control == 0) &&
+        (port->txState == USITX_STATE_IDLE);
+}
+
+// checked with interrupts disabled, up to the sleep instruction, so the ISR
+// that finishes can't slip in between and leave the MCU asleep for good
+void usi_tx_flush(USISerialPort *port) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        while (! tx_queue_empty(port)) {
+            usi_serial_idle(port);
+            cli();
+        }
+    }
+}
+
+void usi_tx_drain(USISerialPort *port) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        while (! tx_drained(port)) {
+            usi_serial_idle(port);
+            cli();
+        }
+    }
+}
+
+uint8_t usi_rx_available(USISerialPort *port) {
+    return (uint8_t)(port->rx_head - port->rx_tail);
+}
+
+// asks the peer to carry on once the receive buffer's drained enough
+static void check_rx_low_watermark(USISerialPort *port) {
+    if (! port->rx_throttled || (usi_rx_available(port) > port->rx_low_watermark)) {
+        return;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        port->rx_throttled = false;
+        
+        if (port->flow_control == USI_SERIAL_FLOW_RTS_CTS) {
+            USI_REG(port, PORTB) &= ~port->rts_pin_mask;
+        }
+        else {
+            port->tx_control = USI_SERIAL_XON;
+            
+            if (tx_startable(port)) {
+                start_tx(port);
+            }
+        }
+    }
+}
+
+uint8_t usi_rx_read_with_status(USISerialPort *port, uint8_t *status) {
+    uint8_t b = 0;
+    
+    *status = 0;
+    
+    if (usi_rx_available(port) != 0) {
+        b = reverse_bits(port->rx_buffer[port->rx_tail & RX_BUFFER_MASK]) >> RX_SHIFT(port);
+        *status = port->rx_status[port->rx_tail & RX_BUFFER_MASK];
+        port->rx_tail += 1;
+        
+        check_rx_low_watermark(port);
+    }
+    
+    return b;
+}
+
+uint8_t usi_rx_read(USISerialPort *port) {
+    uint8_t status;
+    
+    return usi_rx_read_with_status(port, &status);
+}
+
+uint8_t usi_rx_read_block(USISerialPort *port, uint8_t *buf, const uint8_t len) {
+    uint8_t count = usi_rx_available(port);
+    
+    if (count > len) {
+        count = len;
+    }
+    
+    for (uint8_t i = 0; i < count; i++) {
+        buf[i] = reverse_bits(port->rx_buffer[(port->rx_tail + i) & RX_BUFFER_MASK]) >> RX_SHIFT(port);
+    }
+    
+    port->rx_tail += count;
+    
+    check_rx_low_watermark(port);
+    
+    return count;
+}
+
+uint16_t usi_rx_overrun_count(USISerialPort *port) {
+    uint16_t count;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = port->rx_overrun_count;
+    }
+    
+    return count;
+}
+
+uint16_t usi_rx_parity_error_count(USISerialPort *port) {
+    uint16_t count;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = port->rx_parity_error_count;
+    }
+    
+    return count;
+}
+
+uint16_t usi_rx_framing_error_count(USISerialPort *port) {
+    uint16_t count;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = port->rx_framing_error_count;
+    }
+    
+    return count;
+}
+
+void usi_rx_reset_error_counts(USISerialPort *port) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        port->rx_overrun_count = 0;
+        port->rx_parity_error_count = 0;
+        port->rx_framing_error_count = 0;
+    }
+}
+
+void usi_serial_read_stats(USISerialPort *port, USISerialStats *stats) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        stats->rx_frames = port->rx_frame_count;
+        stats->tx_frames = port->tx_frame_count;
+        stats->tx_sleep_entries = port->tx_sleep_entry_count;
+        stats->tx_held_by_rx = port->tx_held_by_rx_count;
+        stats->rx_missed = port->rx_missed_count;
+        stats->rx_overruns = port->rx_overrun_count;
+        stats->rx_parity_errors = port->rx_parity_error_count;
+        stats->rx_framing_errors = port->rx_framing_error_count;
+        
+        #ifdef USI_SERIAL_TIMESTAMPS
+        stats->max_handler_time = port->max_handler_time;
+        #endif
+    }
+}
+
+void usi_serial_reset_stats(USISerialPort *port) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        port->rx_frame_count = 0;
+        port->tx_frame_count = 0;
+        port->tx_sleep_entry_count = 0;
+        port->tx_held_by_rx_count = 0;
+        port->rx_missed_count = 0;
+        port->rx_overrun_count = 0;
+        port->rx_parity_error_count = 0;
+        port->rx_framing_error_count = 0;
+        
+        #ifdef USI_SERIAL_TIMESTAMPS
+        port->max_handler_time = 0;
+        #endif
+    }
+}
+
+#ifdef USI_SERIAL_TRACE
+uint8_t usi_trace_read(USITraceEntry *buf, const uint8_t len) {
+    uint8_t count = 0;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        while ((count < len) && (trace_tail != trace_head)) {
+            buf[count] = trace_buffer[trace_tail & TRACE_MASK];
+            trace_tail += 1;
+            count += 1;
+        }
+    }
+    
+    return count;
+}
+
+uint16_t usi_trace_lost_count(void) {
+    uint16_t count;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = trace_lost_count;
+    }
+    
+    return count;
+}
+#endif
+
+#ifdef USI_SERIAL_TIMESTAMPS
+void usi_serial_set_clock(USISerialPort *port, USISerialTimestamp (*clock)(void)) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        port->clock = clock;
+    }
+}
+
+USISerialTimestamp usi_serial_rx_timestamp(USISerialPort *port) {
+    return port->rx_delivered_time;
+}
+
+uint8_t usi_rx_read_with_timestamp(USISerialPort *port, uint8_t *status,
+                                   USISerialTimestamp *timestamp)
+{
+    *timestamp = 0;
+    
+    if (usi_rx_available(port) != 0) {
+        *timestamp = port->rx_time[port->rx_tail & RX_BUFFER_MASK];
+    }
+    
+    return usi_rx_read_with_status(port, status);
+}
+
+bool usi_tx_read_timestamp(USISerialPort *port, USISerialTimestamp *timestamp) {
+    bool found = false;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (port->tx_time_tail != port->tx_time_head) {
+            *timestamp = port->tx_time[port->tx_time_tail & TX_BUFFER_MASK];
+            port->tx_time_tail += 1;
+            found = true;
+        }
+    }
+    
+    return found;
+}
+
+uint16_t usi_tx_timestamp_lost_count(USISerialPort *port) {
+    uint16_t count;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = port->tx_time_lost_count;
+    }
+    
+    return count;
+}
+#endif
+
+// sets the port's bit timing from the sync frame's measured bit period, if
+// it's close enough to one of the rates with the port's prescaler.
+// Otherwise detection starts over.
+static void lock_baud_rate(USISerialPort *port) {
+    const uint16_t measured_ticks_256 =
+        port->auto_baud_ticks << ((port->sync_intervals == 4) ? 5 : 6);
+    
+    timer0_stop();
+    timer0_disable_ocra_interrupt();
+    
+    port->auto_baud_edges = 0;
+    
+    for (uint8_t i = 0; i < AUTO_BAUD_RATE_COUNT; i++) {
+        const AutoBaudRate *rate = &auto_baud_rates[i];
+        
+        if (pgm_read_byte(&rate->clock_select) != port->timer1_clock_select) {
+            continue;
+        }
+        
+        const uint16_t nominal = pgm_read_word(&rate->bit_ticks_256);
+        const uint16_t diff = (measured_ticks_256 > nominal) ?
+            (measured_ticks_256 - nominal) : (nominal - measured_ticks_256);
+        
+        if (diff > pgm_read_word(&rate->tolerance_256)) {
+            continue;
+        }
+        
+        if (port->full_duplex && ! timer1_keeps_up(pgm_read_dword(&rate->baud))) {
+            // too fast to receive on timer1
+            continue;
+        }
+        
+        // as the compile-time seeds, but from the measured period; always
+        // dithered, to keep the measurement's fraction of a tick
+        port->bit_seed = (measured_ticks_256 >> 8) - 1;
+        port->bit_seed_fraction = measured_ticks_256 & 0xff;
+        
+        set_initial_seeds(port);
+        set_idle_ticks(port);
+        
+        port->baud_rate = (BaudRate) pgm_read_dword(&rate->baud);
+        
+        set_rx_state(port, USIRX_STATE_IDLE);
+        
+        // send anything queued while detecting; what's left of the sync
+        // frame has no more falling edges to mistake for a start bit
+        if (tx_ready(port)) {
+            start_tx(port);
+        }
+        
+        return;
+    }
+}
+
+// times the falling edges of the sync character, each from the last, with
+// timer0.  The rising edges are ignored; how long the line takes to rise
+// varies more.
+static void detect_baud_rate(USISerialPort *port, const uint8_t pinb) {
+    const uint8_t ticks = USI_REG(port, TCNT0);
+    
+    TRACE(port, USI_TRACE_PCINT0, pinb);
+    
+    if ((pinb & port->rx_pin_mask) != 0) {
+        return;
+    }
+    
+    timer0_set_counter(0);
+    
+    const uint8_t edges = port->auto_baud_edges;
+    
+    if (edges == 0) {
+        // the start bit, or it might be.  If no falling edge follows within
+        // 256 ticks the compare interrupt starts detection over.
+        timer0_set_ocra(0xff);
+        timer0_enable_ocra_interrupt();
+        timer0_start();
+        
+        port->auto_baud_edges = 1;
+        
+        return;
+    }
+    
+    // every interval's two bits; allow a quarter either way
+    const uint8_t first = port->auto_baud_first;
+    const uint8_t diff = (ticks > first) ? (ticks - first) : (first - ticks);
+    
+    if ((edges == 1) || (diff > (first >> 2))) {
+        // the first interval or, out of step, the last edge might have been
+        // the start bit
+        port->auto_baud_first = ticks;
+        port->auto_baud_ticks = ticks;
+        port->auto_baud_edges = 2;
+        
+        return;
+    }
+    
+    if (edges <= port->sync_intervals) {
+        port->auto_baud_ticks += ticks;
+    }
+    
+    port->auto_baud_edges = edges + 1;
+    
+    if (port->auto_baud_edges == port->sync_edges) {
+        lock_baud_rate(port);
+    }
+}
+
+// times the first data bit's rising edge from timer0 being started by the
+// start bit, while calibrating.  Any other edge disarms PCINT0 for the rest
+// of the frame without counting.
+static void time_first_data_bit(USISerialPort *port, const uint8_t pinb) {
+    const uint8_t ticks = USI_REG(port, TCNT0);
+    
+    TRACE(port, USI_TRACE_PCINT0, pinb);
+    
+    USI_REG(port, PCMSK) &= ~_BV(PCINT0); // disable PCINT0
+    
+    // the first data bit's only a rising edge if it's a 1, and then it's
+    // the first edge and comes before the USI's sampled it
+    if (((pinb & port->rx_pin_mask) == 0) ||
+        ((USI_REG(port, USISR) & 0x0f) != (USI_COUNTER_MAX_COUNT - DATA_BITS(port))))
+    {
+        return;
+    }
+    
+    port->calibration_ticks += ticks;
+    port->calibration_frames_left -= 1;
+    
+    if (port->calibration_frames_left != 0) {
+        return;
+    }
+    
+    // the mean of TCNT0, to 1/256th of a tick, fell short of the bit period
+    // by the time taken to start the timer after the ISR's entry
+    const uint16_t mean_ticks_256 =
+        ((uint32_t) port->calibration_ticks << 8) / USI_SERIAL_CALIBRATION_FRAMES;
+    
+    port->startup_ticks_256 = bit_ticks_256(port) - mean_ticks_256 + port->entry_ticks_256;
+    
+    set_initial_seeds(port);
+}
+
+// starts receiving a frame if the port's RX pin has gone low while armed
+static void handle_pin_change(USISerialPort *port) {
+    const uint8_t pinb = USI_REG(port, PINB);
+    
+    if ((USI_REG(port, PCMSK) & port->rx_pin_mask) == 0) {
+        // not listening; another port's pin changed
+        return;
+    }
+    
+    if (port->rxState == USIRX_STATE_DETECTING_BAUD) {
+        detect_baud_rate(port, pinb);
+    }
+    else if (port->rxState != USIRX_STATE_IDLE) {
+        // only armed mid-frame while calibrating
+        time_first_data_bit(port, pinb);
+    }
+    else if ((pinb & port->rx_pin_mask) != 0) {
+        // not a start bit
+        TRACE(port, USI_TRACE_PCINT0, pinb);
+    }
+    else if (port->full_duplex || port->bit_banged) {
+        // start bit received in full duplex, or on a bit-banged port; time
+        // the samples with timer1, the first in the middle of the first data
+        // bit
+        start_timer1(port, port->initial_timer1_seed);
+        
+        TRACE(port, USI_TRACE_PCINT0, pinb);
+        STAMP_RX_START(port);
+        
+        USI_REG(port, PCMSK) &= ~port->rx_pin_mask; // disable the RX PCINT
+        
+        port->rx_bits_left = DATA_BITS(port);
+        
+        set_rx_state(port, USIRX_STATE_RECEIVING);
+    }
+    else {
+        // PB0 is low; start bit received
+        // do the time-critical stuff first
+        
+        start_rx_bit_clock(port);
+        
+        // ----- configure the USI
+        // overflow should occur when all data bits are received
+        enable_3wire_usi(port, DATA_BITS(port));
+        
+        // ----- time-critical stuff done; TCNT0 shows how long it took
+        TRACE(port, USI_TRACE_PCINT0, pinb);
+        STAMP_RX_START(port);
+        
+        if (port->calibration_frames_left == 0) {
+            USI_REG(port, PCMSK) &= ~_BV(PCINT0); // disable PCINT0
+        }
+        
+        // the message carries on; timer0's been taken over for this frame
+        port->rx_idle_timing = false;
+        
+        port->timer0_fraction_acc = 0x80;
+        
+        set_rx_state(port, USIRX_STATE_RECEIVING);
+    }
+}
+
+// restarts transmission held off by the peer, once it's taken CTS low
+static void handle_cts_change(USISerialPort *port) {
+    if ((port->cts_pin_mask != 0) && tx_startable(port)) {
+        start_tx(port);
+    }
+}
+
+// @todo refactor this so that the PCINT0 ISR is configured in main()
+ISR(PCINT0_vect) {
+    // the USI port first; its timing's the tightest
+    if (usi_port) {
+        handle_pin_change(usi_port);
+    }
+    
+    if (timer1_port && (timer1_port != usi_port)) {
+        handle_pin_change(timer1_port);
+    }
+    
+    // and start bits before CTS
+    if (usi_port) {
+        handle_cts_change(usi_port);
+    }
+    
+    if (timer1_port && (timer1_port != usi_port)) {
+        handle_cts_change(timer1_port);
+    }
+}
+
+// checks the parity and stop bits of a frame received, and passes the byte
+// on.  data is the data bits, reversed; trailer is USIBR, or the bits sampled
+// on timer1, with the stop bit in the LSB and the parity bit, if any, before
+// it.
+static inline void rx_frame_complete(USISerialPort *port, const uint8_t data,
+                                     const uint8_t trailer)
+{
+    uint8_t status = 0;
+    
+    port->active_bit_count += FRAME_BITS(port);
+    port->rx_frame_count += 1;
+    
+    if (port->flow_control == USI_SERIAL_FLOW_XON_XOFF) {
+        // the peer pausing or carrying on; nothing to deliver.  The caller
+        // starts anything queued once it's carrying on.
+        const uint8_t b = reverse_bits(data) >> RX_SHIFT(port);
+        
+        if ((b == USI_SERIAL_XOFF) || (b == USI_SERIAL_XON)) {
+            port->tx_stopped = (b == USI_SERIAL_XOFF);
+            return;
+        }
+    }
+    
+    if ((trailer & _BV(0)) == 0) {
+        status |= USI_SERIAL_RX_FRAMING_ERROR;
+        port->rx_framing_error_count += 1;
+    }
+    
+    // parity's the same whichever order the bits are in
+    if ((PARITY(port) != USI_SERIAL_PARITY_NONE) &&
+        (((trailer >> 1) & 1) != parity_bit(port, data & DATA_MASK(port))))
+    {
+        status |= USI_SERIAL_RX_PARITY_ERROR;
+        port->rx_parity_error_count += 1;
+    }
+    
+    if (port->idle_bits != 0) {
+        // part of a message, delivered once the line's been idle long enough
+        #ifdef USI_SERIAL_TIMESTAMPS
+        if (port->message_len == 0) {
+            port->message_time = port->rx_frame_time;
+        }
+        #endif
+        
+        if (port->message_len < port->message_size) {
+            port->message_buf[port->message_len++] = reverse_bits(data) >> RX_SHIFT(port);
+        }
+        else {
+            status |= USI_SERIAL_RX_OVERRUN;
+            port->rx_overrun_count += 1;
+        }
+        
+        port->message_status |= status;
+    }
+    else if (port->received_byte_handler) {
+        #ifdef USI_SERIAL_TIMESTAMPS
+        port->rx_delivered_time = port->rx_frame_time;
+        
+        const USISerialTimestamp called = timestamp_now(port);
+        #endif
+        
+        // WARNING! this is being called in an ISR and MUST be very fast!
+        port->received_byte_handler(reverse_bits(data) >> RX_SHIFT(port), status);
+        
+        #ifdef USI_SERIAL_TIMESTAMPS
+        handler_returned(port, called);
+        #endif
+    }
+    else if ((uint8_t)(port->rx_head - port->rx_tail) != USI_SERIAL_RX_BUFFER_SIZE) {
+        port->rx_buffer[port->rx_head & RX_BUFFER_MASK] = data;
+        port->rx_status[port->rx_head & RX_BUFFER_MASK] = status;
+        
+        #ifdef USI_SERIAL_TIMESTAMPS
+        port->rx_time[port->rx_head & RX_BUFFER_MASK] = port->rx_frame_time;
+        #endif
+        
+        port->rx_head += 1;
+        
+        if ((port->flow_control != USI_SERIAL_FLOW_NONE) && ! port->rx_throttled &&
+            ((uint8_t)(port->rx_head - port->rx_tail) >= port->rx_high_watermark))
+        {
+            // ask the peer to pause.  XOFF goes out ahead of the queue, as
+            // soon as TX is free; the caller starts it if it's idle.
+            port->rx_throttled = true;
+            
+            if (port->flow_control == USI_SERIAL_FLOW_RTS_CTS) {
+                USI_REG(port, PORTB) |= port->rts_pin_mask;
+            }
+            else {
+                port->tx_control = USI_SERIAL_XOFF;
+            }
+        }
+    }
+    else {
+        port->rx_overrun_count += 1;
+    }
+}
+
+// hands a frame over to be checked and delivered, once the receiver's been
+// re-armed for the next.  The ISR that's not interrupting an earlier
+// delivery delivers, with interrupts enabled, until none are left; one that
+// is just leaves its frame for it, so the handler's never re-entered and
+// frames are delivered in order.  Returns with interrupts disabled.
+static void rx_handoff(USISerialPort *port, const uint8_t data, const uint8_t trailer) {
+    const uint8_t head = port->rx_handoff_head;
+    
+    if ((uint8_t)(head - port->rx_handoff_tail) == USI_SERIAL_RX_HANDOFF_SIZE) {
+        // the handler's fallen too far behind
+        port->rx_overrun_count += 1;
+        return;
+    }
+    
+    port->rx_handoff_data[head & RX_HANDOFF_MASK] = data;
+    port->rx_handoff_trailer[head & RX_HANDOFF_MASK] = trailer;
+    
+    #ifdef USI_SERIAL_TIMESTAMPS
+    port->rx_handoff_time[head & RX_HANDOFF_MASK] = port->rx_start_time;
+    #endif
+    
+    port->rx_handoff_head = head + 1;
+    
+    if (port->rx_delivering) {
+        return;
+    }
+    
+    port->rx_delivering = true;
+    
+    // checked with interrupts disabled, so nothing's left behind
+    while (port->rx_handoff_tail != port->rx_handoff_head) {
+        const uint8_t tail = port->rx_handoff_tail;
+        
+        #ifdef USI_SERIAL_TIMESTAMPS
+        port->rx_frame_time = port->rx_handoff_time[tail & RX_HANDOFF_MASK];
+        #endif
+        
+        sei();
+        
+        rx_frame_complete(port,
+                          port->rx_handoff_data[tail & RX_HANDOFF_MASK],
+                          port->rx_handoff_trailer[tail & RX_HANDOFF_MASK]);
+        
+        cli();
+        
+        port->rx_handoff_tail = tail + 1;
+    }
+    
+    port->rx_delivering = false;
+}
+
+// a chunk of the idle timeout has passed; delivers the message at the end of
+// the last
+static void idle_timeout_elapsed(USISerialPort *port) {
+    port->idle_ticks_left -= port->idle_chunk;
+    
+    if ((port->idle_ticks_left == 0) &&
+        (port->rx_delivering || port->message_delivering))
+    {
+        // the message's last frame, or the last message, is still being
+        // delivered; look again in a bit period
+        port->idle_ticks_left = port->bit_seed + 1;
+    }
+    
+    if (port->idle_ticks_left != 0) {
+        set_idle_chunk(port);
+        return;
+    }
+    
+    timer0_stop();
+    timer0_disable_ocra_interrupt();
+    
+    port->rx_idle_timing = false;
+    
+    #ifdef USI_SERIAL_TIMESTAMPS
+    port->rx_delivered_time = port->message_time;
+    #endif
+    
+    // the next message starts afresh, even if it starts before the handler's
+    // returned
+    const uint8_t len = port->message_len;
+    const uint8_t status = port->message_status;
+    
+    port->message_len = 0;
+    port->message_status = 0;
+    port->message_delivering = true;
+    
+    // a start bit can interrupt delivering the message, as it can a frame
+    sei();
+    
+    if ((len != 0) || (status != 0)) {
+        #ifdef USI_SERIAL_TIMESTAMPS
+        const USISerialTimestamp called = timestamp_now(port);
+        #endif
+        
+        port->message_handler(port->message_buf, len, status);
+        
+        #ifdef USI_SERIAL_TIMESTAMPS
+        handler_returned(port, called);
+        #endif
+    }
+    
+    cli();
+    
+    port->message_delivering = false;
+    
+    // send anything queued while the message was arriving
+    if (tx_startable(port)) {
+        start_tx(port);
+    }
+}
+
+static void usi_handle_ocra_reload() {
+    USISerialPort *port = usi_port;
+    
+    if (port->rx_idle_timing) {
+        idle_timeout_elapsed(port);
+        return;
+    }
+    
+    if (port->rxState == USIRX_STATE_DETECTING_BAUD) {
+        // too long since the last falling edge for the sync character
+        timer0_stop();
+        timer0_disable_ocra_interrupt();
+        
+        port->auto_baud_edges = 0;
+        
+        return;
+    }
+    
+    // set the OCR0A match to the bit duration and disable the OCR0A compare
+    // interrupt; with CTC mode, the timer's reset, and the OCR0A match clocks
+    // the USI in hardware
+    
+    if (port->bit_seed_fraction == 0) {
+        timer0_set_ocra(port->bit_seed);
+        timer0_disable_ocra_interrupt();
+    }
+    else {
+        // dithered; stretch this bit by a tick whenever the accumulated
+        // fraction carries.  The timer's just been cleared, so the new
+        // value takes effect for the bit that's just started.
+        uint8_t acc = port->timer0_fraction_acc + port->bit_seed_fraction;
+        
+        timer0_set_ocra(port->bit_seed + (acc < port->timer0_fraction_acc ? 1 : 0));
+        port->timer0_fraction_acc = acc;
+    }
+}
+
+// Timer1 compare interrupt; full duplex and bit-banged ports, and USI-backed
+// ports clocked by timer1.  Samples a bit of the frame being received, sends
+// one, or clocks the USI.
+ISR(TIMER1_COMPA_vect) {
+    USISerialPort *port = timer1_port;
+    
+    if (port->bit_clock == USI_SERIAL_CLOCK_TIMER1) {
+        // first, as timer0's compare match would
+        USI_REG(port, USICR) |= _BV(USICLK);
+    }
+    
+    const uint8_t sample = (USI_REG(port, PINB) & port->rx_pin_mask) ? 1 : 0;
+    
+    // the timer's just been cleared; set the length of the bit that's just
+    // started, dithered like timer0's
+    uint8_t seed = port->bit_seed;
+    
+    if (port->bit_seed_fraction != 0) {
+        uint8_t acc = port->timer1_fraction_acc + port->bit_seed_fraction;
+        
+        seed += (acc < port->timer1_fraction_acc) ? 1 : 0;
+        port->timer1_fraction_acc = acc;
+    }
+    
+    TIMER1_REG(port, OCR1A) = seed;
+    TIMER1_REG(port, OCR1C) = seed;
+    
+    if (port->bit_clock == USI_SERIAL_CLOCK_TIMER1) {
+        // the USI overflow ISR does the rest
+        return;
+    }
+    
+    if (port->txState == USITX_STATE_SENDING_BITS) {
+        send_next_bit(port);
+        return;
+    }
+    
+    port->rx_sampled = (port->rx_sampled << 1) | sample;
+    port->rx_bits_left -= 1;
+    
+    if (port->rx_bits_left != 0) {
+        return;
+    }
+    
+    if (port->rxState == USIRX_STATE_RECEIVING) {
+        // all data bits received; on to the parity and stop bits
+        port->rx_data = port->rx_sampled;
+        port->rx_bits_left = RX_TRAILER_BITS(port);
+        
+        set_rx_state(
+            port,
+            (PARITY(port) != USI_SERIAL_PARITY_NONE) ?
+                USIRX_STATE_WAITING_FOR_PARITY_BIT :
+                USIRX_STATE_WAITING_FOR_STOP_BIT
+        );
+    }
+    else {
+        // stop timer1; ready for the next start bit
+        stop_timer1(port);
+        USI_REG(port, PCMSK) |= port->rx_pin_mask;
+        
+        set_rx_state(port, USIRX_STATE_IDLE);
+        
+        // as in the USI overflow ISR; the transmit ISRs can interrupt too
+        rx_handoff(port, port->rx_data, port->rx_sampled);
+        
+        // send anything queued while receiving, as the USI port does, or
+        // XON and XOFF, or what the peer's XON has let go, in full duplex
+        if (tx_startable(port)) {
+            start_tx(port);
+        }
+    }
+}
+
+// USI overflow interrupt.  Configured to occur when the desired number of bits
+// have been shifted in (in reverse order!)
+ISR(USI_OVF_vect) {
+    USISerialPort *port = usi_port;
+    
+    TRACE(port, USI_TRACE_USI_OVF, USI_REG(port, USIBR));
+    
+    if (port->txState != USITX_STATE_IDLE) {
+        if (port->txState == USITX_STATE_READY_FOR_FIRST_HALF_FRAME) {
+            load_first_half_frame(port);
+        }
+        else if (port->txState == USITX_STATE_READY_FOR_SECOND_HALF_FRAME) {
+            // load USIDR with the last bits of the byte, parity and stop
+            // bits, and set up the next overflow to shut down the USI; both
+            // images were built by usi_tx_enqueue().  About 27 cycles at
+            // -Os, against about 60 for shifting and computing parity here.
+            USI_REG(port, USIDR) = port->pending_second_half;
+            USI_REG(port, USISR) = SECOND_HALF_USISR(port);
+            
+            set_tx_state(port, USITX_STATE_COMPLETE);
+        }
+        else if (tx_ready(port)) {
+            // USITX_STATE_COMPLETE, with more to send; leave the USI running
+            tx_frame_sent(port);
+            dequeue_pending_tx_byte(port);
+            
+            if (port->tx_streaming_enabled) {
+                // the stop bit's on the line now; the start bit follows it
+                // on the next tick
+                load_first_half_frame(port);
+            }
+            else {
+                // hold the line high for one more bit before the next start
+                // bit
+                USI_REG(port, USIDR) = 0xff;
+                set_usi_counter_and_clear_flags(port, 1);
+                
+                set_tx_state(port, USITX_STATE_READY_FOR_FIRST_HALF_FRAME);
+            }
+        }
+        else /* USITX_STATE_COMPLETE */ {
+            tx_frame_sent(port);
+            
+            disable_usi(port);
+            stop_bit_clock(port);
+            
+            if (! port->full_duplex) {
+                check_missed_rx(port);
+                USI_REG(port, PCMSK) |= _BV(PCINT0); // re-enable PCINT
+            }
+            
+            USI_REG(port, DDRB) &= ~_BV(PB1);    // PB1 as input
+            USI_REG(port, PORTB) |= _BV(PB1);    // PB1 internal pull-up enabled
+            
+            set_tx_state(port, USITX_STATE_IDLE);
+        }
+    }
+    else if (port->rxState == USIRX_STATE_RECEIVING) {
+        // all data bits received; keep them until the frame's checked
+        port->rx_data = USI_REG(port, USIBR);
+        
+        // clear interrupt flags; overflow should occur when the parity bit,
+        // if any, and the stop bit are received
+        set_usi_counter_and_clear_flags(port, RX_TRAILER_BITS(port));
+        
+        set_rx_state(
+            port,
+            (PARITY(port) != USI_SERIAL_PARITY_NONE) ?
+                USIRX_STATE_WAITING_FOR_PARITY_BIT :
+                USIRX_STATE_WAITING_FOR_STOP_BIT
+        );
+    }
+    else {
+        const uint8_t trailer = USI_REG(port, USIBR);
+        
+        // the next start bit's only half a bit away; be ready for it first.
+        // Timing the idle line, timer0 counts on from the stop bit's sample,
+        // so the first chunk's set before anything can hold this ISR up;
+        // anything queued waits for the message to end.
+        if (port->idle_bits == 0) {
+            stop_bit_clock(port);
+        }
+        else {
+            start_idle_timeout(port);
+        }
+        
+        disable_usi(port);
+        USI_REG(port, PCMSK) |= _BV(PCINT0); // re-enable PCINT
+        
+        set_rx_state(port, USIRX_STATE_IDLE);
+        
+        // and let it interrupt checking and delivering this frame.  Nothing
+        // else can fire now but the idle timeout: the USI's off.
+        rx_handoff(port, port->rx_data, trailer);
+        
+        // send anything queued while receiving, unless the next frame's
+        // already started
+        if ((port->rxState == USIRX_STATE_IDLE) && tx_startable(port)) {
+            start_tx(port);
         }
     }
 }
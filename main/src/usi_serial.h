@@ -1,6 +1,12 @@
 /*
  * Based on AVR307
  *
+ * Each port's state lives in a USISerialPort allocated by the caller.  A port
+ * is either backed by the USI, on PB0 and PB1, or bit-banged on timer1 and
+ * any two pins of port B; both share the rest of the API.  The interrupt
+ * vectors can't be shared, so there can be at most one port of each kind,
+ * and a bit-banged port rules out full duplex on the USI port.
+ *
  * NOTE:
  *    DO requires external pull-up (@todo verify)
  */
@@ -11,21 +17,180 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// @todo parameterize for use with other prescaler values
-#define PCINT_STARTUP_DELAY 28
+#include "usi_serial_timing.h"
+#include "usi_serial_trace.h"
+
+typedef enum __usi_serial_parity {
+    USI_SERIAL_PARITY_NONE,
+    USI_SERIAL_PARITY_EVEN,
+    USI_SERIAL_PARITY_ODD,
+    USI_SERIAL_PARITY_MARK,  // always 1
+    USI_SERIAL_PARITY_SPACE, // always 0
+} USISerialParity;
+
+// the frame's data bits, parity bit and stop bits; the start bit's implied.
+// Only 7 or 8 data bits and 1 or 2 stop bits are supported.  Only the first
+// stop bit is checked when receiving.
+typedef struct __usi_serial_frame_format {
+    uint8_t data_bits;
+    USISerialParity parity;
+    uint8_t stop_bits;
+} USISerialFrameFormat;
+
+// initializer for a USISerialFrameFormat, e.g.
+// USI_SERIAL_FRAME_FORMAT(8, NONE, 1) for 8N1
+#define USI_SERIAL_FRAME_FORMAT(data_bits, parity, stop_bits) \
+    { (data_bits), USI_SERIAL_PARITY_##parity, (stop_bits) }
+
+// Define USI_SERIAL_FIXED_DATA_BITS, USI_SERIAL_FIXED_PARITY and
+// USI_SERIAL_FIXED_STOP_BITS, as for USI_SERIAL_FRAME_FORMAT(), to build the
+// driver for that format alone: 8, EVEN and 1 for 8E1, say.  The ISRs then
+// don't test the format at run time, and the code for the parity modes not
+// used drops out.  Every port uses it: the format passed to usi_serial_init()
+// and the other init functions is ignored, without any error, so a port
+// initialized with another format receives garbage.
+#if defined(USI_SERIAL_FIXED_DATA_BITS) || defined(USI_SERIAL_FIXED_PARITY) || \
+    defined(USI_SERIAL_FIXED_STOP_BITS)
+#if ! (defined(USI_SERIAL_FIXED_DATA_BITS) && defined(USI_SERIAL_FIXED_PARITY) && \
+       defined(USI_SERIAL_FIXED_STOP_BITS))
+#error "USI_SERIAL_FIXED_DATA_BITS, USI_SERIAL_FIXED_PARITY and USI_SERIAL_FIXED_STOP_BITS go together"
+#endif
+
+#if (USI_SERIAL_FIXED_DATA_BITS != 7) && (USI_SERIAL_FIXED_DATA_BITS != 8)
+#error "USI_SERIAL_FIXED_DATA_BITS must be 7 or 8"
+#endif
+
+#if (USI_SERIAL_FIXED_STOP_BITS != 1) && (USI_SERIAL_FIXED_STOP_BITS != 2)
+#error "USI_SERIAL_FIXED_STOP_BITS must be 1 or 2"
+#endif
+
+#define USI_SERIAL_FIXED_FORMAT
+#endif
+
+// number of bytes that can be queued for transmission.  Must be a power of
+// two, no larger than 128.
+#ifndef USI_SERIAL_TX_BUFFER_SIZE
+#define USI_SERIAL_TX_BUFFER_SIZE 16
+#endif
 
-// mainly for reference for interested parties; 8 data bits and
-// (optionally) 1 parity bit are all that this driver can handle.
-#define DATA_BITS   8
-#define PARITY_BITS 1
+#if (USI_SERIAL_TX_BUFFER_SIZE & (USI_SERIAL_TX_BUFFER_SIZE - 1)) != 0
+#error "USI_SERIAL_TX_BUFFER_SIZE must be a power of 2"
+#endif
+
+#if USI_SERIAL_TX_BUFFER_SIZE > 128
+#error "USI_SERIAL_TX_BUFFER_SIZE must not exceed 128"
+#endif
+
+// number of received bytes buffered when no received_byte_handler is
+// provided.  Same restrictions as USI_SERIAL_TX_BUFFER_SIZE.
+#ifndef USI_SERIAL_RX_BUFFER_SIZE
+#define USI_SERIAL_RX_BUFFER_SIZE 16
+#endif
+
+#if (USI_SERIAL_RX_BUFFER_SIZE & (USI_SERIAL_RX_BUFFER_SIZE - 1)) != 0
+#error "USI_SERIAL_RX_BUFFER_SIZE must be a power of 2"
+#endif
+
+#if USI_SERIAL_RX_BUFFER_SIZE > 128
+#error "USI_SERIAL_RX_BUFFER_SIZE must not exceed 128"
+#endif
+
+// number of received frames that can wait to be checked and delivered while
+// an earlier one's still being handled.  Same restrictions as
+// USI_SERIAL_TX_BUFFER_SIZE.
+#ifndef USI_SERIAL_RX_HANDOFF_SIZE
+#define USI_SERIAL_RX_HANDOFF_SIZE 2
+#endif
+
+#if (USI_SERIAL_RX_HANDOFF_SIZE & (USI_SERIAL_RX_HANDOFF_SIZE - 1)) != 0
+#error "USI_SERIAL_RX_HANDOFF_SIZE must be a power of 2"
+#endif
+
+#if USI_SERIAL_RX_HANDOFF_SIZE > 128
+#error "USI_SERIAL_RX_HANDOFF_SIZE must not exceed 128"
+#endif
+
+// Define USI_SERIAL_TIMESTAMPS to timestamp each frame received, at its start
+// bit, and each frame sent, as it finishes, with a clock the application
+// provides; see usi_serial_set_clock().  Without it the timestamps take no
+// RAM or time in the ISRs.
+#ifdef USI_SERIAL_TIMESTAMPS
+typedef uint32_t USISerialTimestamp;
+#endif
+
+// status of each received byte; 0 if it arrived intact
+#define USI_SERIAL_RX_PARITY_ERROR  (1 << 0)
+#define USI_SERIAL_RX_FRAMING_ERROR (1 << 1) // stop bit was 0
+#define USI_SERIAL_RX_OVERRUN       (1 << 2) // a message outgrew its buffer
+
+// flow control; see usi_serial_set_flow_control()
+typedef enum __usi_serial_flow_control {
+    USI_SERIAL_FLOW_NONE,
+    USI_SERIAL_FLOW_RTS_CTS,
+    USI_SERIAL_FLOW_XON_XOFF,
+} USISerialFlowControl;
+
+#define USI_SERIAL_XON  0x11 // DC1
+#define USI_SERIAL_XOFF 0x13 // DC3
+
+// what clocks a USI-backed port's bits; see usi_serial_init_timer1()
+typedef enum __usi_serial_bit_clock {
+    USI_SERIAL_CLOCK_TIMER0,
+    USI_SERIAL_CLOCK_TIMER1,
+} USISerialBitClock;
+
+// a snapshot of a port's counters; see usi_serial_read_stats()
+typedef struct __usi_serial_stats {
+    uint32_t rx_frames;         // received, whatever their errors
+    uint32_t tx_frames;         // sent
+    uint16_t tx_sleep_entries;  // times usi_tx_byte() idled for room in the queue
+    uint16_t tx_held_by_rx;     // bytes queued, in half duplex, while receiving
+    uint16_t rx_missed;         // frames seen arriving while transmitting in half duplex
+    uint16_t rx_overruns;       // see usi_rx_overrun_count()
+    uint16_t rx_parity_errors;
+    uint16_t rx_framing_errors;
+    
+    // usi_tx_byte() doesn't spin, so tx_sleep_entries counts the times it
+    // idled until an interrupt, not how long it slept, nor turns of a busy
+    // loop.  A handler isn't timed in timer ticks either, as timer0 may be
+    // stopped, or the application's, while it runs: max_handler_time is
+    // only kept with USI_SERIAL_TIMESTAMPS, in the application's clock, and
+    // stays 0 without one.
+    #ifdef USI_SERIAL_TIMESTAMPS
+    // longest call to the received byte or message handler, in the units
+    // of the clock set with usi_serial_set_clock()
+    USISerialTimestamp max_handler_time;
+    #endif
+} USISerialStats;
+
+// the character a peer sends for usi_serial_start_auto_baud() to time.  Its
+// falling edges are every two bits, from the start bit on.
+#define USI_SERIAL_AUTO_BAUD_SYNC 0x55
+
+// one BAUD_x for each rate in USI_SERIAL_BAUD_RATES.  Tested range is in
+// TEST(USISerialRXTests, BaudRateChecks).
+#define USI_SERIAL_BAUD_ENUM(baud) BAUD_##baud = baud,
 
-// must match tested range in TEST(USISerialTests, BaudRateChecks).
 typedef enum __baud_rate {
-     BAUD_9600 = 9600,
-    BAUD_19200 = 19200,
-    BAUD_38400 = 38400,
+    USI_SERIAL_BAUD_RATES(USI_SERIAL_BAUD_ENUM)
 } BaudRate;
 
+// The driver reaches each register through the pointers in the port's
+// register structs, so the tests can point it at MockAVR's virtual registers.
+// That's a pointer load before every access, in the ISRs too.  Define
+// USI_SERIAL_FIXED_REGISTERS to bind each access to USI_SERIAL_IO(r) at
+// compile time instead, the register itself by default, which lets avr-gcc
+// use in, out, sbi and cbi.  The structs are still passed to the init
+// functions, to say which timer a port uses, but aren't read through.  For
+// the host, also define USI_SERIAL_IO(r) as virtual##r.
+//
+// The saving's estimated by counting instructions, not measured on a
+// target: about 30 cycles of the PCINT0 ISR for a start bit, 14 of them
+// before timer0 starts, and 15 to 25 of the USI overflow ISR's.
+#ifndef USI_SERIAL_IO
+#define USI_SERIAL_IO(r) r
+#endif
+
 typedef struct __usi_ser_regs {
     volatile uint8_t *pPORTB;
     volatile uint8_t *pPINB;
@@ -37,28 +202,688 @@ typedef struct __usi_ser_regs {
     volatile uint8_t *pGIFR;
     volatile uint8_t *pGIMSK;
     volatile uint8_t *pPCMSK;
+    volatile uint8_t *pTCNT0;
+    volatile uint8_t *pMCUCR;
 } USISerialRegisters;
 
+// timer1, used to receive in full duplex, or to clock the USI
+typedef struct __usi_ser_timer1_regs {
+    volatile uint8_t *pTCCR1;
+    volatile uint8_t *pTCNT1;
+    volatile uint8_t *pOCR1A;
+    volatile uint8_t *pOCR1C;
+    volatile uint8_t *pTIMSK;
+    volatile uint8_t *pTIFR;
+} USISerialTimer1Registers;
+
+/*
+ * A serial port.  Allocated by the caller, and only to be touched through
+ * the functions below.
+ */
+typedef struct __usi_serial_port {
+    const USISerialRegisters *reg;
+    void (*received_byte_handler)(uint8_t b, uint8_t status);
+    
+    // timer1, when receiving in full duplex, bit-banged or clocking the
+    // USI; NULL otherwise
+    const USISerialTimer1Registers *timer1_reg;
+    USISerialBitClock bit_clock;
+    bool bit_banged;
+    bool full_duplex;
+    
+    // PB0 and PB1 for the USI
+    uint8_t rx_pin_mask;
+    uint8_t tx_pin_mask;
+    
+    USISerialParity parity;
+    uint8_t data_bits;
+    uint8_t data_mask;
+    uint8_t rx_shift;
+    uint8_t rx_trailer_bits;
+    uint8_t rx_data;
+    
+    // transmit frame images; see usi_tx_enqueue()
+    uint8_t tx_trailer;
+    uint8_t tx_parity_bit;
+    uint8_t second_half_usisr;
+    uint8_t frame_bits;
+    bool tx_streaming_enabled;
+    
+    // bit timing; see usi_serial_timing.h
+    uint8_t bit_seed;
+    uint8_t bit_seed_fraction;
+    uint8_t initial_timer0_seed;
+    uint8_t initial_timer1_seed;
+    uint8_t timer1_clock_select;
+    uint8_t timer0_fraction_acc;
+    uint8_t timer1_fraction_acc;
+    
+    // auto-baud detection; see usi_serial_start_auto_baud()
+    BaudRate baud_rate;
+    uint8_t timer1_sample_ticks;
+    uint8_t sync_edges;
+    uint8_t sync_intervals;
+    uint8_t auto_baud_edges;
+    uint8_t auto_baud_first;
+    uint16_t auto_baud_ticks;
+    
+    // start-bit delay, in 1/256ths of a tick; see usi_serial_calibrate()
+    uint16_t startup_ticks_256;
+    uint16_t entry_ticks_256;
+    uint8_t calibration_frames_left;
+    uint16_t calibration_ticks;
+    
+    // timer1 receiver and bit-banged transmitter
+    uint8_t rx_sampled;
+    uint8_t rx_bits_left;
+    uint16_t tx_frame;
+    uint8_t tx_bits_left;
+    
+    uint8_t pending_first_half;
+    uint8_t pending_second_half;
+    
+    uint8_t tx_first_half[USI_SERIAL_TX_BUFFER_SIZE];
+    uint8_t tx_second_half[USI_SERIAL_TX_BUFFER_SIZE];
+    volatile uint8_t tx_head;
+    volatile uint8_t tx_tail;
+    
+    uint8_t rx_buffer[USI_SERIAL_RX_BUFFER_SIZE];
+    uint8_t rx_status[USI_SERIAL_RX_BUFFER_SIZE];
+    volatile uint8_t rx_head;
+    volatile uint8_t rx_tail;
+    volatile uint16_t rx_overrun_count;
+    volatile uint16_t rx_parity_error_count;
+    volatile uint16_t rx_framing_error_count;
+    
+    // frames received, with their trailers, waiting to be checked and
+    // delivered by the ISR that's delivering
+    uint8_t rx_handoff_data[USI_SERIAL_RX_HANDOFF_SIZE];
+    uint8_t rx_handoff_trailer[USI_SERIAL_RX_HANDOFF_SIZE];
+    volatile uint8_t rx_handoff_head;
+    volatile uint8_t rx_handoff_tail;
+    volatile bool rx_delivering;
+    
+    #ifdef USI_SERIAL_TIMESTAMPS
+    // see usi_serial_set_clock().  Each received frame's start bit time
+    // follows it from the PCINT0 ISR, through the handoff, to the receive
+    // buffer, the message or the handler.
+    USISerialTimestamp (*clock)(void);
+    USISerialTimestamp rx_start_time;
+    USISerialTimestamp rx_handoff_time[USI_SERIAL_RX_HANDOFF_SIZE];
+    USISerialTimestamp rx_frame_time;
+    USISerialTimestamp rx_delivered_time;
+    USISerialTimestamp rx_time[USI_SERIAL_RX_BUFFER_SIZE];
+    USISerialTimestamp message_time;
+    USISerialTimestamp max_handler_time;
+    
+    // frames sent, oldest first; see usi_tx_read_timestamp()
+    USISerialTimestamp tx_time[USI_SERIAL_TX_BUFFER_SIZE];
+    volatile uint8_t tx_time_head;
+    volatile uint8_t tx_time_tail;
+    volatile uint16_t tx_time_lost_count;
+    #endif
+    
+    // see usi_serial_active_bits()
+    volatile uint32_t active_bit_count;
+    
+    // see usi_serial_read_stats()
+    volatile uint32_t rx_frame_count;
+    volatile uint32_t tx_frame_count;
+    volatile uint16_t tx_sleep_entry_count;
+    volatile uint16_t tx_held_by_rx_count;
+    volatile uint16_t rx_missed_count;
+    
+    // idle-line timeout; see usi_serial_set_idle_timeout()
+    uint8_t idle_bits;
+    uint16_t idle_ticks;
+    uint16_t idle_ticks_left;
+    uint16_t idle_chunk;
+    volatile bool rx_idle_timing;
+    uint8_t *message_buf;
+    uint8_t message_size;
+    uint8_t message_len;
+    uint8_t message_status;
+    void (*message_handler)(uint8_t *message, uint8_t len, uint8_t status);
+    volatile bool message_delivering;
+    
+    // flow control; see usi_serial_set_flow_control()
+    USISerialFlowControl flow_control;
+    uint8_t rts_pin_mask;
+    uint8_t cts_pin_mask;
+    uint8_t rx_high_watermark;
+    uint8_t rx_low_watermark;
+    volatile bool rx_throttled;
+    volatile bool tx_stopped;  // by the peer's XOFF
+    volatile uint8_t tx_control; // XON or XOFF to send next; 0 for none
+    uint8_t xon_image[2];
+    uint8_t xoff_image[2];
+    
+    volatile USIRxState rxState;
+    volatile USITxState txState;
+} USISerialPort;
+
 /*
- * Initialize USI Serial receiver.
+ * Initialize a USI-backed port, in half duplex.  It takes over the USI,
+ * timer0 and PCINT0 from any port previously initialized here.
  *
+ * @param port the port to initialize
  * @param reg register config struct
- * @param received_byte_handler pointer to handler of received bytes
- * @param baud_rate the baud rate to operate at
- * @param enable_even_parity true if using even parity
+ * @param received_byte_handler pointer to handler of received bytes, called
+ *        from the USI overflow ISR with each byte and its status, once the
+ *        stop bit's been sampled.  Interrupts are enabled by then, so the
+ *        next start bit isn't held up.  Frames that end while it's running
+ *        are delivered in turn once it returns, rather than by calling it
+ *        again; up to USI_SERIAL_RX_HANDOFF_SIZE can wait, and any more are
+ *        counted as overruns.  If NULL, received bytes are stored in a ring
+ *        buffer to be drained with usi_rx_read().
+ * @param baud_rate the baud rate to operate at; timer0 must have been
+ *        initialized with USI_SERIAL_TIMER0_PRESCALE(baud_rate)
+ * @param format frame format for both directions.  With 7 data bits, the
+ *        MSB of each byte transmitted is ignored and of each byte received
+ *        is 0.  Ignored if the build's is fixed; see
+ *        USI_SERIAL_FIXED_DATA_BITS.
  */
 void usi_serial_init(
+    USISerialPort *port,
+    const USISerialRegisters *reg,
+    void (*received_byte_handler)(uint8_t b, uint8_t status),
+    const BaudRate baud_rate,
+    const USISerialFrameFormat *format
+);
+
+/*
+ * Initialize a USI-backed port, in half duplex, with its bits clocked by
+ * timer1 instead of timer0, leaving timer0 to the application.  It takes
+ * over the USI and PCINT0 from the port previously using them, and timer1
+ * too if that port was in full duplex, but refuses while a bit-banged port
+ * has timer1; see usi_serial_close_bit_banged().
+ *
+ * The USI can't count timer1's compare matches itself, so the timer1
+ * compare ISR strobes its clock in software as it starts, a compare
+ * interrupt for every bit of a frame; timer0 only costs one per bit at
+ * dithered rates.  Timer1's prescaler is set as fine as 1.5 bit periods
+ * allow, and it's always dithered, keeping the bit period to 1/256 of a
+ * tick at timer0's prescaler; rates timer0 rounds to a whole tick come out
+ * closer to nominal on timer1.  Each strobe comes an interrupt response and
+ * prologue after the compare match, so the first is brought forward by
+ * USI_SERIAL_PCINT_ENTRY_CYCLES.
+ *
+ * Full duplex, the idle timeout, auto-baud detection and calibration all
+ * need timer0, and a bit-banged port needs timer1; none of them can be used
+ * alongside this.
+ *
+ * @param port the port to initialize
+ * @param reg register config struct
+ * @param timer1_reg timer1 register config struct
+ * @param received_byte_handler as for usi_serial_init()
+ * @param baud_rate the baud rate to operate at; timer0 needn't be
+ *        initialized
+ * @param format frame format for both directions, unless the build's is
+ *        fixed
+ * @return false, leaving the port as it was, if a bit-banged port has timer1
+ */
+bool usi_serial_init_timer1(
+    USISerialPort *port,
     const USISerialRegisters *reg,
-    void (*received_byte_handler)(uint8_t),
+    const USISerialTimer1Registers *timer1_reg,
+    void (*received_byte_handler)(uint8_t b, uint8_t status),
     const BaudRate baud_rate,
-    const bool enable_even_parity
+    const USISerialFrameFormat *format
+);
+
+/*
+ * Switch to full duplex: received bits are sampled in software, timed by
+ * timer1, leaving the USI and timer0 to transmit.  A byte can then arrive
+ * while another is being sent, and a transmission needn't wait for a
+ * reception to finish.  Call while idle, after usi_serial_init(), which
+ * returns to half duplex.
+ *
+ * Each received bit costs a timer1 compare interrupt, sampled as the ISR
+ * starts; a transmit ISR running at the time delays the sample, which
+ * USI_SERIAL_TIMER1_SAMPLE_ADVANCE_CYCLES allows for.  The bit period must
+ * be at least USI_SERIAL_TIMER1_MIN_BIT_CYCLES, 19200 baud or slower at
+ * 8MHz, and auto-baud detection only locks on to such rates.
+ *
+ * @param port a USI-backed port clocked by timer0; ignored otherwise
+ * @param timer1_reg timer1 register config struct
+ * @return false, staying in half duplex, if the port's clocked by timer1 or
+ *         its rate's too fast
+ */
+bool usi_serial_enable_full_duplex(
+    USISerialPort *port,
+    const USISerialTimer1Registers *timer1_reg
 );
 
 /*
- * Transmit a byte.
+ * Deliver received bytes in messages delimited by silence on the line, as
+ * Modbus RTU's are, instead of one at a time.  Once a frame's stop bit has
+ * ended, timer0 carries on timing the idle line; if idle_bits bit periods
+ * pass without a start bit, the bytes received since the last message go to
+ * the message handler together.  A start bit cancels the timeout.  Nothing
+ * is transmitted while it's running, so a reply always follows the whole of
+ * a message.
+ *
+ * The timeout's counted in chunks of up to 256 ticks, each costing a
+ * compare interrupt.  Modbus RTU ends a message after 3.5 characters, 35
+ * bit periods for 8N1, and calls a gap of more than 1.5, 15 bit periods,
+ * within one an error.
+ *
+ * Call while idle, after usi_serial_init(), which turns it off, as does
+ * usi_serial_enable_full_duplex().  Auto-baud detection rescales it to the
+ * rate detected.
+ *
+ * @param port a USI-backed port in half duplex; full duplex keeps timer0 busy
+ *        transmitting
+ * @param idle_bits the timeout, in bit periods; 0 to turn it off
+ * @param buf buffer for each message
+ * @param size size of buf; bytes beyond it are counted as overruns and the
+ *        message is flagged with USI_SERIAL_RX_OVERRUN
+ * @param message_handler called from the timer0 compare ISR with buf, the
+ *        message's length and the USI_SERIAL_RX_* status of its bytes
+ *        together.  buf is written again from the next frame on, which
+ *        may end before the handler's returned; the next message isn't
+ *        delivered until it has.
+ * @return false, leaving the timeout off, if the port can't use it
+ */
+bool usi_serial_set_idle_timeout(
+    USISerialPort *port,
+    const uint8_t idle_bits,
+    uint8_t *buf,
+    const uint8_t size,
+    void (*message_handler)(uint8_t *message, uint8_t len, uint8_t status)
+);
+
+/*
+ * Throttle the peer when the receive buffer fills, and be throttled by it.
+ *
+ * Once usi_rx_available() reaches high_watermark, the port asks the peer to
+ * pause; once it's been drained to low_watermark, to carry on.  The peer
+ * only pauses at the end of the frame it's sending, or some frames later
+ * for XON/XOFF, so leave room above high_watermark.  Ports with a received
+ * byte handler or an idle timeout never ask.  Before starting each frame,
+ * the port checks that the peer hasn't asked it to pause.
+ *
+ * USI_SERIAL_FLOW_RTS_CTS uses two spare pins of port B, both active low:
+ * RTS is driven low while the port can take more, and a frame's only
+ * started while the peer holds CTS low.  CTS going low raises the pin
+ * change interrupt, to restart transmission.
+ *
+ * USI_SERIAL_FLOW_XON_XOFF sends USI_SERIAL_XOFF and USI_SERIAL_XON ahead of
+ * anything queued, and acts on, and drops, those received, so the data
+ * mustn't contain them.  In half duplex, receiving stops while XOFF is sent,
+ * and a frame that follows straight on is lost; prefer full duplex.
+ *
+ * Call while idle, after usi_serial_init() or usi_serial_init_bit_banged(),
+ * which turn it off.
+ *
+ * @param port the port
+ * @param flow_control USI_SERIAL_FLOW_*
+ * @param rts_pin the PBn RTS output, for USI_SERIAL_FLOW_RTS_CTS
+ * @param cts_pin the PBn CTS input, for USI_SERIAL_FLOW_RTS_CTS; PCINTn must
+ *        be free
+ * @param high_watermark fill at which the peer's asked to pause, no more
+ *        than USI_SERIAL_RX_BUFFER_SIZE
+ * @param low_watermark fill at which it's asked to carry on, less than
+ *        high_watermark
+ * @return false, leaving flow control off, if the watermarks are out of
+ *         range
+ */
+bool usi_serial_set_flow_control(
+    USISerialPort *port,
+    const USISerialFlowControl flow_control,
+    const uint8_t rts_pin,
+    const uint8_t cts_pin,
+    const uint8_t high_watermark,
+    const uint8_t low_watermark
+);
+
+/*
+ * @return true while the port's asking the peer to pause
+ */
+bool usi_serial_rx_throttled(USISerialPort *port);
+
+/*
+ * @return true while the peer's asking the port to pause: CTS is high or,
+ *         with XON/XOFF, XOFF was the last received
+ */
+bool usi_serial_tx_stopped(USISerialPort *port);
+
+/*
+ * Detect the peer's baud rate from the next frame received, which must be
+ * USI_SERIAL_AUTO_BAUD_SYNC in the port's frame format.  The PCINT0 ISR
+ * times the frame's falling edges with timer0, and once the last of them
+ * has arrived the port's bit timing is set from the measurement, so it
+ * follows the peer's clock rather than the nominal rate.  The sync
+ * character isn't delivered.  Edges that don't fit the sync character
+ * restart the detection, but data that happens to alternate like it can be
+ * taken for it; peers should send it from an idle line.
+ *
+ * Only rates that share timer0's prescaler with the rate the port was
+ * initialized at can be detected; at 8MHz, 9600 to 38400 baud share
+ * prescale 8.  The measurement must be within
+ * USI_SERIAL_AUTO_BAUD_TOLERANCE of one of them.  Nothing is transmitted
+ * until the rate's been detected.  Call while idle, after usi_serial_init()
+ * and, if used, usi_serial_enable_full_duplex(), which rules out the rates
+ * too fast for it.
+ *
+ * @param port a USI-backed port clocked by timer0; ignored otherwise
+ */
+void usi_serial_start_auto_baud(USISerialPort *port);
+
+/*
+ * @return the rate the port was initialized at or, after auto-baud
+ *         detection, the nearest rate to the one measured; 0 while
+ *         detecting
+ */
+BaudRate usi_serial_baud_rate(USISerialPort *port);
+
+/*
+ * Measure the start-bit delay, USI_SERIAL_PCINT_STARTUP_CYCLES, for this
+ * build and clock, and centre the first sample of each frame from then on.
+ *
+ * For each of the next USI_SERIAL_CALIBRATION_FRAMES frames whose first data
+ * bit is a 1, the PCINT0 ISR stays armed after starting timer0, and reads
+ * TCNT0 on entry as the first data bit's rising edge comes in.  That's a bit
+ * period after the start bit's falling edge, so TCNT0 falls short of it by
+ * the time taken to start the timer, less USI_SERIAL_PCINT_ENTRY_CYCLES.
+ * Frames after a first data bit of 0 don't count.  Every frame is still
+ * received as usual.  The ISR must have finished starting the frame by
+ * then, so calibrate at a rate whose bit period is well over
+ * USI_SERIAL_PCINT_STARTUP_CYCLES: 19200 or slower at 8MHz.
+ *
+ * The bit period is the port's own, so calibrate against a peer whose clock
+ * is accurate, or after auto-baud detection has measured it.  Call while
+ * idle, on a USI-backed port in half duplex; usi_serial_init() returns to
+ * the compile-time delay.
+ *
+ * @param port a USI-backed port clocked by timer0; ignored otherwise
+ */
+void usi_serial_calibrate(USISerialPort *port);
+
+/*
+ * @return true until calibration's finished
+ */
+bool usi_serial_calibrating(USISerialPort *port);
+
+/*
+ * @return the start-bit delay in use, in CPU cycles: measured, or
+ *         USI_SERIAL_PCINT_STARTUP_CYCLES before calibration
+ */
+uint16_t usi_serial_startup_cycles(USISerialPort *port);
+
+/*
+ * Sleep until the next interrupt.  Call from the main loop whenever there's
+ * nothing else to do; it returns once the interrupt's ISR has run.
+ *
+ * The MCU powers down if no port is mid-frame, or timing the sync
+ * character's edges, so only the pin change interrupt of a start bit, or an
+ * interrupt from outside the driver, wakes it.  Timer0 and timer1 are only
+ * clocked while the driver needs them.  Otherwise it idles, and the driver's
+ * timer interrupts wake it.  Waking from power-down adds the oscillator's
+ * start-up time, 6 cycles for the internal RC oscillator, to the start-bit
+ * delay; usi_serial_calibrate() measures it along with the rest.
+ *
+ * Other peripherals the application needs clocked while this port's idle
+ * rule out calling this; use usi_serial_idle() instead.  The driver's own
+ * waits only ever idle.  Returns with interrupts enabled, as it must sleep
+ * with them enabled, so don't call from an ISR.
+ *
+ * @param port any port; its registers are used to sleep
+ */
+void usi_serial_sleep(USISerialPort *port);
+
+/*
+ * Sleep until the next interrupt, as usi_serial_sleep() does, but idle
+ * rather than power down, so the application's timers keep running.  The
+ * driver waits with this in usi_tx_byte(), usi_tx_flush(), usi_tx_drain()
+ * and the stdio stream.
+ *
+ * @param port any port; its registers are used to sleep
+ */
+void usi_serial_idle(USISerialPort *port);
+
+/*
+ * @return the number of times usi_serial_sleep() or usi_serial_idle() has
+ *         idled the MCU; each one lasts until the next interrupt, so this
+ *         doesn't say how long it slept
+ */
+uint16_t usi_serial_idle_sleep_entries(void);
+
+/*
+ * @return the number of times usi_serial_sleep() has powered the MCU down,
+ *         however long each one lasted
+ */
+uint16_t usi_serial_power_down_sleep_entries(void);
+
+/*
+ * @return the number of bit periods the port has spent receiving or
+ *         transmitting frames, since usi_serial_init(), during which the
+ *         MCU can only idle.  Divide by the baud rate for the time, and
+ *         compare with the time elapsed for the time it could power down.
+ */
+uint32_t usi_serial_active_bits(USISerialPort *port);
+
+/*
+ * Initialize a bit-banged port, in half duplex: each bit is sampled or
+ * driven by the timer1 compare ISR, and start bits are caught by the pin
+ * change interrupt.  It takes over timer1 from any port previously using
+ * it.  The TX pin is driven high while idle.
+ *
+ * The USI port's ISRs hold off timer1's, and vice versa, so the bit period
+ * must be at least USI_SERIAL_TIMER1_MIN_BIT_CYCLES: 19200 baud or slower at
+ * 8MHz.
+ *
+ * @param port the port to initialize
+ * @param reg register config struct; the USI registers are unused
+ * @param timer1_reg timer1 register config struct
+ * @param rx_pin the PBn receive pin; PCINTn must be free
+ * @param tx_pin the PBn transmit pin
+ * @param received_byte_handler as for usi_serial_init(), but called from the
+ *        timer1 compare ISR
+ * @param baud_rate the baud rate to operate at
+ * @param format frame format for both directions, unless the build's is
+ *        fixed
+ * @return false, leaving the port uninitialized, if timer1 is clocking the
+ *         USI port's bits, see usi_serial_init_timer1(), or the rate's too
+ *         fast
+ */
+bool usi_serial_init_bit_banged(
+    USISerialPort *port,
+    const USISerialRegisters *reg,
+    const USISerialTimer1Registers *timer1_reg,
+    const uint8_t rx_pin,
+    const uint8_t tx_pin,
+    void (*received_byte_handler)(uint8_t b, uint8_t status),
+    const BaudRate baud_rate,
+    const USISerialFrameFormat *format
+);
+
+/*
+ * Close a bit-banged port, releasing timer1 for usi_serial_init_timer1() or
+ * another bit-banged port.  Anything still queued, or mid-frame, is dropped,
+ * and the port mustn't be used again until it's re-initialized.
+ */
+void usi_serial_close_bit_banged(USISerialPort *port);
+
+/*
+ * Transmit a byte.  Queues the byte for transmission, only waiting, with
+ * usi_serial_idle(), if the transmit queue is full.
+ *
+ * The queue's only emptied by the driver's ISRs, so with the queue full this
+ * never returns if called from a received byte handler, or any other ISR;
+ * use usi_tx_enqueue() there.
+ *
+ * @param b the byte to transmit
+ */
+uint8_t usi_tx_byte(USISerialPort *port, const uint8_t b);
+
+/*
+ * Queue a byte for transmission without waiting.  Transmission starts
+ * immediately if the line is idle, otherwise the byte is sent by the USI
+ * overflow, or timer1 compare, interrupt once the bytes ahead of it have gone
+ * out.  Safe to call from a received byte handler, or any other ISR, as well
+ * as the main loop; interrupts are left as they were.
  *
  * @param b the byte to transmit
+ * @return true if the byte was queued, false if the queue is full
+ */
+bool usi_tx_enqueue(USISerialPort *port, const uint8_t b);
+
+/*
+ * @return the number of bytes that can be queued without blocking
+ */
+uint8_t usi_tx_space_available(USISerialPort *port);
+
+/*
+ * Wait, with usi_serial_idle(), until every byte queued has been handed to
+ * the ISRs.  The last may still be on the line.  Waits for as long as the
+ * peer's asking the port to pause.
  */
-uint8_t usi_tx_byte(const uint8_t b);
+void usi_tx_flush(USISerialPort *port);
+
+/*
+ * Wait, with usi_serial_idle(), until every byte queued has been sent and
+ * the port's stopped its timer, with the TX pin holding the line high for
+ * the last stop bit.  Call before putting the MCU to sleep other than with
+ * usi_serial_sleep(), or stopping its clock, so the last frame isn't cut
+ * short.  Waits for as long as the peer's asking the port to pause.
+ */
+void usi_tx_drain(USISerialPort *port);
+
+/*
+ * Enable or disable streaming transmission.  When enabled, queued bytes are
+ * sent back-to-back: the start bit of each frame immediately follows the stop
+ * bit of the previous one.  Otherwise an extra idle bit separates frames.
+ * Disabled by usi_serial_init().
+ *
+ * @param enable true to send queued frames without a gap
+ */
+void usi_tx_set_streaming(USISerialPort *port, const bool enable);
+
+/*
+ * Only meaningful when initialized without a received_byte_handler.
+ *
+ * @return the number of received bytes waiting to be read
+ */
+uint8_t usi_rx_available(USISerialPort *port);
+
+/*
+ * Remove the oldest byte from the receive buffer.  Check usi_rx_available()
+ * first; returns 0 if the buffer is empty.
+ *
+ * @return the received byte
+ */
+uint8_t usi_rx_read(USISerialPort *port);
+
+/*
+ * Like usi_rx_read(), but also reports whether the byte arrived intact.
+ *
+ * @param status set to the byte's USI_SERIAL_RX_* error flags; 0 if intact
+ * @return the received byte
+ */
+uint8_t usi_rx_read_with_status(USISerialPort *port, uint8_t *status);
+
+/*
+ * Remove up to len bytes from the receive buffer.  Bytes received with
+ * errors are included; use usi_rx_read_with_status() to tell them apart.
+ * Does not wait for more bytes to arrive.
+ *
+ * @param buf destination for the received bytes
+ * @param len maximum number of bytes to read
+ * @return the number of bytes copied into buf
+ */
+uint8_t usi_rx_read_block(USISerialPort *port, uint8_t *buf, const uint8_t len);
+
+/*
+ * @return the number of received bytes dropped because the receive buffer
+ *         was full
+ */
+uint16_t usi_rx_overrun_count(USISerialPort *port);
+
+/*
+ * @return the number of bytes received with a bad parity bit
+ */
+uint16_t usi_rx_parity_error_count(USISerialPort *port);
+
+/*
+ * @return the number of bytes received without a stop bit
+ */
+uint16_t usi_rx_framing_error_count(USISerialPort *port);
+
+/*
+ * Zero the overrun, parity error and framing error counts.
+ */
+void usi_rx_reset_error_counts(USISerialPort *port);
+
+/*
+ * Copy the port's counters, all as of the same moment, with interrupts
+ * disabled only for the copy.  Each ISR just adds one to a counter, so
+ * keeping them costs next to nothing; max_handler_time takes a read of the
+ * clock either side of each handler call, and only with a clock set.
+ *
+ * The 16 bit counts wrap; read and reset them often enough that they don't.
+ */
+void usi_serial_read_stats(USISerialPort *port, USISerialStats *stats);
+
+/*
+ * Zero all the counters in usi_serial_read_stats(), the error counts
+ * included.
+ */
+void usi_serial_reset_stats(USISerialPort *port);
+
+#ifdef USI_SERIAL_TIMESTAMPS
+
+/*
+ * Set the clock the port timestamps frames with, or NULL, the default, for
+ * none; every timestamp's 0 without one.  It's called from the ISRs, so must
+ * be quick and safe to call with interrupts disabled: an extended tick
+ * count, say, kept by the application's own timer, as the driver stops
+ * timer0 between frames.
+ *
+ * A received frame's timestamp is taken in the PCINT0 ISR once the start
+ * bit's time-critical work is done, a fixed delay after its falling edge,
+ * so the spacing between frames is exact to the clock's resolution.  A sent
+ * frame's is taken by the ISR that finishes it, as its last stop bit starts,
+ * or ends on a bit-banged port; XON and XOFF included.
+ *
+ * @param clock returns the time, in whatever units it counts
+ */
+void usi_serial_set_clock(USISerialPort *port, USISerialTimestamp (*clock)(void));
+
+/*
+ * Call from the received byte handler, or the idle timeout's message
+ * handler.
+ *
+ * @return the timestamp of the byte being delivered, or of the first byte
+ *         of the message
+ */
+USISerialTimestamp usi_serial_rx_timestamp(USISerialPort *port);
+
+/*
+ * Like usi_rx_read_with_status(), but also reports when the byte arrived.
+ *
+ * @param status set to the byte's USI_SERIAL_RX_* error flags; 0 if intact
+ * @param timestamp set to the byte's timestamp; 0 if the buffer is empty
+ * @return the received byte
+ */
+uint8_t usi_rx_read_with_timestamp(USISerialPort *port, uint8_t *status,
+                                   USISerialTimestamp *timestamp);
+
+/*
+ * Remove the timestamp of the oldest frame sent.  As many are kept as the
+ * transmit queue holds frames; older ones are overwritten.
+ *
+ * @param timestamp set to the frame's timestamp
+ * @return false if there are none
+ */
+bool usi_tx_read_timestamp(USISerialPort *port, USISerialTimestamp *timestamp);
+
+/*
+ * @return the number of sent frames' timestamps overwritten before they
+ *         could be read
+ */
+uint16_t usi_tx_timestamp_lost_count(USISerialPort *port);
+
+#endif
 
 #endif
@@ -0,0 +1,151 @@
+#include <stddef.h>
+
+#include "usi_serial_cobs.h"
+
+// the longest run of packet bytes a block can carry
+#define MAX_BLOCK_LEN 254
+
+// ----- decoding
+
+static void reset_decoder(USISerialCOBSDecoder *dec) {
+    dec->len = 0;
+    dec->block_left = 0;
+    dec->zero_pending = false;
+    dec->in_packet = false;
+    dec->status = 0;
+}
+
+static inline void store(USISerialCOBSDecoder *dec, const uint8_t b) {
+    if (dec->len < dec->size) {
+        dec->buf[dec->len++] = b;
+    }
+    else {
+        dec->status |= USI_COBS_OVERRUN;
+    }
+}
+
+void usi_cobs_decoder_init(
+    USISerialCOBSDecoder *dec,
+    uint8_t *buf,
+    const uint8_t size,
+    void (*packet_handler)(uint8_t *packet, uint8_t len, uint8_t status)
+) {
+    dec->packet_handler = packet_handler;
+    
+    usi_cobs_decoder_set_buffer(dec, buf, size);
+    reset_decoder(dec);
+}
+
+void usi_cobs_decoder_set_buffer(USISerialCOBSDecoder *dec, uint8_t *buf, const uint8_t size) {
+    dec->buf = buf;
+    dec->size = size;
+}
+
+void usi_cobs_decode(USISerialCOBSDecoder *dec, const uint8_t b, const uint8_t status) {
+    if (b == USI_COBS_DELIMITER) {
+        if (dec->in_packet) {
+            if (dec->block_left != 0) {
+                dec->status |= USI_COBS_TRUNCATED;
+            }
+            
+            dec->packet_handler(dec->buf, dec->len, dec->status | status);
+        }
+        
+        reset_decoder(dec);
+        
+        return;
+    }
+    
+    dec->status |= status;
+    
+    if (dec->block_left != 0) {
+        store(dec, b);
+        dec->block_left -= 1;
+        
+        return;
+    }
+    
+    // a code byte; the zero the last block stood for is only stored now,
+    // as the last block of a packet doesn't stand for one
+    if (dec->zero_pending) {
+        store(dec, 0);
+    }
+    
+    dec->block_left = b - 1;
+    dec->zero_pending = (b != 0xff);
+    dec->in_packet = true;
+}
+
+// ----- encoding
+
+void usi_cobs_encoder_init(USISerialCOBSEncoder *enc, const uint8_t *packet, const uint8_t len) {
+    enc->packet = packet;
+    enc->len = len;
+    enc->pos = 0;
+    enc->block_end = 0;
+    enc->code = 0;
+    enc->code_sent = false;
+    enc->delimiter_next = false;
+    enc->done = false;
+}
+
+bool usi_cobs_encoder_done(const USISerialCOBSEncoder *enc) {
+    return enc->done;
+}
+
+uint8_t usi_cobs_encode(USISerialCOBSEncoder *enc) {
+    uint8_t b;
+    
+    if (enc->done) {
+        return USI_COBS_DELIMITER;
+    }
+    
+    if (enc->delimiter_next) {
+        enc->done = true;
+        
+        return USI_COBS_DELIMITER;
+    }
+    
+    if (! enc->code_sent) {
+        // the block runs to the next zero, the end of the packet or its
+        // longest, whichever's first
+        uint8_t end = enc->pos;
+        
+        while ((end < enc->len) && (enc->packet[end] != 0) &&
+               ((uint8_t)(end - enc->pos) < MAX_BLOCK_LEN))
+        {
+            end += 1;
+        }
+        
+        enc->block_end = end;
+        enc->code = (end - enc->pos) + 1;
+        enc->code_sent = true;
+        
+        b = enc->code;
+    }
+    else {
+        b = enc->packet[enc->pos++];
+    }
+    
+    if (enc->pos == enc->block_end) {
+        enc->code_sent = false;
+        
+        if (enc->pos == enc->len) {
+            enc->delimiter_next = true;
+        }
+        else if (enc->code != 0xff) {
+            // skip the zero the block stands for
+            enc->pos += 1;
+        }
+    }
+    
+    return b;
+}
+
+bool usi_cobs_send(USISerialPort *port, USISerialCOBSEncoder *enc) {
+    while (! enc->done && (usi_tx_space_available(port) != 0)) {
+        usi_tx_enqueue(port, usi_cobs_encode(enc));
+    }
+    
+    return enc->done;
+}
@@ -0,0 +1,139 @@
+/*
+ * Optional packet framing on top of a port, with Consistent Overhead Byte
+ * Stuffing.
+ *
+ * Each packet goes out as COBS blocks followed by a 0 delimiter, so the
+ * packet's own zeroes never appear on the line: a block is a code byte n,
+ * then n - 1 non-zero bytes of the packet, and stands for them followed by a
+ * zero unless n is 0xff or it's the last block.  That's one byte of overhead
+ * for every 254 of the packet, and a receiver can always resynchronize at
+ * the next 0.
+ *
+ * The decoder takes one received byte at a time and writes the packet
+ * straight into a buffer supplied by the caller, raising a single event once
+ * the delimiter arrives.  Each byte's work is bounded, so it can be fed from
+ * the port's received byte handler, in the ISR.  The encoder produces one
+ * byte at a time from the caller's packet, for the main loop to queue as
+ * room comes free.
+ */
+
+#ifndef USI_SERIAL_COBS_H
+#define USI_SERIAL_COBS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usi_serial.h"
+
+// the packet delimiter
+#define USI_COBS_DELIMITER 0x00
+
+// status of each decoded packet, along with any USI_SERIAL_RX_* status of
+// its bytes; 0 if it arrived intact
+#define USI_COBS_OVERRUN   (1 << 6) // longer than the buffer; the rest was dropped
+#define USI_COBS_TRUNCATED (1 << 7) // the delimiter came mid-block
+
+typedef struct __usi_cobs_decoder {
+    uint8_t *buf;
+    uint8_t size;
+    uint8_t len;
+    
+    // packet bytes left in the current block, and whether a zero follows it
+    uint8_t block_left;
+    bool zero_pending;
+    
+    bool in_packet;
+    uint8_t status;
+    
+    void (*packet_handler)(uint8_t *packet, uint8_t len, uint8_t status);
+} USISerialCOBSDecoder;
+
+typedef struct __usi_cobs_encoder {
+    const uint8_t *packet;
+    uint8_t len;
+    uint8_t pos;
+    
+    // end of the current block, its code byte and whether that's gone out
+    uint8_t block_end;
+    uint8_t code;
+    bool code_sent;
+    
+    bool delimiter_next;
+    bool done;
+} USISerialCOBSEncoder;
+
+/*
+ * Initialize a decoder.
+ *
+ * @param dec the decoder to initialize
+ * @param buf buffer for the packet being received
+ * @param size size of buf; longer packets are reported with USI_COBS_OVERRUN
+ * @param packet_handler called once for each packet, with buf, its length and
+ *        its status.  Bytes received after it returns are written to the
+ *        same buffer, so it must be done with the packet by then, or call
+ *        usi_cobs_decoder_set_buffer() for the next one.  Called from
+ *        wherever usi_cobs_decode() is.
+ */
+void usi_cobs_decoder_init(
+    USISerialCOBSDecoder *dec,
+    uint8_t *buf,
+    const uint8_t size,
+    void (*packet_handler)(uint8_t *packet, uint8_t len, uint8_t status)
+);
+
+/*
+ * Hand the decoder another buffer, from the packet handler, so the one just
+ * filled can be read after it returns.
+ */
+void usi_cobs_decoder_set_buffer(USISerialCOBSDecoder *dec, uint8_t *buf, const uint8_t size);
+
+/*
+ * Decode a received byte, calling the packet handler if it's the delimiter
+ * at the end of a packet.  Delimiters between packets are ignored, so a
+ * sender can start each packet with one as well, to flush out anything the
+ * receiver caught the end of.
+ *
+ * @param b the byte received
+ * @param status the byte's USI_SERIAL_RX_* status, passed on with the packet
+ */
+void usi_cobs_decode(USISerialCOBSDecoder *dec, const uint8_t b, const uint8_t status);
+
+/*
+ * Start encoding a packet.  The packet isn't copied, and must be left alone
+ * until it's been encoded.
+ *
+ * @param enc the encoder to initialize
+ * @param packet the packet to encode
+ * @param len its length
+ */
+void usi_cobs_encoder_init(USISerialCOBSEncoder *enc, const uint8_t *packet, const uint8_t len);
+
+/*
+ * @return true once the packet and its delimiter have been encoded
+ */
+bool usi_cobs_encoder_done(const USISerialCOBSEncoder *enc);
+
+/*
+ * Encode the next byte of the packet.  Finding the end of a block takes a
+ * scan of up to 254 bytes at its start; the rest are a copy.
+ *
+ * @return the next byte to send, the delimiter last of all; the delimiter
+ *         again once done
+ */
+uint8_t usi_cobs_encode(USISerialCOBSEncoder *enc);
+
+/*
+ * Queue as much of the packet being encoded as there's room for, without
+ * waiting.  Call again, from the main loop, until it returns true.
+ *
+ * @return true once the whole packet has been queued
+ */
+bool usi_cobs_send(USISerialPort *port, USISerialCOBSEncoder *enc);
+
+/*
+ * @return the most bytes a packet of len bytes encodes to, including the
+ *         delimiter
+ */
+#define USI_COBS_MAX_ENCODED_LEN(len) ((len) + ((len) / 254) + 2)
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef __AVR__
+// for fopencookie()
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+
+#include "usi_serial_stdio.h"
+
+// queues a character written, waiting for room unless non-blocking
+static void put_char(USISerialStdio *stream, const uint8_t c) {
+    if (! (stream->flags & USI_SERIAL_STDIO_NONBLOCKING)) {
+        usi_tx_byte(stream->port, c);
+    }
+    else if (! usi_tx_enqueue(stream->port, c)) {
+        stream->dropped_count += 1;
+    }
+}
+
+// the next character received, waiting for one unless non-blocking
+//
+// @return the character, or -1 if there's none
+static int get_char(USISerialStdio *stream) {
+    while (usi_rx_available(stream->port) == 0) {
+        if (stream->flags & USI_SERIAL_STDIO_NONBLOCKING) {
+            return -1;
+        }
+        
+        usi_serial_idle(stream->port);
+    }
+    
+    return usi_rx_read(stream->port);
+}
+
+#ifdef __AVR__
+
+static int stream_put(char c, FILE *file) {
+    put_char(fdev_get_udata(file), c);
+    
+    return 0;
+}
+
+static int stream_get(FILE *file) {
+    const int c = get_char(fdev_get_udata(file));
+    
+    return (c < 0) ? _FDEV_EOF : c;
+}
+
+static FILE *open_stream(USISerialStdio *stream) {
+    fdev_setup_stream(&stream->file, &stream_put, &stream_get, _FDEV_SETUP_RW);
+    fdev_set_udata(&stream->file, stream);
+    
+    return &stream->file;
+}
+
+static void close_stream(USISerialStdio *stream) {
+    fdev_close();
+}
+
+#else
+
+static size_t write_chars(USISerialStdio *stream, const char *buf, const size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        put_char(stream, buf[i]);
+    }
+    
+    return len;
+}
+
+// as many characters as have been received, once there's at least one
+static size_t read_chars(USISerialStdio *stream, char *buf, const size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    
+    const int c = get_char(stream);
+    
+    if (c < 0) {
+        return 0;
+    }
+    
+    buf[0] = c;
+    
+    size_t n = 1;
+    
+    while ((n < len) && (usi_rx_available(stream->port) != 0)) {
+        buf[n++] = usi_rx_read(stream->port);
+    }
+    
+    return n;
+}
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+
+static int funopen_write(void *cookie, const char *buf, int len) {
+    return write_chars(cookie, buf, len);
+}
+
+static int funopen_read(void *cookie, char *buf, int len) {
+    return read_chars(cookie, buf, len);
+}
+
+static FILE *open_host_stream(USISerialStdio *stream) {
+    return funopen(stream, &funopen_read, &funopen_write, NULL, NULL);
+}
+
+#else
+
+// glibc takes a short write for a failed one, so the whole of len is sent
+static ssize_t cookie_write(void *cookie, const char *buf, size_t len) {
+    return write_chars(cookie, buf, len);
+}
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t len) {
+    return read_chars(cookie, buf, len);
+}
+
+static FILE *open_host_stream(USISerialStdio *stream) {
+    const cookie_io_functions_t functions = { &cookie_read, &cookie_write, NULL, NULL };
+    
+    return fopencookie(stream, "r+", functions);
+}
+
+#endif
+
+static FILE *open_stream(USISerialStdio *stream) {
+    stream->file = open_host_stream(stream);
+    
+    // nothing held back from the transmit queue, as on the target
+    if (stream->file != NULL) {
+        setvbuf(stream->file, NULL, _IONBF, 0);
+    }
+    
+    return stream->file;
+}
+
+static void close_stream(USISerialStdio *stream) {
+    if (stream->file != NULL) {
+        fclose(stream->file);
+        stream->file = NULL;
+    }
+}
+
+#endif
+
+FILE *usi_serial_stdio_open(USISerialStdio *stream, USISerialPort *port, const uint8_t flags) {
+    stream->port = port;
+    stream->flags = flags;
+    stream->dropped_count = 0;
+    
+    return open_stream(stream);
+}
+
+void usi_serial_stdio_close(USISerialStdio *stream) {
+    close_stream(stream);
+}
+
+uint16_t usi_serial_stdio_dropped_count(const USISerialStdio *stream) {
+    return stream->dropped_count;
+}
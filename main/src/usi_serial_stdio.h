@@ -0,0 +1,71 @@
+/*
+ * Optional stdio stream on top of a port, for printf() and friends.
+ *
+ * Each character written goes into the port's transmit queue, for the ISRs
+ * to send, so formatting runs at the CPU's pace rather than the line's: it
+ * only waits while the queue's full or, opened non-blocking, drops the
+ * character and counts it instead.  Characters read come out of the receive
+ * buffer, so the port must have been initialized without a received byte
+ * handler.  Use usi_tx_flush() and usi_tx_drain() on the port to wait for
+ * what's been written to go out.
+ *
+ * On the target it's an avr-libc stream, set up with fdev_setup_stream().
+ * On the host, where the tests run, it's opened with fopencookie(), or
+ * funopen() on BSD and OS X, unbuffered, so nothing's held back from the
+ * transmit queue there either.
+ */
+
+#ifndef USI_SERIAL_STDIO_H
+#define USI_SERIAL_STDIO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usi_serial.h"
+
+// flags for usi_serial_stdio_open()
+
+// drop characters written while the transmit queue's full, rather than
+// waiting, and read EOF while the receive buffer's empty
+#define USI_SERIAL_STDIO_NONBLOCKING (1 << 0)
+
+typedef struct __usi_serial_stdio {
+#ifdef __AVR__
+    FILE file;
+#else
+    FILE *file;
+#endif
+
+    USISerialPort *port;
+    uint8_t flags;
+
+    // see usi_serial_stdio_dropped_count()
+    uint16_t dropped_count;
+} USISerialStdio;
+
+/*
+ * Open a stream on an initialized port, for reading and writing.
+ *
+ * A non-blocking stream reading EOF sets its end-of-file indicator;
+ * clearerr() it before reading again.
+ *
+ * @param stream the stream's state, which must outlive it
+ * @param port the port to read and write
+ * @param flags USI_SERIAL_STDIO_* flags, or 0
+ * @return the stream, or NULL if the host couldn't open it
+ */
+FILE *usi_serial_stdio_open(USISerialStdio *stream, USISerialPort *port, const uint8_t flags);
+
+/*
+ * Close a stream.  Anything written is left in the transmit queue.
+ */
+void usi_serial_stdio_close(USISerialStdio *stream);
+
+/*
+ * @return the number of characters a non-blocking stream has dropped for
+ *         want of room in the transmit queue
+ */
+uint16_t usi_serial_stdio_dropped_count(const USISerialStdio *stream);
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * Compile-time bit timing for the USI serial driver.
+ *
+ * Every supported baud rate gets its timer0 prescaler, its per-bit OCR0A seed
+ * and its start-bit seed calculated by the preprocessor from F_CPU, so the
+ * driver doesn't need to divide at run time.
+ *
+ * All values are rounded to the nearest timer tick.  The timing error of a
+ * rate is the difference between the rounded bit period and the real one, in
+ * basis points (0.01%).
+ *
+ * Rates whose rounded bit period is off by more than
+ * USI_SERIAL_DITHER_THRESHOLD are dithered: the bit period is kept to 1/256
+ * of a tick and the OCR0A compare ISR alternates between the seed and seed+1
+ * so the error doesn't accumulate across a frame.  This costs an interrupt per
+ * bit while the rate is in use.
+ *
+ * Note that in CTC mode timer0 matches every OCR0A+1 ticks, including the
+ * first match after starting the timer at 0, so both seeds are one less than
+ * the number of ticks they time.
+ */
+
+#ifndef USI_SERIAL_TIMING_H
+#define USI_SERIAL_TIMING_H
+
+#ifndef F_CPU
+#error "F_CPU must be defined"
+#endif
+
+// Time, in CPU cycles, between the falling edge of the start bit and timer0
+// being started by the PCINT0 ISR.  The default is the 28 ticks at prescale 8
+// the original driver assumed at 8MHz; it hasn't been measured for this ISR.
+// Measure it on your build, with usi_serial_calibrate() or a scope, before
+// overriding it with anything shorter: too short a figure makes rates
+// available that sample the wrong bits.  At the default, 57600 and 115200
+// aren't available at 8MHz, and no rate at any clock gets prescale 1; 57600
+// at 8MHz does with 175 cycles or less.  It's shorter with
+// USI_SERIAL_FIXED_REGISTERS, which saves the ISR loading register pointers:
+// by about 14 cycles, estimated rather than measured.
+#ifndef USI_SERIAL_PCINT_STARTUP_CYCLES
+#define USI_SERIAL_PCINT_STARTUP_CYCLES (28 * 8)
+#endif
+
+// Time, in CPU cycles, between a pin change and the PCINT0 ISR reading
+// TCNT0: the interrupt response and the ISR's prologue.  Calibration
+// measures the rest of the startup delay, and adds this to it.
+#ifndef USI_SERIAL_PCINT_ENTRY_CYCLES
+#define USI_SERIAL_PCINT_ENTRY_CYCLES 16
+#endif
+
+// Number of frames usi_serial_calibrate() averages over.  Must be a power of
+// two, no larger than 8.
+#ifndef USI_SERIAL_CALIBRATION_FRAMES
+#define USI_SERIAL_CALIBRATION_FRAMES 8
+#endif
+
+#if (USI_SERIAL_CALIBRATION_FRAMES & (USI_SERIAL_CALIBRATION_FRAMES - 1)) != 0
+#error "USI_SERIAL_CALIBRATION_FRAMES must be a power of 2"
+#endif
+
+#if USI_SERIAL_CALIBRATION_FRAMES > 8
+#error "USI_SERIAL_CALIBRATION_FRAMES must not exceed 8"
+#endif
+
+// Time, in CPU cycles, by which timer1's compare match is brought forward of
+// the middle of each bit when receiving in full duplex.  The ISR samples PB0
+// about 16 cycles after the match, later still if a transmit ISR's running;
+// the default centres the samples on the middle of the bit for transmit ISRs
+// of up to about 80 cycles.
+#ifndef USI_SERIAL_TIMER1_SAMPLE_ADVANCE_CYCLES
+#define USI_SERIAL_TIMER1_SAMPLE_ADVANCE_CYCLES 56
+#endif
+
+// Lengths, in CPU cycles, of the driver's ISRs from the interrupt to the end
+// of the epilogue, for avr-gcc -Os: the PCINT0 ISR's after its startup
+// delay.  Estimated from the code, not measured; the line simulator models
+// the same figures.  Rates and modes the CPU couldn't keep up with at these
+// aren't available.
+#ifndef USI_SERIAL_PCINT_REST_CYCLES
+#define USI_SERIAL_PCINT_REST_CYCLES 48
+#endif
+
+#ifndef USI_SERIAL_TIMER0_COMPA_CYCLES
+#define USI_SERIAL_TIMER0_COMPA_CYCLES 56
+#endif
+
+#ifndef USI_SERIAL_TIMER1_COMPA_CYCLES
+#define USI_SERIAL_TIMER1_COMPA_CYCLES 64
+#endif
+
+#ifndef USI_SERIAL_USI_OVF_CYCLES
+#define USI_SERIAL_USI_OVF_CYCLES 72
+#endif
+
+// Shortest bit period, in CPU cycles, for full duplex or a bit-banged port:
+// timer1's ISR takes every bit, and the USI port's PCINT0 and overflow ISRs
+// can both hold it off first.
+#define USI_SERIAL_TIMER1_MIN_BIT_CYCLES \
+    (USI_SERIAL_PCINT_STARTUP_CYCLES + USI_SERIAL_PCINT_REST_CYCLES + \
+     USI_SERIAL_USI_OVF_CYCLES + USI_SERIAL_TIMER1_COMPA_CYCLES)
+
+// Largest acceptable timing error, in basis points.
+#ifndef USI_SERIAL_MAX_TIMING_ERROR
+#define USI_SERIAL_MAX_TIMING_ERROR 200
+#endif
+
+// Largest difference, in basis points, between the bit period measured by
+// auto-baud detection and the rate it's taken to be.
+#ifndef USI_SERIAL_AUTO_BAUD_TOLERANCE
+#define USI_SERIAL_AUTO_BAUD_TOLERANCE 500
+#endif
+
+// Rounding error, in basis points, above which a rate is dithered.
+#ifndef USI_SERIAL_DITHER_THRESHOLD
+#define USI_SERIAL_DITHER_THRESHOLD 50
+#endif
+
+// ----- generic forms, for any clock
+
+// n/2 bit periods, in timer ticks, rounded
+#define USI_SERIAL_HALF_BITS_TICKS_F(f_cpu, baud, prescale, n) \
+    (((n) * 1ULL * (f_cpu) + 1ULL * (baud) * (prescale)) / (2ULL * (baud) * (prescale)))
+
+// true if the start-bit delay of 1.5 bit periods fits in 8 bits
+#define USI_SERIAL_PRESCALE_FITS_F(f_cpu, baud, prescale) \
+    (USI_SERIAL_HALF_BITS_TICKS_F(f_cpu, baud, prescale, 3) <= 255)
+
+// smallest prescaler that fits; prescale 1 gives the finest resolution at high
+// rates
+#define USI_SERIAL_PRESCALE_F(f_cpu, baud) \
+    (USI_SERIAL_PRESCALE_FITS_F(f_cpu, baud, 1)   ? 1   : \
+     USI_SERIAL_PRESCALE_FITS_F(f_cpu, baud, 8)   ? 8   : \
+     USI_SERIAL_PRESCALE_FITS_F(f_cpu, baud, 64)  ? 64  : \
+     USI_SERIAL_PRESCALE_FITS_F(f_cpu, baud, 256) ? 256 : 1024)
+
+// timer ticks in one bit period, rounded
+#define USI_SERIAL_BIT_TICKS_F(f_cpu, baud) \
+    USI_SERIAL_HALF_BITS_TICKS_F(f_cpu, baud, USI_SERIAL_PRESCALE_F(f_cpu, baud), 2)
+
+// timer ticks in one bit period, in 1/256ths of a tick, rounded
+#define USI_SERIAL_BIT_TICKS_256_F(f_cpu, baud) \
+    USI_SERIAL_HALF_BITS_TICKS_F(f_cpu, baud, USI_SERIAL_PRESCALE_F(f_cpu, baud), 512)
+
+// PCINT startup delay, in timer ticks
+#define USI_SERIAL_PCINT_STARTUP_TICKS_F(f_cpu, baud) \
+    ((2ULL * USI_SERIAL_PCINT_STARTUP_CYCLES + USI_SERIAL_PRESCALE_F(f_cpu, baud)) / \
+     (2ULL * USI_SERIAL_PRESCALE_F(f_cpu, baud)))
+
+// n CPU cycles, in 1/256ths of a timer tick, rounded
+#define USI_SERIAL_CYCLES_TICKS_256_F(f_cpu, baud, n) \
+    ((512ULL * (n) + USI_SERIAL_PRESCALE_F(f_cpu, baud)) / \
+     (2ULL * USI_SERIAL_PRESCALE_F(f_cpu, baud)))
+
+// true if timer0 can be started at least one tick before the middle of the
+// first data bit
+#define USI_SERIAL_STARTUP_FITS_F(f_cpu, baud) \
+    ((3ULL * (f_cpu)) >= \
+     (2ULL * (baud) * (USI_SERIAL_PCINT_STARTUP_CYCLES + USI_SERIAL_PRESCALE_F(f_cpu, baud))))
+
+// OCR0A value for the middle of the first data bit, less the PCINT startup
+// delay.  Only valid if USI_SERIAL_STARTUP_FITS_F().
+#define USI_SERIAL_INITIAL_TIMER0_SEED_F(f_cpu, baud) \
+    (((3ULL * (f_cpu) + 1ULL * (baud) * USI_SERIAL_PRESCALE_F(f_cpu, baud) - \
+       2ULL * (baud) * USI_SERIAL_PCINT_STARTUP_CYCLES) / \
+      (2ULL * (baud) * USI_SERIAL_PRESCALE_F(f_cpu, baud))) - 1)
+
+// true if the compare ISR reloads OCR0A with the per-bit seed before the
+// initial seed matches a second time: it's held off by the rest of the
+// PCINT0 ISR, and taken to have the same entry as that ISR.  Only a start-bit
+// delay of a handful of ticks, as prescale 1 leaves, falls foul of this.
+#define USI_SERIAL_RELOAD_FITS_F(f_cpu, baud) \
+    ((2ULL * (USI_SERIAL_INITIAL_TIMER0_SEED_F(f_cpu, baud) + 1) * USI_SERIAL_PRESCALE_F(f_cpu, baud)) > \
+     (USI_SERIAL_PCINT_REST_CYCLES + USI_SERIAL_PCINT_ENTRY_CYCLES))
+
+// timer1 sample advance, in timer ticks
+#define USI_SERIAL_TIMER1_SAMPLE_TICKS_F(f_cpu, baud) \
+    ((2ULL * USI_SERIAL_TIMER1_SAMPLE_ADVANCE_CYCLES + USI_SERIAL_PRESCALE_F(f_cpu, baud)) / \
+     (2ULL * USI_SERIAL_PRESCALE_F(f_cpu, baud)))
+
+// OCR1A value for sampling the first data bit in full duplex: the initial
+// timer0 seed, brought forward by the sample advance
+#define USI_SERIAL_INITIAL_TIMER1_SEED_F(f_cpu, baud) \
+    ((USI_SERIAL_INITIAL_TIMER0_SEED_F(f_cpu, baud) > USI_SERIAL_TIMER1_SAMPLE_TICKS_F(f_cpu, baud)) \
+        ? (USI_SERIAL_INITIAL_TIMER0_SEED_F(f_cpu, baud) - USI_SERIAL_TIMER1_SAMPLE_TICKS_F(f_cpu, baud)) \
+        : 0)
+
+// difference between two periods, in basis points
+#define _USI_SERIAL_ERROR_BP(actual, expected) \
+    ((((actual) >= (expected)) ? ((actual) - (expected)) : ((expected) - (actual))) \
+     * 10000ULL / (expected))
+
+// error of the rounded bit period, in basis points
+#define USI_SERIAL_ROUNDING_ERROR_F(f_cpu, baud) \
+    _USI_SERIAL_ERROR_BP(USI_SERIAL_BIT_TICKS_F(f_cpu, baud) * \
+                         USI_SERIAL_PRESCALE_F(f_cpu, baud) * (baud), \
+                         1ULL * (f_cpu))
+
+// true if the rate's bit period is dithered
+#define USI_SERIAL_DITHERED_F(f_cpu, baud) \
+    (USI_SERIAL_ROUNDING_ERROR_F(f_cpu, baud) > USI_SERIAL_DITHER_THRESHOLD)
+
+// OCR0A value for one bit period
+#define USI_SERIAL_TIMER0_SEED_F(f_cpu, baud) \
+    ((USI_SERIAL_DITHERED_F(f_cpu, baud) \
+        ? (USI_SERIAL_BIT_TICKS_256_F(f_cpu, baud) >> 8) \
+        : USI_SERIAL_BIT_TICKS_F(f_cpu, baud)) - 1)
+
+// fraction of a tick, in 1/256ths, added to each bit period by dithering
+#define USI_SERIAL_TIMER0_FRACTION_F(f_cpu, baud) \
+    (USI_SERIAL_DITHERED_F(f_cpu, baud) \
+        ? (USI_SERIAL_BIT_TICKS_256_F(f_cpu, baud) & 0xff) \
+        : 0)
+
+// timing error, in basis points, after any dithering
+#define USI_SERIAL_TIMING_ERROR_F(f_cpu, baud) \
+    (USI_SERIAL_DITHERED_F(f_cpu, baud) \
+        ? _USI_SERIAL_ERROR_BP(USI_SERIAL_BIT_TICKS_256_F(f_cpu, baud) * \
+                               USI_SERIAL_PRESCALE_F(f_cpu, baud) * (baud), \
+                               256ULL * (f_cpu)) \
+        : USI_SERIAL_ROUNDING_ERROR_F(f_cpu, baud))
+
+// true if the CPU keeps up with back-to-back frames: a dithered rate takes a
+// compare interrupt every bit, which mustn't take more than half of it
+#define USI_SERIAL_LOAD_OK_F(f_cpu, baud) \
+    (! USI_SERIAL_DITHERED_F(f_cpu, baud) || \
+     ((f_cpu) >= (2ULL * (baud) * USI_SERIAL_TIMER0_COMPA_CYCLES)))
+
+// true if the rate can be used at this clock
+#define USI_SERIAL_TIMING_OK_F(f_cpu, baud) \
+    (USI_SERIAL_PRESCALE_FITS_F(f_cpu, baud, USI_SERIAL_PRESCALE_F(f_cpu, baud)) && \
+     USI_SERIAL_STARTUP_FITS_F(f_cpu, baud) && \
+     USI_SERIAL_RELOAD_FITS_F(f_cpu, baud) && \
+     USI_SERIAL_LOAD_OK_F(f_cpu, baud) && \
+     (USI_SERIAL_TIMING_ERROR_F(f_cpu, baud) <= USI_SERIAL_MAX_TIMING_ERROR))
+
+// true if the rate can be used in full duplex, or on a bit-banged port, as
+// well
+#define USI_SERIAL_TIMER1_RATE_OK_F(f_cpu, baud) \
+    ((f_cpu) >= (1ULL * (baud) * USI_SERIAL_TIMER1_MIN_BIT_CYCLES))
+
+// ----- at F_CPU
+
+#define USI_SERIAL_PRESCALE(baud)             USI_SERIAL_PRESCALE_F(F_CPU, baud)
+#define USI_SERIAL_BIT_TICKS_256(baud)        USI_SERIAL_BIT_TICKS_256_F(F_CPU, baud)
+#define USI_SERIAL_TIMER0_SEED(baud)          USI_SERIAL_TIMER0_SEED_F(F_CPU, baud)
+#define USI_SERIAL_TIMER0_FRACTION(baud)      USI_SERIAL_TIMER0_FRACTION_F(F_CPU, baud)
+#define USI_SERIAL_DITHERED(baud)             USI_SERIAL_DITHERED_F(F_CPU, baud)
+#define USI_SERIAL_INITIAL_TIMER0_SEED(baud)  USI_SERIAL_INITIAL_TIMER0_SEED_F(F_CPU, baud)
+#define USI_SERIAL_PCINT_STARTUP_TICKS(baud)  USI_SERIAL_PCINT_STARTUP_TICKS_F(F_CPU, baud)
+#define USI_SERIAL_CYCLES_TICKS_256(baud, n)  USI_SERIAL_CYCLES_TICKS_256_F(F_CPU, baud, n)
+#define USI_SERIAL_TIMER1_SAMPLE_TICKS(baud)  USI_SERIAL_TIMER1_SAMPLE_TICKS_F(F_CPU, baud)
+#define USI_SERIAL_INITIAL_TIMER1_SEED(baud)  USI_SERIAL_INITIAL_TIMER1_SEED_F(F_CPU, baud)
+#define USI_SERIAL_TIMING_ERROR(baud)         USI_SERIAL_TIMING_ERROR_F(F_CPU, baud)
+#define USI_SERIAL_TIMING_OK(baud)            USI_SERIAL_TIMING_OK_F(F_CPU, baud)
+#define USI_SERIAL_TIMER1_RATE_OK(baud)       USI_SERIAL_TIMER1_RATE_OK_F(F_CPU, baud)
+
+/*
+ * The libtimer prescale value to pass to timer0_init() for a baud rate.
+ */
+#define USI_SERIAL_TIMER0_PRESCALE(baud) \
+    (USI_SERIAL_PRESCALE(baud) == 1   ? TIMER0_PRESCALE_1   : \
+     USI_SERIAL_PRESCALE(baud) == 8   ? TIMER0_PRESCALE_8   : \
+     USI_SERIAL_PRESCALE(baud) == 64  ? TIMER0_PRESCALE_64  : \
+     USI_SERIAL_PRESCALE(baud) == 256 ? TIMER0_PRESCALE_256 : TIMER0_PRESCALE_1024)
+
+/*
+ * The TCCR1 clock select bits for a baud rate, wherever timer1 times bits:
+ * receiving in full duplex, a bit-banged port, or a USI-backed port clocked
+ * by timer1; see usi_serial_init_timer1().  Timer1's prescaler has every
+ * power of two, so it runs at the same rate as timer0 and uses the same
+ * per-bit seed.
+ */
+#define USI_SERIAL_TIMER1_CLOCK_SELECT(baud) \
+    (USI_SERIAL_PRESCALE(baud) == 1   ? 1 : \
+     USI_SERIAL_PRESCALE(baud) == 8   ? 4 : \
+     USI_SERIAL_PRESCALE(baud) == 64  ? 7 : \
+     USI_SERIAL_PRESCALE(baud) == 256 ? 9 : 11)
+
+/*
+ * The baud rates available, as an X-macro: X(baud) is expanded once for each.
+ *
+ * Define USI_SERIAL_BAUD_RATES to choose your own; the build fails if any of
+ * them can't be used at F_CPU.  By default, every standard rate that can be
+ * used at F_CPU is available, and the build notes each one left out.
+ */
+#ifndef USI_SERIAL_BAUD_RATES
+
+#if USI_SERIAL_TIMING_OK(2400)
+#define _USI_SERIAL_BAUD_2400(X) X(2400)
+#else
+#pragma message "USI serial: 2400 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_2400(X)
+#endif
+
+#if USI_SERIAL_TIMING_OK(4800)
+#define _USI_SERIAL_BAUD_4800(X) X(4800)
+#else
+#pragma message "USI serial: 4800 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_4800(X)
+#endif
+
+#if USI_SERIAL_TIMING_OK(9600)
+#define _USI_SERIAL_BAUD_9600(X) X(9600)
+#else
+#pragma message "USI serial: 9600 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_9600(X)
+#endif
+
+#if USI_SERIAL_TIMING_OK(14400)
+#define _USI_SERIAL_BAUD_14400(X) X(14400)
+#else
+#pragma message "USI serial: 14400 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_14400(X)
+#endif
+
+#if USI_SERIAL_TIMING_OK(19200)
+#define _USI_SERIAL_BAUD_19200(X) X(19200)
+#else
+#pragma message "USI serial: 19200 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_19200(X)
+#endif
+
+#if USI_SERIAL_TIMING_OK(28800)
+#define _USI_SERIAL_BAUD_28800(X) X(28800)
+#else
+#pragma message "USI serial: 28800 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_28800(X)
+#endif
+
+#if USI_SERIAL_TIMING_OK(38400)
+#define _USI_SERIAL_BAUD_38400(X) X(38400)
+#else
+#pragma message "USI serial: 38400 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_38400(X)
+#endif
+
+#if USI_SERIAL_TIMING_OK(57600)
+#define _USI_SERIAL_BAUD_57600(X) X(57600)
+#else
+#pragma message "USI serial: 57600 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_57600(X)
+#endif
+
+#if USI_SERIAL_TIMING_OK(115200)
+#define _USI_SERIAL_BAUD_115200(X) X(115200)
+#else
+#pragma message "USI serial: 115200 baud isn't available at F_CPU"
+#define _USI_SERIAL_BAUD_115200(X)
+#endif
+
+#define USI_SERIAL_BAUD_RATES(X) \
+    _USI_SERIAL_BAUD_2400(X)  \
+    _USI_SERIAL_BAUD_4800(X)  \
+    _USI_SERIAL_BAUD_9600(X)  \
+    _USI_SERIAL_BAUD_14400(X) \
+    _USI_SERIAL_BAUD_19200(X) \
+    _USI_SERIAL_BAUD_28800(X) \
+    _USI_SERIAL_BAUD_38400(X) \
+    _USI_SERIAL_BAUD_57600(X) \
+    _USI_SERIAL_BAUD_115200(X)
+
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Optional trace of the USI serial driver's ISRs.
+ *
+ * Define USI_SERIAL_TRACE to record each PCINT0 entry, each USI overflow and
+ * each RX/TX state transition, with the value of TCNT0 at the time, in a
+ * circular buffer shared by all ports.  Drain it with usi_trace_read().
+ * Without USI_SERIAL_TRACE the trace points compile to nothing.
+ */
+
+#ifndef USI_SERIAL_TRACE_H
+#define USI_SERIAL_TRACE_H
+
+#include <stdint.h>
+
+// number of events kept; the oldest are overwritten.  Must be a power of two,
+// no larger than 128.
+#ifndef USI_SERIAL_TRACE_SIZE
+#define USI_SERIAL_TRACE_SIZE 32
+#endif
+
+#if (USI_SERIAL_TRACE_SIZE & (USI_SERIAL_TRACE_SIZE - 1)) != 0
+#error "USI_SERIAL_TRACE_SIZE must be a power of 2"
+#endif
+
+#if USI_SERIAL_TRACE_SIZE > 128
+#error "USI_SERIAL_TRACE_SIZE must not exceed 128"
+#endif
+
+// the driver's states; traced by value
+typedef enum __usi_rx_state {
+    USIRX_STATE_IDLE,
+    USIRX_STATE_RECEIVING,
+    USIRX_STATE_WAITING_FOR_PARITY_BIT, // and then the stop bit
+    USIRX_STATE_WAITING_FOR_STOP_BIT,
+    USIRX_STATE_DETECTING_BAUD,         // timing the sync character
+} USIRxState;
+
+typedef enum __usi_tx_state {
+    USITX_STATE_IDLE,
+    USITX_STATE_READY_FOR_FIRST_HALF_FRAME,
+    USITX_STATE_READY_FOR_SECOND_HALF_FRAME,
+    USITX_STATE_COMPLETE,
+    USITX_STATE_SENDING_BITS, // bit-banged ports only
+} USITxState;
+
+typedef enum __usi_trace_event {
+    USI_TRACE_PCINT0,   // value is PINB
+    USI_TRACE_USI_OVF,  // value is USIBR
+    USI_TRACE_RX_STATE, // value is the new USIRxState
+    USI_TRACE_TX_STATE, // value is the new USITxState
+} USITraceEvent;
+
+typedef struct __usi_trace_entry {
+    uint8_t event;
+    uint8_t value;
+    uint8_t tcnt0;
+} USITraceEntry;
+
+#ifdef USI_SERIAL_TRACE
+
+/*
+ * Remove up to len of the oldest events from the trace buffer.
+ *
+ * @param buf destination for the events
+ * @param len maximum number of events to read
+ * @return the number of events copied into buf
+ */
+uint8_t usi_trace_read(USITraceEntry *buf, const uint8_t len);
+
+/*
+ * @return the number of events overwritten before they could be read
+ */
+uint16_t usi_trace_lost_count(void);
+
+#endif
+
+#endif
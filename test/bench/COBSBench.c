@@ -0,0 +1,131 @@
+/*
+ * Host throughput benchmark for the COBS packet framing.
+ *
+ * Encodes and decodes a run of packets of each length, with payloads that
+ * have no zeroes, a few and nothing but, and reports megabytes of packet per
+ * second each way and the encoding's overhead.  Host figures only compare
+ * the payloads and lengths with each other; on the ATtiny85, count cycles in
+ * the disassembly.
+ *
+ * usage: cobs_bench [packets per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "usi_serial_cobs.h"
+
+#define MAX_PACKET_LEN 255
+
+typedef enum __payload {
+    PAYLOAD_NO_ZEROES,
+    PAYLOAD_SOME_ZEROES,
+    PAYLOAD_ALL_ZEROES,
+    PAYLOAD_COUNT,
+} Payload;
+
+static const char *payload_names[PAYLOAD_COUNT] = { "no zeroes", "1 in 16", "all zeroes" };
+
+static const uint8_t packet_lens[] = { 8, 32, 128, 255 };
+
+static uint8_t packet[MAX_PACKET_LEN];
+static uint8_t encoded[USI_COBS_MAX_ENCODED_LEN(MAX_PACKET_LEN)];
+static uint8_t decoded[MAX_PACKET_LEN];
+
+static USISerialCOBSDecoder dec;
+static volatile uint32_t decoded_bytes;
+
+static void packet_handler(uint8_t *p, uint8_t len, uint8_t status) {
+    decoded_bytes += len;
+}
+
+static void fill(const Payload payload, const uint8_t len) {
+    for (uint16_t i = 0; i < len; i++) {
+        switch (payload) {
+            case PAYLOAD_NO_ZEROES:
+                packet[i] = (i % 255) + 1;
+                break;
+
+            case PAYLOAD_SOME_ZEROES:
+                packet[i] = (i % 16) ? (uint8_t) (i * 7) | 1 : 0;
+                break;
+
+            default:
+                packet[i] = 0;
+                break;
+        }
+    }
+}
+
+static uint16_t encode(const uint8_t len) {
+    USISerialCOBSEncoder enc;
+    uint16_t n = 0;
+
+    usi_cobs_encoder_init(&enc, packet, len);
+
+    while (! usi_cobs_encoder_done(&enc)) {
+        encoded[n++] = usi_cobs_encode(&enc);
+    }
+
+    return n;
+}
+
+static double seconds_since(const clock_t start) {
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void bench(const Payload payload, const uint8_t len, const uint32_t runs) {
+    fill(payload, len);
+
+    clock_t start = clock();
+    uint16_t n = 0;
+
+    for (uint32_t r = 0; r < runs; r++) {
+        n = encode(len);
+    }
+
+    double encode_rate = (len * (double) runs) / seconds_since(start) / 1e6;
+
+    decoded_bytes = 0;
+    start = clock();
+
+    for (uint32_t r = 0; r < runs; r++) {
+        for (uint16_t i = 0; i < n; i++) {
+            usi_cobs_decode(&dec, encoded[i], 0);
+        }
+    }
+
+    double decode_rate = decoded_bytes / seconds_since(start) / 1e6;
+
+    if (decoded_bytes != (len * runs)) {
+        printf("decoded %lu bytes, expected %lu\n",
+               (unsigned long) decoded_bytes, (unsigned long) (len * runs));
+    }
+
+    printf("%-10s  %4u  %8.1f  %8.1f  %6.1f%%\n",
+           payload_names[payload], len, encode_rate, decode_rate,
+           (100.0 * (n - len)) / len);
+}
+
+int main(int argc, char **argv) {
+    uint32_t runs = 100000;
+
+    if (argc > 1) {
+        runs = atol(argv[1]);
+    }
+
+    usi_cobs_decoder_init(&dec, decoded, sizeof(decoded), &packet_handler);
+
+    printf("%lu packets per run\n\n", (unsigned long) runs);
+    printf("payload      len  enc MB/s  dec MB/s  overhead\n");
+
+    for (uint8_t p = 0; p < PAYLOAD_COUNT; p++) {
+        for (uint8_t i = 0; i < (sizeof(packet_lens) / sizeof(packet_lens[0])); i++) {
+            bench(p, packet_lens[i], runs);
+        }
+    }
+
+    return 0;
+}
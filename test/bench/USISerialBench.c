@@ -0,0 +1,337 @@
+/*
+ * Throughput benchmark for the USI serial driver, run on the line simulator.
+ *
+ * For each available baud rate, the remote end sends a burst of back-to-back
+ * frames which the main loop drains from the receive buffer, then the main
+ * loop streams a burst back to the remote end.  Reports sustained bytes per
+ * second, frames dropped or corrupted, and the share of time spent in ISRs.
+ *
+ * Then, in full duplex, both bursts at once.
+ *
+ * Then a bridge: the remote end of the USI port's line sends a burst, which
+ * the main loop forwards out of a bit-banged port on PB3/PB4.
+ *
+ * Then receiving again, with a character's idle line between frames and the
+ * main loop sleeping whenever it's drained the receive buffer.  Reports the
+ * share of time asleep and powered down, and the CPU cycles awake and idle
+ * per byte, for working out the energy per byte.
+ *
+ * usage: usi_serial_bench [skew, in basis points]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+
+#include "usi_serial.h"
+#include "8bit_tiny_timer0.h"
+
+#include "LineSimulator.h"
+
+#define BURST_LEN 1024
+
+// frames intact_count() will skip over to resynchronize with the burst
+#define RESYNC_WINDOW 8
+
+static USISerialPort port;
+static USISerialPort soft_port;
+static uint8_t soft_line;
+
+static uint8_t burst[BURST_LEN];
+
+static uint8_t received[BURST_LEN * 2];
+static uint16_t received_count;
+static uint8_t remote_received[BURST_LEN * 2];
+static uint16_t tx_count;
+
+static void drain_rx(void) {
+    uint8_t buf[USI_SERIAL_RX_BUFFER_SIZE];
+    uint8_t count = usi_rx_read_block(&port, buf, sizeof(buf));
+
+    for (uint8_t i = 0; (i < count) && (received_count < sizeof(received)); i++) {
+        received[received_count++] = buf[i];
+    }
+}
+
+/*
+ * Compares what was received, by either end, with the burst.
+ *
+ * @return the number of bytes of the burst received intact, in order
+ */
+static uint16_t intact_count(const uint8_t *buf, const uint16_t count) {
+    uint16_t expected = 0;
+    uint16_t intact = 0;
+
+    for (uint16_t i = 0; (i < count) && (expected < BURST_LEN); i++) {
+        for (uint8_t skip = 0; (skip < RESYNC_WINDOW) && ((expected + skip) < BURST_LEN); skip++) {
+            if (buf[i] == burst[expected + skip]) {
+                expected += skip + 1;
+                intact += 1;
+                break;
+            }
+        }
+    }
+
+    return intact;
+}
+
+static void drain_rx_and_sleep(void) {
+    drain_rx();
+    usi_serial_sleep(&port);
+}
+
+static void fill_tx(void) {
+    while ((tx_count < BURST_LEN) && usi_tx_enqueue(&port, burst[tx_count])) {
+        tx_count += 1;
+    }
+}
+
+static void drain_rx_and_fill_tx(void) {
+    drain_rx();
+    fill_tx();
+}
+
+static void bridge(void) {
+    while (usi_rx_available(&port) && usi_tx_space_available(&soft_port)) {
+        usi_tx_enqueue(&soft_port, usi_rx_read(&port));
+    }
+}
+
+static void init_at(const BaudRate baud_rate, const int16_t skew) {
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.skew = skew;
+
+    lsim_init(&cfg);
+
+    timer0_init(&lsim_timer0_regs, USI_SERIAL_TIMER0_PRESCALE(baud_rate));
+    usi_serial_init(&port, &lsim_usi_regs, NULL, baud_rate, &cfg.format);
+}
+
+// percentage of simulated time spent in ISRs
+static double isr_share(void) {
+    const LineSimStats *stats = lsim_stats();
+
+    return (100.0 * stats->isr_cycles) / stats->cycles;
+}
+
+static void bench(const BaudRate baud_rate, const int16_t skew) {
+    const uint32_t max_cycles = BURST_LEN * 20UL * (F_CPU / baud_rate);
+
+    // 8N1 frames; the most the line can carry
+    const double line_rate = baud_rate / 10.0;
+
+    const LineSimStats *stats = lsim_stats();
+    const LineSimLineStats *line_stats = lsim_line_stats(LSIM_USI_LINE);
+
+    // ----- receive
+    init_at(baud_rate, skew);
+
+    received_count = 0;
+
+    lsim_set_main_loop(&drain_rx);
+    lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+    lsim_run_until_idle(max_cycles);
+    drain_rx();
+
+    uint16_t rx_intact = intact_count(received, received_count);
+    double rx_rate = (rx_intact * (double) F_CPU) / stats->cycles;
+    double rx_isr_share = isr_share();
+
+    // ----- transmit
+    init_at(baud_rate, skew);
+
+    tx_count = 0;
+
+    usi_tx_set_streaming(&port, true);
+    lsim_set_main_loop(&fill_tx);
+
+    // the driver's idle between calls to the main loop, so run until the
+    // remote end's seen every frame
+    while (((line_stats->frames_received + line_stats->framing_errors) < BURST_LEN) &&
+           (stats->cycles < max_cycles))
+    {
+        lsim_run(F_CPU / baud_rate);
+    }
+
+    uint16_t tx_intact = intact_count(
+        remote_received,
+        lsim_remote_read(LSIM_USI_LINE, remote_received, sizeof(remote_received))
+    );
+    double tx_rate = (tx_intact * (double) F_CPU) / stats->cycles;
+
+    printf("%7lu  %8.1f  %8.1f %5u %6.1f%%  %8.1f %5u %6.1f%%\n",
+           (unsigned long) baud_rate, line_rate,
+           rx_rate, BURST_LEN - rx_intact, rx_isr_share,
+           tx_rate, BURST_LEN - tx_intact, isr_share());
+}
+
+static void bench_full_duplex(const BaudRate baud_rate, const int16_t skew) {
+    const uint32_t max_cycles = BURST_LEN * 20UL * (F_CPU / baud_rate);
+
+    const LineSimStats *stats = lsim_stats();
+    const LineSimLineStats *line_stats = lsim_line_stats(LSIM_USI_LINE);
+
+    init_at(baud_rate, skew);
+
+    if (! usi_serial_enable_full_duplex(&port, &lsim_timer1_regs)) {
+        printf("%7lu  refused; too fast to receive on timer1\n", (unsigned long) baud_rate);
+        return;
+    }
+
+    received_count = 0;
+    tx_count = 0;
+
+    usi_tx_set_streaming(&port, true);
+    lsim_set_main_loop(&drain_rx_and_fill_tx);
+    lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+
+    while (((line_stats->frames_received + line_stats->framing_errors + line_stats->parity_errors) < BURST_LEN) &&
+           (stats->cycles < max_cycles))
+    {
+        lsim_run(F_CPU / baud_rate);
+    }
+
+    lsim_run_until_idle(max_cycles);
+    drain_rx();
+
+    uint16_t rx_intact = intact_count(received, received_count);
+    uint16_t tx_intact = intact_count(
+        remote_received,
+        lsim_remote_read(LSIM_USI_LINE, remote_received, sizeof(remote_received))
+    );
+
+    printf("%7lu  %8.1f %5u  %8.1f %5u %6.1f%%  %6.2f\n",
+           (unsigned long) baud_rate,
+           (rx_intact * (double) F_CPU) / stats->cycles, BURST_LEN - rx_intact,
+           (tx_intact * (double) F_CPU) / stats->cycles, BURST_LEN - tx_intact,
+           isr_share(), line_stats->max_sample_offset);
+}
+
+static void bench_bridge(const BaudRate baud_rate, const int16_t skew) {
+    const uint32_t max_cycles = BURST_LEN * 20UL * (F_CPU / baud_rate);
+
+    LineSimConfig cfg;
+
+    const LineSimStats *stats = lsim_stats();
+
+    init_at(baud_rate, skew);
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.skew = skew;
+    cfg.rx_pin = PB3;
+    cfg.tx_pin = PB4;
+    soft_line = lsim_add_line(&cfg);
+
+    if (! usi_serial_init_bit_banged(&soft_port, &lsim_usi_regs, &lsim_timer1_regs,
+                                    PB3, PB4, NULL, baud_rate, &cfg.format))
+    {
+        printf("%7lu  refused; too fast to bit-bang\n", (unsigned long) baud_rate);
+        return;
+    }
+
+    usi_tx_set_streaming(&soft_port, true);
+
+    lsim_set_main_loop(&bridge);
+    lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+    lsim_run_until_idle(max_cycles);
+
+    uint16_t intact = intact_count(
+        remote_received,
+        lsim_remote_read(soft_line, remote_received, sizeof(remote_received))
+    );
+
+    printf("%7lu  %8.1f %5u %6.1f%%  %6.2f\n",
+           (unsigned long) baud_rate,
+           (intact * (double) F_CPU) / stats->cycles, BURST_LEN - intact,
+           isr_share(), lsim_line_stats(LSIM_USI_LINE)->max_sample_offset);
+}
+
+static void bench_sleep(const BaudRate baud_rate, const int16_t skew) {
+    const uint32_t max_cycles = BURST_LEN * 40UL * (F_CPU / baud_rate);
+
+    LineSimConfig cfg;
+
+    const LineSimStats *stats = lsim_stats();
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.skew = skew;
+    cfg.gap_bits = 10;
+
+    lsim_init(&cfg);
+
+    timer0_init(&lsim_timer0_regs, USI_SERIAL_TIMER0_PRESCALE(baud_rate));
+    usi_serial_init(&port, &lsim_usi_regs, NULL, baud_rate, &cfg.format);
+
+    received_count = 0;
+
+    lsim_set_main_loop(&drain_rx_and_sleep);
+    lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+    lsim_run_until_idle(max_cycles);
+    drain_rx();
+
+    uint16_t intact = intact_count(received, received_count);
+    uint32_t idle_cycles = stats->sleep_cycles - stats->power_down_cycles;
+
+    printf("%7lu  %8.1f %5u %6.1f%% %6.1f%% %6.1f%%  %8.1f %8.1f\n",
+           (unsigned long) baud_rate,
+           (intact * (double) F_CPU) / stats->cycles, BURST_LEN - intact,
+           isr_share(),
+           (100.0 * stats->sleep_cycles) / stats->cycles,
+           (100.0 * stats->power_down_cycles) / stats->cycles,
+           (double) (stats->cycles - stats->sleep_cycles) / BURST_LEN,
+           (double) idle_cycles / BURST_LEN);
+}
+
+int main(int argc, char **argv) {
+    int16_t skew = 0;
+
+    if (argc > 1) {
+        skew = atoi(argv[1]);
+    }
+
+    for (uint16_t i = 0; i < BURST_LEN; i++) {
+        burst[i] = (i * 7) + (i >> 8);
+    }
+
+    printf("F_CPU %lu, %u byte bursts, remote skew %d bp\n\n",
+           (unsigned long) F_CPU, BURST_LEN, skew);
+    printf("   baud  line B/s    RX B/s  drop    ISR    TX B/s  drop    ISR\n");
+
+    #define BENCH_BAUD(baud) bench(BAUD_##baud, skew);
+
+    USI_SERIAL_BAUD_RATES(BENCH_BAUD)
+
+    #undef BENCH_BAUD
+
+    printf("\nfull duplex\n\n");
+    printf("   baud    RX B/s  drop    TX B/s  drop    ISR  offset\n");
+
+    #define BENCH_BAUD(baud) bench_full_duplex(BAUD_##baud, skew);
+
+    USI_SERIAL_BAUD_RATES(BENCH_BAUD)
+
+    #undef BENCH_BAUD
+
+    printf("\nbridge, USI to bit-banged\n\n");
+    printf("   baud       B/s  drop    ISR  offset\n");
+
+    #define BENCH_BAUD(baud) bench_bridge(BAUD_##baud, skew);
+
+    USI_SERIAL_BAUD_RATES(BENCH_BAUD)
+
+    #undef BENCH_BAUD
+
+    printf("\nreceive, sleeping between frames\n\n");
+    printf("   baud    RX B/s  drop    ISR  asleep   down  awake/B   idle/B\n");
+
+    #define BENCH_BAUD(baud) bench_sleep(BAUD_##baud, skew);
+
+    USI_SERIAL_BAUD_RATES(BENCH_BAUD)
+
+    #undef BENCH_BAUD
+
+    return 0;
+}
@@ -1,15 +1,18 @@
 #include "ByteReceiverSpy.h"
 
 static uint8_t received_byte;
+static uint8_t received_status;
 static uint8_t invocation_count;
 
 void brs_init() {
     received_byte = 0;
+    received_status = 0;
     invocation_count = 0;
 }
 
-void brs_receive_byte(uint8_t b) {
+void brs_receive_byte(uint8_t b, uint8_t status) {
     received_byte = b;
+    received_status = status;
     invocation_count += 1;
 }
 
@@ -17,6 +20,10 @@ uint8_t brs_get_received_byte() {
     return received_byte;
 }
 
+uint8_t brs_get_received_status() {
+    return received_status;
+}
+
 uint8_t brs_get_invocation_count() {
     return invocation_count;
 }
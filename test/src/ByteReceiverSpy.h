@@ -5,8 +5,9 @@
 
 void brs_init(void);
 
-void brs_receive_byte(uint8_t b);
+void brs_receive_byte(uint8_t b, uint8_t status);
 uint8_t brs_get_received_byte(void);
+uint8_t brs_get_received_status(void);
 uint8_t brs_get_invocation_count(void);
 
 #endif
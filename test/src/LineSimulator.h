@@ -0,0 +1,214 @@
+/*
+ * Bit-level simulation of the USI serial driver's hardware, on top of
+ * MockAVR's virtual registers.
+ *
+ * Steps one CPU cycle at a time, modelling:
+ *  - timer0 in CTC mode, with its prescaler and OCR0A compare match
+ *  - timer1 in CTC mode, cleared by OCR1C, with its OCR1A compare match
+ *  - the USI in 3-wire mode, clocked by the timer0 compare match or strobed
+ *    with USICLK by an ISR
+ *  - lines to remote ends, each with a transmitter driving one of the
+ *    driver's pins and a receiver decoding another, running at a (possibly
+ *    skewed) baud rate.  The first is wired to the USI's PB0 and PB1;
+ *    others can be added for bit-banged ports.
+ *  - the PCINT0, TIMER1_COMPA, TIMER0_COMPA and USI_OVF interrupts,
+ *    dispatched one at a time in priority order, each keeping the CPU busy
+ *    for a configurable number of cycles.  Any pending interrupt can preempt
+ *    an ISR that's finished receiving a frame and re-armed the receiver, as
+ *    the driver re-enables interrupts there.  A handler called with
+ *    interrupts enabled can keep the CPU busy, and be interrupted, with
+ *    lsim_busy().
+ *  - sleep_cpu(), for the driver's sleep instruction: the main loop isn't
+ *    called again until an interrupt's woken the CPU, and the timers stop
+ *    while powered down.  Called by the test itself, from one of the
+ *    driver's blocking calls, it runs the simulation until the interrupt's
+ *    ISR has finished.
+ *
+ * The driver and libtimer must be initialized with lsim_usi_regs and
+ * lsim_timer0_regs after lsim_init(), and full duplex enabled, or a port
+ * clocked by timer1 initialized, with lsim_timer1_regs.
+ * lsim_init_usi_port() does the usual timer0-clocked case in one go.
+ */
+
+#ifndef LINE_SIMULATOR_H
+#define LINE_SIMULATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usi_serial.h"
+#include "8bit_tiny_timer0.h"
+
+// largest number of bytes queued to, or received by, each remote end
+#define LSIM_BUFFER_SIZE 4096
+
+#define LSIM_MAX_LINES 2
+
+// the line set up by lsim_init()
+#define LSIM_USI_LINE 0
+
+typedef struct __line_sim_config {
+    uint32_t baud;                // remote end's nominal baud rate
+    int16_t  skew;                // remote end's baud rate error, in basis points
+    USISerialFrameFormat format;  // remote end's frame format
+    uint8_t  gap_bits;            // idle bit-times between remote frames
+
+    // the driver's pins the remote end's wired to
+    uint8_t  rx_pin;
+    uint8_t  tx_pin;
+
+    // flow control the remote end honours: pausing before a frame while the
+    // driver's RTS pin is high, or after XOFF.  It drives the driver's CTS
+    // pin; see lsim_remote_set_rts().
+    USISerialFlowControl flow_control;
+    uint8_t  rts_pin;
+    uint8_t  cts_pin;
+
+    // cycles from an ISR being dispatched to it accessing any registers, and
+    // from the PCINT0 ISR being dispatched to it starting timer0
+    uint16_t isr_latency;
+    uint16_t pcint_latency;
+
+    // cycles each ISR keeps the CPU busy for, including the latency
+    uint16_t pcint_cycles;
+    uint16_t timer1_compa_cycles;
+    uint16_t timer0_compa_cycles;
+    uint16_t usi_ovf_cycles;
+
+    uint16_t main_loop_interval;  // cycles between calls to the main loop
+} LineSimConfig;
+
+typedef struct __line_sim_stats {
+    uint32_t cycles;              // cycles simulated
+    uint32_t isr_cycles;          // cycles spent in ISRs
+    uint32_t sleep_cycles;        // cycles spent asleep, idle or powered down
+    uint32_t power_down_cycles;   // of which powered down
+
+    uint32_t pcint_count;
+    uint32_t timer1_compa_count;
+    uint32_t timer0_compa_count;
+    uint32_t usi_ovf_count;
+} LineSimStats;
+
+typedef struct __line_sim_line_stats {
+    uint16_t frames_sent;         // by the remote end
+    uint16_t frames_received;     // by the remote end
+    uint16_t framing_errors;      // received by the remote end without its stop bits
+    uint16_t parity_errors;       // received by the remote end with bad parity
+    uint16_t xoffs_received;      // by the remote end, and not stored
+    uint16_t xons_received;
+
+    // largest distance, in bits, between the RX pin being sampled, by a USI
+    // clock or the timer1 ISR, and the middle of the remote end's bit
+    double max_sample_offset;
+} LineSimLineStats;
+
+extern const USISerialRegisters lsim_usi_regs;
+extern const Timer0Registers lsim_timer0_regs;
+extern const USISerialTimer1Registers lsim_timer1_regs;
+
+/*
+ * Fill in a configuration for a remote end at the given rate, wired to the
+ * USI: no skew, 8N1, back-to-back frames, no flow control, and the model's
+ * own ISR timings.  Its PCINT latency is the driver's default
+ * USI_SERIAL_PCINT_STARTUP_CYCLES, but doesn't follow an override of it.
+ */
+void lsim_default_config(LineSimConfig *cfg, const uint32_t baud);
+
+/*
+ * Reset the virtual registers and the statistics, and set up LSIM_USI_LINE,
+ * with its remote end, from cfg.
+ */
+void lsim_init(const LineSimConfig *cfg);
+
+/*
+ * Set up a simulation with a USI-backed port on LSIM_USI_LINE, clocked by
+ * timer0, as most tests start: lsim_init() from cfg, then timer0_init() and
+ * usi_serial_init() for the port.  The remote end needn't match the port's
+ * rate or format.
+ *
+ * @param cfg the remote end's configuration, or NULL for the default at
+ *        baud_rate in format
+ */
+void lsim_init_usi_port(USISerialPort *port,
+                        const LineSimConfig *cfg,
+                        void (*received_byte_handler)(uint8_t b, uint8_t status),
+                        const BaudRate baud_rate,
+                        const USISerialFrameFormat *format);
+
+/*
+ * Add a line to another remote end.  Only cfg's remote end settings and pins
+ * are used; the rest come from lsim_init().
+ *
+ * @return the new line, or LSIM_MAX_LINES if there's no room
+ */
+uint8_t lsim_add_line(const LineSimConfig *cfg);
+
+/*
+ * Function called periodically while no ISR is running, standing in for the
+ * application's main loop.  NULL for none.
+ */
+void lsim_set_main_loop(void (*main_loop)(void));
+
+/*
+ * Queue bytes for a line's remote end to transmit to the driver.
+ */
+void lsim_remote_send(const uint8_t line, const uint8_t *buf, const uint16_t len);
+
+/*
+ * Drive the driver's CTS pin from the line's remote end, active low: ready
+ * to receive, or not.  Ready by default.
+ */
+void lsim_remote_set_rts(const uint8_t line, const bool ready);
+
+/*
+ * @return number of bytes the line's remote end has yet to finish sending
+ */
+uint16_t lsim_remote_send_pending(const uint8_t line);
+
+/*
+ * Copy out the bytes a line's remote end has decoded from the driver.
+ *
+ * @return the number of bytes copied
+ */
+uint16_t lsim_remote_read(const uint8_t line, uint8_t *buf, const uint16_t max);
+
+/*
+ * Simulate the given number of CPU cycles.
+ */
+void lsim_run(const uint32_t cycles);
+
+/*
+ * Keep the CPU busy for the given number of cycles, from a handler the
+ * driver calls with interrupts enabled.  Any ISR that comes due runs in the
+ * meantime, nested in the handler's, which carries on once it's finished.
+ */
+void lsim_busy(const uint32_t cycles);
+
+/*
+ * Simulate until no remote end has anything more to send, every line is
+ * idle in both directions, the USI and timer1 are stopped, timer0 has no
+ * compare interrupt to come and the main loop, if any, has run since the last
+ * ISR.
+ *
+ * @return false if max_cycles elapsed first
+ */
+bool lsim_run_until_idle(const uint32_t max_cycles);
+
+/*
+ * @return a limit for lsim_run_until_idle(): the cycles taken by the given
+ *         number of frames, each frame_bits bit periods long, idle bits and
+ *         all, plus four more for the ISRs and the line to settle
+ */
+uint32_t lsim_frames_cycles(const uint32_t baud, const uint16_t frames, const uint8_t frame_bits);
+
+const LineSimStats *lsim_stats(void);
+
+const LineSimLineStats *lsim_line_stats(const uint8_t line);
+
+/*
+ * Zero a line's statistics, to measure from here on.
+ */
+void lsim_clear_line_stats(const uint8_t line);
+
+#endif
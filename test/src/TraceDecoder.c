@@ -0,0 +1,61 @@
+#include "TraceDecoder.h"
+
+static const char *rx_state_names[] = {
+    "IDLE",
+    "RECEIVING",
+    "WAITING_FOR_PARITY_BIT",
+    "WAITING_FOR_STOP_BIT",
+    "DETECTING_BAUD",
+};
+
+static const char *tx_state_names[] = {
+    "IDLE",
+    "READY_FOR_FIRST_HALF_FRAME",
+    "READY_FOR_SECOND_HALF_FRAME",
+    "COMPLETE",
+    "SENDING_BITS",
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static const char *state_name(const char **names, const size_t count, const uint8_t state) {
+    return (state < count) ? names[state] : "?";
+}
+
+void trace_format(char *buf, const size_t len, const USITraceEntry *entry) {
+    switch (entry->event) {
+        case USI_TRACE_PCINT0:
+            snprintf(buf, len, "TCNT0 %3u  PCINT0   PB0 %s",
+                     entry->tcnt0, (entry->value & 1) ? "high" : "low");
+            break;
+
+        case USI_TRACE_USI_OVF:
+            snprintf(buf, len, "TCNT0 %3u  USI_OVF  USIBR 0x%02x",
+                     entry->tcnt0, entry->value);
+            break;
+
+        case USI_TRACE_RX_STATE:
+            snprintf(buf, len, "TCNT0 %3u  RX       %s", entry->tcnt0,
+                     state_name(rx_state_names, COUNT(rx_state_names), entry->value));
+            break;
+
+        case USI_TRACE_TX_STATE:
+            snprintf(buf, len, "TCNT0 %3u  TX       %s", entry->tcnt0,
+                     state_name(tx_state_names, COUNT(tx_state_names), entry->value));
+            break;
+
+        default:
+            snprintf(buf, len, "TCNT0 %3u  ?%-7u  0x%02x",
+                     entry->tcnt0, entry->event, entry->value);
+            break;
+    }
+}
+
+void trace_print(FILE *out, const USITraceEntry *entries, const uint8_t count) {
+    char line[64];
+
+    for (uint8_t i = 0; i < count; i++) {
+        trace_format(line, sizeof(line), &entries[i]);
+        fprintf(out, "%3u  %s\n", i, line);
+    }
+}
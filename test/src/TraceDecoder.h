@@ -0,0 +1,25 @@
+/*
+ * Host-side decoder for the USI serial driver's trace; see
+ * usi_serial_trace.h.
+ */
+
+#ifndef TRACE_DECODER_H
+#define TRACE_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "usi_serial_trace.h"
+
+/*
+ * Describe one event, e.g. "TCNT0  12  RX       RECEIVING".
+ */
+void trace_format(char *buf, const size_t len, const USITraceEntry *entry);
+
+/*
+ * Print a timeline of events, oldest first, one per line.
+ */
+void trace_print(FILE *out, const USITraceEntry *entries, const uint8_t count);
+
+#endif
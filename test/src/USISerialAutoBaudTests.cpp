@@ -0,0 +1,213 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * Auto-baud detection on the line simulator.  The port's initialized at
+ * 19200, and the peer runs at each of the rates that share its prescaler.
+ */
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+static const USISerialFrameFormat format8E1 = USI_SERIAL_FRAME_FORMAT(8, EVEN, 1);
+static const USISerialFrameFormat format7O1 = USI_SERIAL_FRAME_FORMAT(7, ODD, 1);
+
+static const BaudRate peer_rates[] = { BAUD_9600, BAUD_19200, BAUD_38400 };
+static const int16_t skews[] = { -300, 0, 300 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static USISerialPort port;
+
+static uint8_t received[64];
+static uint8_t received_count;
+
+static void drain_rx(void) {
+    received_count += usi_rx_read_block(
+        &port,
+        received + received_count,
+        sizeof(received) - received_count
+    );
+}
+
+// the port at 19200, and the line at the peer's rate
+static void init_sim(const BaudRate peer_rate,
+                     const int16_t skew,
+                     const USISerialFrameFormat *format)
+{
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, peer_rate);
+    cfg.skew = skew;
+    cfg.format = *format;
+
+    lsim_init_usi_port(&port, &cfg, NULL, BAUD_19200, format);
+    lsim_set_main_loop(&drain_rx);
+
+    usi_serial_start_auto_baud(&port);
+}
+
+static void send_sync_and_message(void) {
+    const uint8_t sync = USI_SERIAL_AUTO_BAUD_SYNC;
+
+    lsim_remote_send(LSIM_USI_LINE, &sync, 1);
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+}
+
+static void check_detected(const BaudRate peer_rate,
+                           const int16_t skew,
+                           const USISerialFrameFormat *format)
+{
+    init_sim(peer_rate, skew, format);
+    received_count = 0;
+
+    LONGS_EQUAL(0, usi_serial_baud_rate(&port));
+
+    send_sync_and_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(peer_rate, strlen(message), 12)));
+
+    LONGS_EQUAL(peer_rate, usi_serial_baud_rate(&port));
+
+    // the sync character's not delivered
+    LONGS_EQUAL(strlen(message), received_count);
+    CHECK(memcmp(message, received, strlen(message)) == 0);
+
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+    LONGS_EQUAL(0, usi_rx_parity_error_count(&port));
+
+    // and the reply's at the peer's rate
+    for (uint8_t i = 0; i < 10; i++) {
+        CHECK(usi_tx_enqueue(&port, message[i]));
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(peer_rate, strlen(message), 12)));
+
+    LONGS_EQUAL(10, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    CHECK(memcmp(message, received, 10) == 0);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+}
+
+TEST_GROUP(USISerialAutoBaudTests) {
+    void setup() {
+        received_count = 0;
+    }
+};
+
+TEST(USISerialAutoBaudTests, BaudRateIsInitRateWithoutDetection) {
+    init_sim(BAUD_19200, 0, &format8N1);
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_38400, &format8N1);
+
+    LONGS_EQUAL(BAUD_38400, usi_serial_baud_rate(&port));
+}
+
+TEST(USISerialAutoBaudTests, DetectsEachRate) {
+    for (uint8_t i = 0; i < COUNT(peer_rates); i++) {
+        for (uint8_t j = 0; j < COUNT(skews); j++) {
+            check_detected(peer_rates[i], skews[j], &format8N1);
+        }
+    }
+}
+
+#ifndef USI_SERIAL_FIXED_FORMAT
+TEST(USISerialAutoBaudTests, DetectsWithParity) {
+    // the fifth falling edge is the parity bit's with 7E1, and there isn't
+    // one with 7O1
+    for (uint8_t i = 0; i < COUNT(peer_rates); i++) {
+        for (uint8_t j = 0; j < COUNT(skews); j++) {
+            check_detected(peer_rates[i], skews[j], &format8E1);
+            check_detected(peer_rates[i], skews[j], &format7O1);
+        }
+    }
+}
+#endif
+
+TEST(USISerialAutoBaudTests, DetectsInFullDuplex) {
+    for (uint8_t j = 0; j < COUNT(skews); j++) {
+        init_sim(BAUD_19200, skews[j], &format8N1);
+        CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+        usi_serial_start_auto_baud(&port);
+        received_count = 0;
+
+        send_sync_and_message();
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 12)));
+
+        LONGS_EQUAL(BAUD_19200, usi_serial_baud_rate(&port));
+        LONGS_EQUAL(strlen(message), received_count);
+        CHECK(memcmp(message, received, strlen(message)) == 0);
+    }
+}
+
+TEST(USISerialAutoBaudTests, FullDuplexSkipsFasterRates) {
+    init_sim(BAUD_38400, 0, &format8N1);
+    CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+    usi_serial_start_auto_baud(&port);
+
+    send_sync_and_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_38400, strlen(message), 12)));
+
+    // too fast to receive on timer1, so still detecting
+    LONGS_EQUAL(0, usi_serial_baud_rate(&port));
+    LONGS_EQUAL(0, received_count);
+}
+
+TEST(USISerialAutoBaudTests, SkipsFramesBeforeSync) {
+    // a long low, then a frame whose falling edges are 5 bits apart, the
+    // second of them the sync character's start bit
+    const uint8_t noise[] = { 0x00, 0x0f };
+
+    for (uint8_t i = 0; i < COUNT(peer_rates); i++) {
+        for (uint8_t j = 0; j < COUNT(skews); j++) {
+            init_sim(peer_rates[i], skews[j], &format8N1);
+            received_count = 0;
+
+            lsim_remote_send(LSIM_USI_LINE, noise, sizeof(noise));
+            send_sync_and_message();
+            CHECK(lsim_run_until_idle(lsim_frames_cycles(peer_rates[i], strlen(message), 12)));
+
+            LONGS_EQUAL(peer_rates[i], usi_serial_baud_rate(&port));
+            LONGS_EQUAL(strlen(message), received_count);
+            CHECK(memcmp(message, received, strlen(message)) == 0);
+        }
+    }
+}
+
+TEST(USISerialAutoBaudTests, TransmitsOnceDetected) {
+    init_sim(BAUD_9600, 0, &format8N1);
+
+    CHECK(usi_tx_enqueue(&port, 'x'));
+
+    // nothing goes out at the wrong rate
+    lsim_run(20 * (F_CPU / BAUD_9600));
+    LONGS_EQUAL(USITX_STATE_IDLE, port.txState);
+
+    send_sync_and_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 12)));
+
+    LONGS_EQUAL(1, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    BYTES_EQUAL('x', received[0]);
+}
+
+TEST(USISerialAutoBaudTests, OtherPrescalersNotDetected) {
+    const BaudRate rates[] = { BAUD_2400, BAUD_4800 };
+
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i], 0, &format8N1);
+
+        send_sync_and_message();
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], strlen(message), 12)));
+
+        LONGS_EQUAL(0, usi_serial_baud_rate(&port));
+        LONGS_EQUAL(USIRX_STATE_DETECTING_BAUD, port.rxState);
+    }
+}
@@ -0,0 +1,278 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "usi_serial_cobs.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * COBS packet framing: the encoder and decoder on their own, and then
+ * packets over the line simulator, decoded in the received byte handler.
+ */
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+static USISerialCOBSDecoder dec;
+static uint8_t packet_buf[64];
+static uint8_t big_buf[255];
+
+static uint8_t packet[256];
+static uint8_t packet_len;
+static uint8_t packet_status;
+static uint8_t packet_count;
+
+static void packet_handler(uint8_t *p, uint8_t len, uint8_t status) {
+    memcpy(packet, p, len);
+    packet_len = len;
+    packet_status = status;
+    packet_count += 1;
+}
+
+static uint16_t encode(const uint8_t *src, const uint8_t len, uint8_t *dst) {
+    USISerialCOBSEncoder enc;
+    uint16_t n = 0;
+
+    usi_cobs_encoder_init(&enc, src, len);
+
+    while (! usi_cobs_encoder_done(&enc)) {
+        dst[n++] = usi_cobs_encode(&enc);
+    }
+
+    return n;
+}
+
+static void decode(const uint8_t *src, const uint16_t len) {
+    for (uint16_t i = 0; i < len; i++) {
+        usi_cobs_decode(&dec, src[i], 0);
+    }
+}
+
+static void check_encoding(const uint8_t *src, const uint8_t len,
+                           const uint8_t *expected, const uint16_t expected_len)
+{
+    uint8_t encoded[USI_COBS_MAX_ENCODED_LEN(255)];
+
+    LONGS_EQUAL(expected_len, encode(src, len, encoded));
+    CHECK(memcmp(expected, encoded, expected_len) == 0);
+    CHECK(expected_len <= USI_COBS_MAX_ENCODED_LEN(len));
+}
+
+TEST_GROUP(USISerialCOBSTests) {
+    void setup() {
+        packet_len = 0;
+        packet_status = 0;
+        packet_count = 0;
+
+        usi_cobs_decoder_init(&dec, packet_buf, sizeof(packet_buf), &packet_handler);
+    }
+};
+
+TEST(USISerialCOBSTests, EncodesShortPackets) {
+    const uint8_t p1[] = { 0x00 };
+    const uint8_t e1[] = { 0x01, 0x01, 0x00 };
+    const uint8_t p2[] = { 0x00, 0x00 };
+    const uint8_t e2[] = { 0x01, 0x01, 0x01, 0x00 };
+    const uint8_t p3[] = { 0x11, 0x22, 0x00, 0x33 };
+    const uint8_t e3[] = { 0x03, 0x11, 0x22, 0x02, 0x33, 0x00 };
+    const uint8_t p4[] = { 0x11, 0x22, 0x33, 0x44 };
+    const uint8_t e4[] = { 0x05, 0x11, 0x22, 0x33, 0x44, 0x00 };
+    const uint8_t p5[] = { 0x11, 0x00, 0x00, 0x00 };
+    const uint8_t e5[] = { 0x02, 0x11, 0x01, 0x01, 0x01, 0x00 };
+    const uint8_t e6[] = { 0x01, 0x00 };
+
+    check_encoding(p1, sizeof(p1), e1, sizeof(e1));
+    check_encoding(p2, sizeof(p2), e2, sizeof(e2));
+    check_encoding(p3, sizeof(p3), e3, sizeof(e3));
+    check_encoding(p4, sizeof(p4), e4, sizeof(e4));
+    check_encoding(p5, sizeof(p5), e5, sizeof(e5));
+    check_encoding(p1, 0, e6, sizeof(e6));
+}
+
+TEST(USISerialCOBSTests, EncodesLongBlocks) {
+    uint8_t src[255];
+    uint8_t expected[USI_COBS_MAX_ENCODED_LEN(255)];
+
+    // 254 non-zero bytes fill a block, which doesn't stand for a zero
+    for (uint16_t i = 0; i < 255; i++) {
+        src[i] = i + 1;
+    }
+
+    expected[0] = 0xff;
+    memcpy(expected + 1, src, 254);
+    expected[255] = 0x00;
+    check_encoding(src, 254, expected, 256);
+
+    // and one more starts another
+    expected[255] = 0x02;
+    expected[256] = 0xff;
+    expected[257] = 0x00;
+    check_encoding(src, 255, expected, 258);
+
+    // or a zero
+    src[254] = 0x00;
+    expected[255] = 0x01;
+    expected[256] = 0x01;
+    expected[257] = 0x00;
+    check_encoding(src, 255, expected, 258);
+}
+
+TEST(USISerialCOBSTests, RoundTrips) {
+    uint8_t src[255];
+    uint8_t encoded[USI_COBS_MAX_ENCODED_LEN(255)];
+
+    usi_cobs_decoder_set_buffer(&dec, big_buf, sizeof(big_buf));
+
+    for (uint16_t len = 0; len <= 255; len++) {
+        for (uint8_t zeroes = 0; zeroes < 4; zeroes++) {
+            for (uint16_t i = 0; i < len; i++) {
+                src[i] = ((i * 37) + len) % (zeroes ? (64 >> zeroes) : 255) + (zeroes ? 0 : 1);
+            }
+
+            uint16_t n = encode(src, len, encoded);
+
+            for (uint16_t i = 0; i < (n - 1); i++) {
+                CHECK(encoded[i] != 0);
+            }
+
+            const uint8_t count = packet_count;
+
+            decode(encoded, n);
+
+            LONGS_EQUAL((uint8_t) (count + 1), packet_count);
+            LONGS_EQUAL(len, packet_len);
+            LONGS_EQUAL(0, packet_status);
+            CHECK(memcmp(src, packet, len) == 0);
+        }
+    }
+}
+
+TEST(USISerialCOBSTests, IgnoresDelimitersBetweenPackets) {
+    const uint8_t encoded[] = { 0x00, 0x00, 0x03, 0x11, 0x22, 0x00, 0x00 };
+
+    decode(encoded, sizeof(encoded));
+
+    LONGS_EQUAL(1, packet_count);
+    LONGS_EQUAL(2, packet_len);
+}
+
+TEST(USISerialCOBSTests, ReportsOverrun) {
+    uint8_t src[100];
+    uint8_t encoded[USI_COBS_MAX_ENCODED_LEN(100)];
+
+    memset(src, 0x55, sizeof(src));
+    decode(encoded, encode(src, sizeof(src), encoded));
+
+    LONGS_EQUAL(1, packet_count);
+    LONGS_EQUAL(sizeof(packet_buf), packet_len);
+    LONGS_EQUAL(USI_COBS_OVERRUN, packet_status);
+
+    // and the next is unaffected
+    decode(encoded, encode(src, 10, encoded));
+
+    LONGS_EQUAL(10, packet_len);
+    LONGS_EQUAL(0, packet_status);
+}
+
+TEST(USISerialCOBSTests, ReportsTruncatedBlock) {
+    // the delimiter comes with 2 bytes of the block still to come, as if
+    // they'd been lost
+    const uint8_t encoded[] = { 0x05, 0x11, 0x22, 0x00 };
+
+    decode(encoded, sizeof(encoded));
+
+    LONGS_EQUAL(1, packet_count);
+    LONGS_EQUAL(2, packet_len);
+    LONGS_EQUAL(USI_COBS_TRUNCATED, packet_status);
+}
+
+TEST(USISerialCOBSTests, PassesOnByteStatus) {
+    usi_cobs_decode(&dec, 0x03, 0);
+    usi_cobs_decode(&dec, 0x11, USI_SERIAL_RX_PARITY_ERROR);
+    usi_cobs_decode(&dec, 0x22, 0);
+    usi_cobs_decode(&dec, 0x00, 0);
+
+    LONGS_EQUAL(USI_SERIAL_RX_PARITY_ERROR, packet_status);
+
+    // cleared for the next
+    usi_cobs_decode(&dec, 0x01, 0);
+    usi_cobs_decode(&dec, 0x00, 0);
+
+    LONGS_EQUAL(2, packet_count);
+    LONGS_EQUAL(0, packet_status);
+}
+
+// ----- over the line simulator
+
+static USISerialPort port;
+
+static void decode_received(uint8_t b, uint8_t status) {
+    usi_cobs_decode(&dec, b, status);
+}
+
+static void init_sim(const BaudRate baud_rate) {
+    lsim_init_usi_port(&port, NULL, &decode_received, baud_rate, &format8N1);
+}
+
+TEST(USISerialCOBSTests, DecodesInByteHandler) {
+    const char *message = "The quick brown fox\0jumps over the lazy dog";
+    const uint8_t len = 43;
+    uint8_t encoded[USI_COBS_MAX_ENCODED_LEN(43)];
+
+    init_sim(BAUD_38400);
+
+    const uint16_t n = encode((const uint8_t *) message, len, encoded);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        lsim_remote_send(LSIM_USI_LINE, encoded, n);
+    }
+
+    CHECK(lsim_run_until_idle(4 * n * 10UL * (F_CPU / BAUD_38400)));
+
+    LONGS_EQUAL(3, packet_count);
+    LONGS_EQUAL(len, packet_len);
+    LONGS_EQUAL(0, packet_status);
+    CHECK(memcmp(message, packet, len) == 0);
+}
+
+static USISerialCOBSEncoder send_enc;
+
+static void send_packet(void) {
+    usi_cobs_send(&port, &send_enc);
+}
+
+TEST(USISerialCOBSTests, SendsFromMainLoop) {
+    uint8_t src[100];
+    uint8_t received[USI_COBS_MAX_ENCODED_LEN(100)];
+
+    for (uint8_t i = 0; i < sizeof(src); i++) {
+        src[i] = i % 10;
+    }
+
+    init_sim(BAUD_19200);
+
+    // more than the transmit queue holds
+    usi_cobs_encoder_init(&send_enc, src, sizeof(src));
+    lsim_set_main_loop(&send_packet);
+
+    CHECK(lsim_run_until_idle(USI_COBS_MAX_ENCODED_LEN(100) * 12UL * (F_CPU / BAUD_19200)));
+    CHECK(usi_cobs_encoder_done(&send_enc));
+
+    const uint16_t n = lsim_remote_read(LSIM_USI_LINE, received, sizeof(received));
+
+    LONGS_EQUAL(0, received[n - 1]);
+
+    usi_cobs_decoder_set_buffer(&dec, big_buf, sizeof(big_buf));
+    decode(received, n);
+
+    LONGS_EQUAL(1, packet_count);
+    LONGS_EQUAL(sizeof(src), packet_len);
+    CHECK(memcmp(src, packet, sizeof(src)) == 0);
+}
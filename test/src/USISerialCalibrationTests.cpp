@@ -0,0 +1,156 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * Start-bit delay calibration on the line simulator, whose PCINT latency
+ * stands in for a build where timer0's started sooner or later than
+ * USI_SERIAL_PCINT_STARTUP_CYCLES assumes.
+ */
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+// at 38400 the PCINT0 ISR's still starting the frame at the first data bit
+static const BaudRate rates[] = { BAUD_4800, BAUD_9600, BAUD_19200 };
+static const uint16_t latencies[] = { 160, 288 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static USISerialPort port;
+
+static uint8_t received[64];
+static uint8_t received_count;
+
+static void drain_rx(void) {
+    received_count += usi_rx_read_block(
+        &port,
+        received + received_count,
+        sizeof(received) - received_count
+    );
+}
+
+static void init_sim(const BaudRate baud_rate, const uint16_t pcint_latency) {
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.pcint_cycles += pcint_latency - cfg.pcint_latency;
+    cfg.pcint_latency = pcint_latency;
+
+    lsim_init_usi_port(&port, &cfg, NULL, baud_rate, &cfg.format);
+    lsim_set_main_loop(&drain_rx);
+
+    received_count = 0;
+}
+
+static void send_message(const BaudRate baud_rate) {
+    received_count = 0;
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(baud_rate, strlen(message), 12)));
+
+    LONGS_EQUAL(strlen(message), received_count);
+    CHECK(memcmp(message, received, strlen(message)) == 0);
+}
+
+TEST_GROUP(USISerialCalibrationTests) {
+    void setup() {
+        received_count = 0;
+    }
+};
+
+TEST(USISerialCalibrationTests, StartupCyclesAreCompileTimeWithoutCalibration) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i], USI_SERIAL_PCINT_STARTUP_CYCLES);
+
+        CHECK(! usi_serial_calibrating(&port));
+
+        // to within a tick
+        DOUBLES_EQUAL(
+            USI_SERIAL_PCINT_STARTUP_CYCLES,
+            usi_serial_startup_cycles(&port),
+            USI_SERIAL_PRESCALE(rates[i])
+        );
+    }
+}
+
+TEST(USISerialCalibrationTests, CalibratesOnFramesStartingWithAOne) {
+    // "Th" are both even, so calibration ends a few frames into the message
+    init_sim(BAUD_9600, 40);
+    usi_serial_calibrate(&port);
+
+    CHECK(usi_serial_calibrating(&port));
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) "ThTh", 4);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 12)));
+
+    CHECK(usi_serial_calibrating(&port));
+    LONGS_EQUAL(4, received_count);
+
+    send_message(BAUD_9600);
+
+    CHECK(! usi_serial_calibrating(&port));
+}
+
+TEST(USISerialCalibrationTests, SamplePointCorrectedAtEachRate) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        const uint16_t prescale = USI_SERIAL_PRESCALE(rates[i]);
+        const double bit_cycles = (double) F_CPU / rates[i];
+
+        // the sample point's off by dithering and rounding to a tick, even
+        // with the latency the compile-time seeds assume
+        init_sim(rates[i], USI_SERIAL_PCINT_STARTUP_CYCLES);
+        send_message(rates[i]);
+
+        const double nominal_offset = lsim_line_stats(LSIM_USI_LINE)->max_sample_offset;
+
+        for (uint8_t j = 0; j < COUNT(latencies); j++) {
+            const uint16_t error = (latencies[j] > USI_SERIAL_PCINT_STARTUP_CYCLES) ?
+                (latencies[j] - USI_SERIAL_PCINT_STARTUP_CYCLES) :
+                (USI_SERIAL_PCINT_STARTUP_CYCLES - latencies[j]);
+
+            init_sim(rates[i], latencies[j]);
+
+            // off by the difference in latency, less a tick
+            send_message(rates[i]);
+            CHECK(lsim_line_stats(LSIM_USI_LINE)->max_sample_offset >
+                  ((error - prescale) / bit_cycles));
+
+            usi_serial_calibrate(&port);
+            send_message(rates[i]);
+            CHECK(! usi_serial_calibrating(&port));
+
+            DOUBLES_EQUAL(latencies[j], usi_serial_startup_cycles(&port), prescale);
+
+            // and then as if the compile-time latency had been right
+            lsim_clear_line_stats(LSIM_USI_LINE);
+            send_message(rates[i]);
+
+            CHECK(lsim_line_stats(LSIM_USI_LINE)->max_sample_offset <=
+                  (nominal_offset + (prescale / bit_cycles)));
+            CHECK(lsim_line_stats(LSIM_USI_LINE)->max_sample_offset < 0.1);
+        }
+    }
+}
+
+TEST(USISerialCalibrationTests, RecalibratingIsStable) {
+    init_sim(BAUD_19200, USI_SERIAL_PCINT_STARTUP_CYCLES);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        usi_serial_calibrate(&port);
+        send_message(BAUD_19200);
+
+        DOUBLES_EQUAL(USI_SERIAL_PCINT_STARTUP_CYCLES, usi_serial_startup_cycles(&port), 8);
+    }
+
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+}
@@ -0,0 +1,132 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * Back-to-back bursts, on the line simulator: the receiver's re-armed at the
+ * stop bit, before the frame's delivered, so none is lost at any rate
+ * that's available.
+ */
+
+static const BaudRate rates[] = {
+    BAUD_2400, BAUD_4800, BAUD_9600, BAUD_14400,
+    BAUD_19200, BAUD_28800, BAUD_38400,
+};
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+static const USISerialFrameFormat format8E2 = USI_SERIAL_FRAME_FORMAT(8, EVEN, 2);
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+#define BURST_LEN 1024
+
+static USISerialPort port;
+
+static uint8_t burst[BURST_LEN];
+static uint8_t received[BURST_LEN];
+static uint16_t received_count;
+static uint8_t received_status;
+
+static void receive_byte(uint8_t b, uint8_t status) {
+    if (received_count < sizeof(received)) {
+        received[received_count++] = b;
+    }
+
+    received_status |= status;
+}
+
+static void drain(void) {
+    const uint16_t room = sizeof(received) - received_count;
+
+    received_count += usi_rx_read_block(&port, received + received_count,
+                                        (room > 255) ? 255 : room);
+}
+
+static void init_sim(const BaudRate baud_rate, const USISerialFrameFormat *format,
+                     void (*handler)(uint8_t, uint8_t))
+{
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.format = *format;
+    lsim_init_usi_port(&port, &cfg, handler, baud_rate, format);
+    lsim_set_main_loop(handler ? NULL : &drain);
+
+    received_count = 0;
+    received_status = 0;
+}
+
+static void check_burst_received(void) {
+    LONGS_EQUAL(BURST_LEN, received_count);
+    CHECK(memcmp(burst, received, BURST_LEN) == 0);
+    LONGS_EQUAL(0, received_status);
+    LONGS_EQUAL(0, usi_rx_overrun_count(&port));
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+    LONGS_EQUAL(0, usi_rx_parity_error_count(&port));
+}
+
+TEST_GROUP(USISerialContinuousRXTests) {
+    void setup() {
+        for (uint16_t i = 0; i < BURST_LEN; i++) {
+            burst[i] = (uint8_t) ((i * 37) + (i >> 8));
+        }
+    }
+};
+
+TEST(USISerialContinuousRXTests, BurstToHandler) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i], &format8N1, &receive_byte);
+
+        lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], BURST_LEN, 10)));
+
+        check_burst_received();
+    }
+}
+
+TEST(USISerialContinuousRXTests, BurstToBuffer) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i], &format8N1, NULL);
+
+        lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], BURST_LEN, 10)));
+
+        check_burst_received();
+    }
+}
+
+#ifndef USI_SERIAL_FIXED_FORMAT
+TEST(USISerialContinuousRXTests, BurstWithParity) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i], &format8E2, &receive_byte);
+
+        lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], BURST_LEN, 12)));
+
+        check_burst_received();
+    }
+}
+#endif
+
+TEST(USISerialContinuousRXTests, BurstInFullDuplex) {
+    // full duplex is refused beyond 19200
+    for (uint8_t i = 0; (i < COUNT(rates)) && (rates[i] <= BAUD_19200); i++) {
+        init_sim(rates[i], &format8N1, &receive_byte);
+        CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+
+        lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], BURST_LEN, 10)));
+
+        check_burst_received();
+    }
+}
@@ -0,0 +1,226 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * RTS/CTS and XON/XOFF flow control, on the line simulator.  The remote end
+ * honours the same flow control as the port, and a slow main loop reads one
+ * byte every few frames.
+ */
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+static const BaudRate rates[] = { BAUD_9600, BAUD_19200, BAUD_38400 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// the driver's RTS and CTS pins
+#define RTS_PIN PB3
+#define CTS_PIN PB4
+
+// bytes the remote end sends, and frames between the main loop's reads
+#define BURST_LEN 200
+#define READ_INTERVAL_FRAMES 3
+
+static USISerialPort port;
+
+static uint8_t burst[BURST_LEN];
+static uint8_t received[BURST_LEN];
+static uint16_t received_count;
+
+static void read_slowly(void) {
+    if (usi_rx_available(&port) && (received_count < sizeof(received))) {
+        received[received_count++] = usi_rx_read(&port);
+    }
+}
+
+static void init_sim(const BaudRate baud_rate, const USISerialFlowControl flow_control,
+                     const bool slow_reader)
+{
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.flow_control = flow_control;
+    cfg.rts_pin = RTS_PIN;
+    cfg.cts_pin = CTS_PIN;
+
+    if (slow_reader) {
+        cfg.main_loop_interval = READ_INTERVAL_FRAMES * 10 * (F_CPU / baud_rate);
+    }
+
+    lsim_init_usi_port(&port, &cfg, NULL, baud_rate, &format8N1);
+    lsim_set_main_loop(slow_reader ? &read_slowly : NULL);
+
+    received_count = 0;
+}
+
+// cycles for the slow reader to get through the burst, and then some
+static uint32_t burst_cycles(const BaudRate baud_rate) {
+    return (BURST_LEN + 10) * READ_INTERVAL_FRAMES * 10UL * (F_CPU / baud_rate);
+}
+
+// what's left in the buffer once the remote end's done, and checks the lot
+static void check_burst_received(void) {
+    received_count += usi_rx_read_block(&port, received + received_count,
+                                        sizeof(received) - received_count);
+
+    LONGS_EQUAL(BURST_LEN, received_count);
+    CHECK(memcmp(burst, received, BURST_LEN) == 0);
+    LONGS_EQUAL(0, usi_rx_overrun_count(&port));
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+    CHECK(! usi_serial_rx_throttled(&port));
+}
+
+TEST_GROUP(USISerialFlowControlTests) {
+    void setup() {
+        for (uint16_t i = 0; i < BURST_LEN; i++) {
+            // no XON or XOFF
+            burst[i] = 'A' + (i % 26);
+        }
+    }
+};
+
+TEST(USISerialFlowControlTests, SlowReaderOverrunsWithout) {
+    init_sim(BAUD_19200, USI_SERIAL_FLOW_NONE, true);
+
+    lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+    CHECK(lsim_run_until_idle(burst_cycles(BAUD_19200)));
+
+    CHECK(usi_rx_overrun_count(&port) > 0);
+    CHECK(received_count < BURST_LEN);
+}
+
+TEST(USISerialFlowControlTests, RTSThrottlesPeer) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i], USI_SERIAL_FLOW_RTS_CTS, true);
+        CHECK(usi_serial_set_flow_control(&port, USI_SERIAL_FLOW_RTS_CTS, RTS_PIN, CTS_PIN, 12, 4));
+
+        // RTS is an output, low while there's room
+        BYTES_EQUAL(_BV(RTS_PIN), virtualDDRB & _BV(RTS_PIN));
+        BYTES_EQUAL(0, virtualPORTB & _BV(RTS_PIN));
+
+        lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+        CHECK(lsim_run_until_idle(burst_cycles(rates[i])));
+
+        check_burst_received();
+        BYTES_EQUAL(0, virtualPORTB & _BV(RTS_PIN));
+    }
+}
+
+TEST(USISerialFlowControlTests, XOFFThrottlesPeer) {
+    // full duplex is refused beyond 19200
+    for (uint8_t i = 0; (i < COUNT(rates)) && (rates[i] <= BAUD_19200); i++) {
+        init_sim(rates[i], USI_SERIAL_FLOW_XON_XOFF, true);
+        CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+        CHECK(usi_serial_set_flow_control(&port, USI_SERIAL_FLOW_XON_XOFF, 0, 0, 12, 4));
+
+        lsim_remote_send(LSIM_USI_LINE, burst, BURST_LEN);
+        CHECK(lsim_run_until_idle(burst_cycles(rates[i])));
+
+        check_burst_received();
+
+        // paused and carried on at least once, and carrying on now that
+        // the last has been read
+        CHECK(lsim_run_until_idle(3 * 10UL * (F_CPU / rates[i])));
+        CHECK(lsim_line_stats(LSIM_USI_LINE)->xoffs_received > 0);
+        LONGS_EQUAL(lsim_line_stats(LSIM_USI_LINE)->xoffs_received,
+                    lsim_line_stats(LSIM_USI_LINE)->xons_received);
+        LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+    }
+}
+
+TEST(USISerialFlowControlTests, CTSHoldsTransmission) {
+    const uint32_t frame_cycles = 10 * (F_CPU / BAUD_19200);
+    uint8_t sent[10];
+
+    init_sim(BAUD_19200, USI_SERIAL_FLOW_RTS_CTS, false);
+    CHECK(usi_serial_set_flow_control(&port, USI_SERIAL_FLOW_RTS_CTS, RTS_PIN, CTS_PIN, 12, 4));
+
+    lsim_remote_set_rts(LSIM_USI_LINE, false);
+    lsim_run(100);
+    CHECK(usi_serial_tx_stopped(&port));
+
+    for (uint8_t i = 0; i < sizeof(sent); i++) {
+        CHECK(usi_tx_enqueue(&port, burst[i]));
+    }
+
+    lsim_run(5 * frame_cycles);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->frames_received);
+
+    // CTS going low restarts it
+    lsim_remote_set_rts(LSIM_USI_LINE, true);
+    lsim_run(3 * frame_cycles);
+    CHECK(! usi_serial_tx_stopped(&port));
+
+    // and high again pauses it after the frame on the line
+    lsim_remote_set_rts(LSIM_USI_LINE, false);
+    lsim_run(5 * frame_cycles);
+
+    const uint16_t before_pause = lsim_line_stats(LSIM_USI_LINE)->frames_received;
+
+    CHECK(before_pause > 0);
+    CHECK(before_pause < sizeof(sent));
+
+    lsim_run(5 * frame_cycles);
+    LONGS_EQUAL(before_pause, lsim_line_stats(LSIM_USI_LINE)->frames_received);
+
+    lsim_remote_set_rts(LSIM_USI_LINE, true);
+    lsim_run(frame_cycles);
+    CHECK(lsim_run_until_idle(20 * frame_cycles));
+
+    LONGS_EQUAL(sizeof(sent), lsim_remote_read(LSIM_USI_LINE, sent, sizeof(sent)));
+    CHECK(memcmp(burst, sent, sizeof(sent)) == 0);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+}
+
+TEST(USISerialFlowControlTests, XOFFHoldsTransmission) {
+    const uint32_t frame_cycles = 10 * (F_CPU / BAUD_19200);
+    const uint8_t xoff = USI_SERIAL_XOFF;
+    const uint8_t xon = USI_SERIAL_XON;
+    uint8_t sent[10];
+
+    init_sim(BAUD_19200, USI_SERIAL_FLOW_XON_XOFF, false);
+    CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+    CHECK(usi_serial_set_flow_control(&port, USI_SERIAL_FLOW_XON_XOFF, 0, 0, 12, 4));
+
+    lsim_remote_send(LSIM_USI_LINE, &xoff, 1);
+    CHECK(lsim_run_until_idle(3 * frame_cycles));
+    CHECK(usi_serial_tx_stopped(&port));
+
+    for (uint8_t i = 0; i < sizeof(sent); i++) {
+        CHECK(usi_tx_enqueue(&port, burst[i]));
+    }
+
+    lsim_run(5 * frame_cycles);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->frames_received);
+
+    lsim_remote_send(LSIM_USI_LINE, &xon, 1);
+    CHECK(lsim_run_until_idle(20 * frame_cycles));
+    CHECK(! usi_serial_tx_stopped(&port));
+
+    LONGS_EQUAL(sizeof(sent), lsim_remote_read(LSIM_USI_LINE, sent, sizeof(sent)));
+    CHECK(memcmp(burst, sent, sizeof(sent)) == 0);
+
+    // neither was delivered
+    LONGS_EQUAL(0, usi_rx_available(&port));
+}
+
+TEST(USISerialFlowControlTests, RejectsWatermarks) {
+    init_sim(BAUD_19200, USI_SERIAL_FLOW_NONE, false);
+
+    CHECK(! usi_serial_set_flow_control(&port, USI_SERIAL_FLOW_RTS_CTS, RTS_PIN, CTS_PIN,
+                                        USI_SERIAL_RX_BUFFER_SIZE + 1, 4));
+    CHECK(! usi_serial_set_flow_control(&port, USI_SERIAL_FLOW_RTS_CTS, RTS_PIN, CTS_PIN, 8, 8));
+    CHECK(usi_serial_set_flow_control(&port, USI_SERIAL_FLOW_RTS_CTS, RTS_PIN, CTS_PIN,
+                                      USI_SERIAL_RX_BUFFER_SIZE, 0));
+}
@@ -0,0 +1,257 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "8bit_binary.h"
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "ByteReceiverSpy.h"
+    #include "LineSimulator.h"
+
+    void ISR_PCINT0_vect(void);
+    void ISR_TIMER0_COMPA_vect(void);
+    void ISR_USI_OVF_vect(void);
+}
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "CppUTest/TestHarness.h"
+
+static const USISerialRegisters usiRegs = {
+    &virtualPORTB,
+    &virtualPINB,
+    &virtualDDRB,
+    &virtualUSIBR,
+    &virtualUSICR,
+    &virtualUSIDR,
+    &virtualUSISR,
+    &virtualGIFR,
+    &virtualGIMSK,
+    &virtualPCMSK,
+    &virtualTCNT0,
+    &virtualMCUCR,
+};
+
+static const Timer0Registers timer0Regs = {
+    &virtualGTCCR,
+    &virtualTCCR0A,
+    &virtualTCCR0B,
+    &virtualOCR0A,
+    &virtualTIMSK,
+    &virtualTIFR,
+    &virtualTCNT0,
+};
+
+static USISerialPort port;
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+static const USISerialFrameFormat format8E1 = USI_SERIAL_FRAME_FORMAT(8, EVEN, 1);
+
+// the fastest rate timer0 runs at prescale 1 for, if any.  None with the
+// default startup delay; make PRESCALE_1=Y runs these tests with a shorter
+// one.
+#if USI_SERIAL_TIMING_OK(115200) && (USI_SERIAL_PRESCALE(115200) == 1)
+#define PRESCALE_1_RATE BAUD_115200
+#elif USI_SERIAL_TIMING_OK(57600) && (USI_SERIAL_PRESCALE(57600) == 1)
+#define PRESCALE_1_RATE BAUD_57600
+#elif USI_SERIAL_TIMING_OK(38400) && (USI_SERIAL_PRESCALE(38400) == 1)
+#define PRESCALE_1_RATE BAUD_38400
+#endif
+
+static void init_at(const BaudRate baud_rate) {
+    timer0_init(&timer0Regs, USI_SERIAL_TIMER0_PRESCALE(baud_rate));
+    usi_serial_init(&port, &usiRegs, &brs_receive_byte, baud_rate, &format8E1);
+}
+
+/*
+ * Starts receiving a byte and walks timer0 through the frame's 8 data bits,
+ * parity bit and stop bit, comparing the time of each compare match (where
+ * the USI samples DI) with the middle of the bit.
+ *
+ * @return the largest error, in CPU cycles
+ */
+static double max_sample_error(const BaudRate baud_rate) {
+    const double prescale = USI_SERIAL_PRESCALE(baud_rate);
+    const double bit_cycles = (double) F_CPU / baud_rate;
+
+    virtualPINB = B11111110;
+    ISR_PCINT0_vect();
+
+    // like the rest, the first match is OCR0A+1 ticks after the timer's
+    // started
+    double sample_cycles = USI_SERIAL_PCINT_STARTUP_CYCLES + ((virtualOCR0A + 1) * prescale);
+    double max_error = 0;
+
+    for (uint8_t bit = 0; bit < 10; bit++) {
+        double error = fabs(sample_cycles - ((bit + 1.5) * bit_cycles));
+
+        if (error > max_error) {
+            max_error = error;
+        }
+
+        // the OCR0A value for the next bit is set at the match; the
+        // following matches are every OCR0A+1 ticks
+        ISR_TIMER0_COMPA_vect();
+        sample_cycles += (virtualOCR0A + 1) * prescale;
+    }
+
+    return max_error;
+}
+
+TEST_GROUP(USISerialHighRateTests) {
+    void setup() {
+        virtualPORTB = 0;
+        virtualPINB = 0xff;
+        virtualDDRB = 0xff;
+        virtualUSIBR = 0;
+        virtualUSICR = 0xff;
+        virtualUSISR = 0xff;
+        virtualGIFR = 0;
+        virtualGIMSK = 0;
+        virtualPCMSK = 0;
+
+        virtualGTCCR = 0;
+        virtualTCCR0A = 0;
+        virtualTCCR0B = 0;
+        virtualOCR0A = 0;
+        virtualTIMSK = 0;
+        virtualTIFR = 0;
+        virtualTCNT0 = 0;
+
+        brs_init();
+    }
+};
+
+#ifdef PRESCALE_1_RATE
+TEST(USISerialHighRateTests, Prescale1) {
+    init_at(PRESCALE_1_RATE);
+
+    virtualPINB = B11111110;
+    ISR_PCINT0_vect();
+
+    BYTES_EQUAL(B00000001, virtualTCCR0B); // prescaler; cpu/1
+    BYTES_EQUAL(USI_SERIAL_INITIAL_TIMER0_SEED(PRESCALE_1_RATE), virtualOCR0A);
+    BYTES_EQUAL(B00010000, virtualTIMSK);  // OCR0A compare interrupt enabled
+
+    ISR_TIMER0_COMPA_vect();
+
+    BYTES_EQUAL(USI_SERIAL_TIMER0_SEED(PRESCALE_1_RATE), virtualOCR0A);
+
+    if (! USI_SERIAL_DITHERED(PRESCALE_1_RATE)) {
+        BYTES_EQUAL(B00000000, virtualTIMSK); // OCR0A compare interrupt disabled
+    }
+}
+
+TEST(USISerialHighRateTests, LineAtPrescale1) {
+    const char *message = "The quick brown fox";
+    uint8_t received[32];
+    LineSimConfig cfg;
+
+    // the PCINT0 ISR starting timer0 as soon as the driver was built to expect
+    lsim_default_config(&cfg, PRESCALE_1_RATE);
+    cfg.pcint_cycles += USI_SERIAL_PCINT_STARTUP_CYCLES - cfg.pcint_latency;
+    cfg.pcint_latency = USI_SERIAL_PCINT_STARTUP_CYCLES;
+
+    lsim_init_usi_port(&port, &cfg, &brs_receive_byte, PRESCALE_1_RATE, &format8N1);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(PRESCALE_1_RATE, strlen(message), 12)));
+
+    LONGS_EQUAL(strlen(message), brs_get_invocation_count());
+    BYTES_EQUAL('x', brs_get_received_byte());
+    BYTES_EQUAL(0, brs_get_received_status());
+    CHECK(lsim_line_stats(LSIM_USI_LINE)->max_sample_offset < 0.05);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        CHECK(usi_tx_enqueue(&port, message[i]));
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(PRESCALE_1_RATE, 10, 12)));
+
+    LONGS_EQUAL(10, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    CHECK(memcmp(message, received, 10) == 0);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+}
+#endif
+
+TEST(USISerialHighRateTests, DitheredRateKeepsCompareInterrupt) {
+    init_at(BAUD_28800);
+
+    virtualPINB = B11111110;
+    ISR_PCINT0_vect();
+
+    BYTES_EQUAL(B00000010, virtualTCCR0B); // prescaler; cpu/8
+    BYTES_EQUAL(USI_SERIAL_INITIAL_TIMER0_SEED(BAUD_28800), virtualOCR0A);
+
+    // 34.72 ticks/bit: alternates between 34 and 35 tick periods
+    uint16_t long_bits = 0;
+
+    for (uint8_t bit = 0; bit < 9; bit++) {
+        ISR_TIMER0_COMPA_vect();
+
+        CHECK((virtualOCR0A == 33) || (virtualOCR0A == 34));
+        long_bits += virtualOCR0A - 33;
+
+        BYTES_EQUAL(B00010000, virtualTIMSK); // still enabled
+    }
+
+    // 0.72 of 9 bits
+    LONGS_EQUAL(7, long_bits);
+
+    // data bits, then parity and stop bits; frame complete
+    virtualUSIBR = B10000110; // 'a' reversed
+    ISR_USI_OVF_vect();
+
+    virtualUSIBR = B00011011;
+    ISR_USI_OVF_vect();
+
+    BYTES_EQUAL('a', brs_get_received_byte());
+    BYTES_EQUAL(0, brs_get_received_status());
+    BYTES_EQUAL(B00000000, virtualTIMSK); // disabled
+    BYTES_EQUAL(B00000001, virtualPCMSK); // PCINT0 re-enabled
+}
+
+TEST(USISerialHighRateTests, FrameErrorUnderOnePercent) {
+    BaudRate baud_rates[] = {
+        BAUD_19200,
+        BAUD_28800,
+        BAUD_38400,
+#ifdef PRESCALE_1_RATE
+        PRESCALE_1_RATE,
+#endif
+    };
+
+    for (uint8_t i = 0; i < (sizeof(baud_rates)/sizeof(baud_rates[0])); i++) {
+        init_at(baud_rates[i]);
+
+        double frame_cycles = 11 * ((double) F_CPU / baud_rates[i]);
+        double max_error = max_sample_error(baud_rates[i]);
+
+        CHECK((max_error / frame_cycles) < 0.01);
+
+        // and never more than a timer tick, plus half a tick of rounding in
+        // the start-bit delay
+        CHECK(max_error <= (1.5 * USI_SERIAL_PRESCALE(baud_rates[i])));
+    }
+}
+
+TEST(USISerialHighRateTests, TransmitDithered) {
+    init_at(BAUD_28800);
+
+    CHECK(usi_tx_enqueue(&port, 'e'));
+
+    BYTES_EQUAL(33,        virtualOCR0A);
+    BYTES_EQUAL(B00010000, virtualTIMSK); // OCR0A compare interrupt enabled
+
+    ISR_TIMER0_COMPA_vect();
+    CHECK((virtualOCR0A == 33) || (virtualOCR0A == 34));
+
+    // idle bit, two half-frames, done
+    ISR_USI_OVF_vect();
+    ISR_USI_OVF_vect();
+    ISR_USI_OVF_vect();
+
+    BYTES_EQUAL(0,         virtualUSICR); // USI disabled
+    BYTES_EQUAL(B00000000, virtualTIMSK); // OCR0A compare interrupt disabled
+}
@@ -0,0 +1,321 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * The idle-line timeout, on the line simulator, with Modbus RTU's thresholds
+ * for 8N1: 1.5 characters, 15 bit periods, and 3.5, 35.
+ */
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+static const BaudRate rates[] = { BAUD_9600, BAUD_19200, BAUD_38400 };
+static const uint8_t thresholds[] = { 15, 35 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static USISerialPort port;
+static USISerialPort soft;
+
+static uint8_t message_buf[64];
+
+static uint8_t delivered[64];
+static uint8_t delivered_len;
+static uint8_t delivered_status;
+static uint8_t delivered_count;
+static uint32_t delivered_at;
+
+static void message_handler(uint8_t *m, uint8_t len, uint8_t status) {
+    memcpy(delivered, m, len);
+    delivered_len = len;
+    delivered_status = status;
+    delivered_count += 1;
+    delivered_at = lsim_stats()->cycles;
+}
+
+// sent as the first message is delivered, while the handler keeps the CPU
+// busy for busy_cycles
+static const char *next_message;
+static uint32_t busy_cycles;
+static uint32_t sent_at;
+static uint32_t returned_at;
+
+static uint8_t handler_depth;
+static uint8_t max_handler_depth;
+
+static void slow_message_handler(uint8_t *m, uint8_t len, uint8_t status) {
+    handler_depth += 1;
+
+    if (handler_depth > max_handler_depth) {
+        max_handler_depth = handler_depth;
+    }
+
+    message_handler(m, len, status);
+
+    if (next_message != NULL) {
+        const char *next = next_message;
+
+        next_message = NULL;
+        sent_at = lsim_stats()->cycles;
+        lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) next, 10);
+        lsim_busy(busy_cycles);
+        returned_at = lsim_stats()->cycles;
+    }
+
+    handler_depth -= 1;
+}
+
+static void init_sim(const BaudRate baud_rate, const uint8_t gap_bits) {
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.gap_bits = gap_bits;
+    lsim_init_usi_port(&port, &cfg, NULL, baud_rate, &format8N1);
+}
+
+// cycles for len frames with gap_bits between them, and a timeout after
+static uint32_t burst_cycles(const BaudRate baud_rate, const uint8_t len,
+                             const uint8_t gap_bits, const uint8_t idle_bits)
+{
+    return lsim_frames_cycles(baud_rate, len, 10 + gap_bits) + (idle_bits * (F_CPU / baud_rate));
+}
+
+TEST_GROUP(USISerialIdleTimeoutTests) {
+    void setup() {
+        delivered_len = 0;
+        delivered_status = 0;
+        delivered_count = 0;
+        delivered_at = 0;
+
+        next_message = NULL;
+        sent_at = 0;
+        returned_at = 0;
+        handler_depth = 0;
+        max_handler_depth = 0;
+    }
+};
+
+TEST(USISerialIdleTimeoutTests, DeliversBurstAfterTimeout) {
+    const uint8_t len = strlen(message);
+
+    for (uint8_t r = 0; r < COUNT(rates); r++) {
+        for (uint8_t t = 0; t < COUNT(thresholds); t++) {
+            const double bit_cycles = (double) F_CPU / rates[r];
+
+            setup();
+            init_sim(rates[r], 0);
+            CHECK(usi_serial_set_idle_timeout(&port, thresholds[t], message_buf,
+                                              sizeof(message_buf), &message_handler));
+
+            const uint32_t start = lsim_stats()->cycles;
+
+            lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, len);
+            CHECK(lsim_run_until_idle(burst_cycles(rates[r], len, 0, thresholds[t])));
+
+            LONGS_EQUAL(1, delivered_count);
+            LONGS_EQUAL(len, delivered_len);
+            LONGS_EQUAL(0, delivered_status);
+            CHECK(memcmp(message, delivered, len) == 0);
+
+            // the end of the last stop bit, and the timeout after it
+            const double expected = start + ((len * 10.0) + thresholds[t]) * bit_cycles;
+            const double error = delivered_at - expected;
+
+            CHECK((error > -(bit_cycles / 4)) && (error < (bit_cycles / 4)));
+
+            // nothing went to the receive buffer
+            LONGS_EQUAL(0, usi_rx_available(&port));
+        }
+    }
+}
+
+TEST(USISerialIdleTimeoutTests, ShorterGapContinuesMessage) {
+    for (uint8_t r = 0; r < COUNT(rates); r++) {
+        for (uint8_t t = 0; t < COUNT(thresholds); t++) {
+            const uint8_t gap_bits = thresholds[t] - 1;
+
+            setup();
+            init_sim(rates[r], gap_bits);
+            CHECK(usi_serial_set_idle_timeout(&port, thresholds[t], message_buf,
+                                              sizeof(message_buf), &message_handler));
+
+            lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 5);
+            CHECK(lsim_run_until_idle(burst_cycles(rates[r], 5, gap_bits, thresholds[t])));
+
+            LONGS_EQUAL(1, delivered_count);
+            LONGS_EQUAL(5, delivered_len);
+            CHECK(memcmp(message, delivered, 5) == 0);
+        }
+    }
+}
+
+TEST(USISerialIdleTimeoutTests, LongerGapEndsMessage) {
+    for (uint8_t r = 0; r < COUNT(rates); r++) {
+        for (uint8_t t = 0; t < COUNT(thresholds); t++) {
+            const uint8_t gap_bits = thresholds[t] + 1;
+
+            setup();
+            init_sim(rates[r], gap_bits);
+            CHECK(usi_serial_set_idle_timeout(&port, thresholds[t], message_buf,
+                                              sizeof(message_buf), &message_handler));
+
+            lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 5);
+            CHECK(lsim_run_until_idle(burst_cycles(rates[r], 5, gap_bits, thresholds[t])));
+
+            // a message for each byte
+            LONGS_EQUAL(5, delivered_count);
+            LONGS_EQUAL(1, delivered_len);
+            BYTES_EQUAL(message[4], delivered[0]);
+        }
+    }
+}
+
+TEST(USISerialIdleTimeoutTests, HoldsReplyUntilTimeout) {
+    const double bit_cycles = (double) F_CPU / BAUD_19200;
+
+    init_sim(BAUD_19200, 0);
+    CHECK(usi_serial_set_idle_timeout(&port, 35, message_buf, sizeof(message_buf),
+                                      &message_handler));
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 10);
+
+    // queued part-way through the message
+    lsim_run(25 * bit_cycles);
+    CHECK(usi_tx_enqueue(&port, 'o'));
+    CHECK(usi_tx_enqueue(&port, 'k'));
+
+    while (delivered_count == 0) {
+        LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->frames_received);
+        CHECK(lsim_stats()->cycles < burst_cycles(BAUD_19200, 10, 0, 35));
+
+        lsim_run(bit_cycles / 2);
+    }
+
+    CHECK(lsim_run_until_idle(burst_cycles(BAUD_19200, 2, 0, 35)));
+
+    LONGS_EQUAL(10, delivered_len);
+    LONGS_EQUAL(0, delivered_status);
+    CHECK(memcmp(message, delivered, 10) == 0);
+
+    uint8_t reply[2];
+
+    LONGS_EQUAL(2, lsim_remote_read(LSIM_USI_LINE, reply, sizeof(reply)));
+    CHECK(memcmp("ok", reply, 2) == 0);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+}
+
+TEST(USISerialIdleTimeoutTests, SlowHandlerOverlapsNextMessage) {
+    const double bit_cycles = (double) F_CPU / BAUD_19200;
+
+    init_sim(BAUD_19200, 0);
+    CHECK(usi_serial_set_idle_timeout(&port, 35, message_buf, sizeof(message_buf),
+                                      &slow_message_handler));
+
+    // busy for half the next message
+    next_message = message + 20;
+    busy_cycles = 50 * bit_cycles;
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 5);
+    CHECK(lsim_run_until_idle(burst_cycles(BAUD_19200, 5, 0, 35) +
+                              burst_cycles(BAUD_19200, 10, 0, 35)));
+
+    LONGS_EQUAL(2, delivered_count);
+    LONGS_EQUAL(1, max_handler_depth);
+
+    // none of it lost to the first message
+    LONGS_EQUAL(10, delivered_len);
+    LONGS_EQUAL(0, delivered_status);
+    CHECK(memcmp(message + 20, delivered, 10) == 0);
+
+    // and still timed from its last stop bit
+    const double error = delivered_at - (sent_at + (100 + 35) * bit_cycles);
+
+    CHECK((error > -(bit_cycles / 4)) && (error < (bit_cycles / 4)));
+}
+
+TEST(USISerialIdleTimeoutTests, SlowHandlerOutlastsNextMessage) {
+    const double bit_cycles = (double) F_CPU / BAUD_19200;
+
+    init_sim(BAUD_19200, 0);
+    CHECK(usi_serial_set_idle_timeout(&port, 35, message_buf, sizeof(message_buf),
+                                      &slow_message_handler));
+
+    // busy past the next message's timeout
+    next_message = message + 20;
+    busy_cycles = (100 + 35 + 20) * bit_cycles;
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 5);
+    CHECK(lsim_run_until_idle(burst_cycles(BAUD_19200, 5, 0, 35) +
+                              burst_cycles(BAUD_19200, 10, 0, 35 + 20)));
+
+    // the handler's not re-entered; the message waits for it to return
+    LONGS_EQUAL(2, delivered_count);
+    LONGS_EQUAL(1, max_handler_depth);
+
+    LONGS_EQUAL(10, delivered_len);
+    CHECK(memcmp(message + 20, delivered, 10) == 0);
+
+    CHECK(delivered_at >= returned_at);
+    CHECK(delivered_at < (returned_at + 2 * bit_cycles));
+}
+
+TEST(USISerialIdleTimeoutTests, ReportsOverrun) {
+    init_sim(BAUD_19200, 0);
+    CHECK(usi_serial_set_idle_timeout(&port, 35, message_buf, 4, &message_handler));
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 6);
+    CHECK(lsim_run_until_idle(burst_cycles(BAUD_19200, 6, 0, 35)));
+
+    LONGS_EQUAL(1, delivered_count);
+    LONGS_EQUAL(4, delivered_len);
+    LONGS_EQUAL(USI_SERIAL_RX_OVERRUN, delivered_status);
+    LONGS_EQUAL(2, usi_rx_overrun_count(&port));
+
+    // and the next is unaffected
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 3);
+    CHECK(lsim_run_until_idle(burst_cycles(BAUD_19200, 3, 0, 35)));
+
+    LONGS_EQUAL(2, delivered_count);
+    LONGS_EQUAL(3, delivered_len);
+    LONGS_EQUAL(0, delivered_status);
+}
+
+TEST(USISerialIdleTimeoutTests, RefusedWithoutTimer0) {
+    init_sim(BAUD_19200, 0);
+    CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+
+    CHECK(! usi_serial_set_idle_timeout(&port, 35, message_buf, sizeof(message_buf),
+                                        &message_handler));
+
+    CHECK(usi_serial_init_bit_banged(&soft, &lsim_usi_regs, &lsim_timer1_regs, PB3, PB4,
+                                     NULL, BAUD_19200, &format8N1));
+
+    CHECK(! usi_serial_set_idle_timeout(&soft, 35, message_buf, sizeof(message_buf),
+                                        &message_handler));
+}
+
+TEST(USISerialIdleTimeoutTests, TurnedOffByInit) {
+    init_sim(BAUD_19200, 0);
+    CHECK(usi_serial_set_idle_timeout(&port, 35, message_buf, sizeof(message_buf),
+                                      &message_handler));
+
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_19200, &format8N1);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 3);
+    CHECK(lsim_run_until_idle(burst_cycles(BAUD_19200, 3, 0, 35)));
+
+    LONGS_EQUAL(0, delivered_count);
+    LONGS_EQUAL(3, usi_rx_available(&port));
+}
@@ -0,0 +1,437 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "ByteReceiverSpy.h"
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * Runs the driver against the line simulator, rather than calling the ISRs by
+ * hand.
+ */
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+static const USISerialFrameFormat format8E1 = USI_SERIAL_FRAME_FORMAT(8, EVEN, 1);
+
+// both parities, and the MSB set and clear
+static const uint8_t frames[] = { 'a', 'c', 0x00, 0xff, 0x80, 0x7f, 0x55 };
+
+static USISerialPort port;
+
+static uint8_t received[64];
+static uint8_t received_count;
+
+static void drain_rx(void) {
+    received_count += usi_rx_read_block(&port, 
+        received + received_count,
+        sizeof(received) - received_count
+    );
+}
+
+static void init_sim(const BaudRate baud_rate,
+                     const int16_t skew,
+                     void (*handler)(uint8_t, uint8_t),
+                     const USISerialFrameFormat *format)
+{
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.skew = skew;
+    cfg.format = *format;
+
+    lsim_init_usi_port(&port, &cfg, handler, baud_rate, format);
+}
+
+static void send_message(void) {
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+}
+
+TEST_GROUP(USISerialLineSimulatorTests) {
+    void setup() {
+        received_count = 0;
+        memset(received, 0, sizeof(received));
+
+        brs_init();
+    }
+};
+
+TEST(USISerialLineSimulatorTests, ReceiveBackToBackFrames) {
+    init_sim(BAUD_9600, 0, NULL, &format8N1);
+    lsim_set_main_loop(&drain_rx);
+
+    send_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 12)));
+
+    LONGS_EQUAL(strlen(message), received_count);
+    CHECK(memcmp(message, received, strlen(message)) == 0);
+    LONGS_EQUAL(0, usi_rx_overrun_count(&port));
+
+    // an overflow for the data bits and one for the stop bit; the compare
+    // interrupt only for each start bit
+    const LineSimStats *stats = lsim_stats();
+
+    LONGS_EQUAL(2 * strlen(message), stats->usi_ovf_count);
+    LONGS_EQUAL(strlen(message), stats->timer0_compa_count);
+
+    // sampled close to the middle of each bit; timer0's prescaler and the
+    // rounded bit period account for the difference
+    CHECK(lsim_line_stats(LSIM_USI_LINE)->max_sample_offset < 0.05);
+}
+
+TEST(USISerialLineSimulatorTests, ReceiveIntoHandler) {
+    init_sim(BAUD_38400, 0, &brs_receive_byte, &format8N1);
+
+    send_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_38400, strlen(message), 12)));
+
+    LONGS_EQUAL(strlen(message), brs_get_invocation_count());
+    BYTES_EQUAL('g', brs_get_received_byte());
+}
+
+#ifndef USI_SERIAL_FIXED_FORMAT
+TEST(USISerialLineSimulatorTests, ReceiveWithParity) {
+    init_sim(BAUD_19200, 0, NULL, &format8E1);
+    lsim_set_main_loop(&drain_rx);
+
+    send_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 12)));
+
+    LONGS_EQUAL(strlen(message), received_count);
+    CHECK(memcmp(message, received, strlen(message)) == 0);
+
+    // data bits, then the parity and stop bits
+    LONGS_EQUAL(2 * strlen(message), lsim_stats()->usi_ovf_count);
+    LONGS_EQUAL(0, usi_rx_parity_error_count(&port));
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+}
+
+TEST(USISerialLineSimulatorTests, ReceiveErrors) {
+    static const USISerialFrameFormat format8O1 = USI_SERIAL_FRAME_FORMAT(8, ODD, 1);
+    static const USISerialFrameFormat format8S1 = USI_SERIAL_FRAME_FORMAT(8, SPACE, 1);
+
+    LineSimConfig cfg;
+    uint8_t status;
+
+    // remote end sends even parity; expecting odd
+    lsim_default_config(&cfg, BAUD_19200);
+    cfg.format = format8E1;
+    lsim_init(&cfg);
+
+    timer0_init(&lsim_timer0_regs, USI_SERIAL_TIMER0_PRESCALE(BAUD_19200));
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_19200, &format8O1);
+
+    lsim_remote_send(LSIM_USI_LINE, frames, sizeof(frames));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 12)));
+
+    LONGS_EQUAL(sizeof(frames), usi_rx_parity_error_count(&port));
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+
+    for (uint8_t i = 0; i < sizeof(frames); i++) {
+        BYTES_EQUAL(frames[i], usi_rx_read_with_status(&port, &status));
+        BYTES_EQUAL(USI_SERIAL_RX_PARITY_ERROR, status);
+    }
+
+    // remote end sends a 0 parity bit where the stop bit's expected; the gap
+    // keeps the frames apart
+    cfg.format = format8S1;
+    cfg.gap_bits = 2;
+    lsim_init(&cfg);
+
+    timer0_init(&lsim_timer0_regs, USI_SERIAL_TIMER0_PRESCALE(BAUD_19200));
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_19200, &format8N1);
+
+    lsim_remote_send(LSIM_USI_LINE, frames, sizeof(frames));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 12)));
+
+    LONGS_EQUAL(0, usi_rx_parity_error_count(&port));
+    LONGS_EQUAL(sizeof(frames), usi_rx_framing_error_count(&port));
+
+    for (uint8_t i = 0; i < sizeof(frames); i++) {
+        BYTES_EQUAL(frames[i], usi_rx_read_with_status(&port, &status));
+        BYTES_EQUAL(USI_SERIAL_RX_FRAMING_ERROR, status);
+    }
+}
+#endif
+
+TEST(USISerialLineSimulatorTests, ReceiveWithSkew) {
+    BaudRate baud_rates[] = {
+        BAUD_9600,
+        BAUD_28800,
+        BAUD_38400,
+    };
+
+    int16_t skews[] = { -200, 200 };
+
+    for (uint8_t i = 0; i < (sizeof(baud_rates)/sizeof(baud_rates[0])); i++) {
+        for (uint8_t j = 0; j < (sizeof(skews)/sizeof(skews[0])); j++) {
+            received_count = 0;
+
+            init_sim(baud_rates[i], skews[j], NULL, &format8N1);
+            lsim_set_main_loop(&drain_rx);
+
+            send_message();
+            CHECK(lsim_run_until_idle(lsim_frames_cycles(baud_rates[i], strlen(message), 12)));
+
+            LONGS_EQUAL(strlen(message), received_count);
+            CHECK(memcmp(message, received, strlen(message)) == 0);
+        }
+    }
+}
+
+TEST(USISerialLineSimulatorTests, Transmit) {
+    init_sim(BAUD_9600, 0, NULL, &format8N1);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        CHECK(usi_tx_enqueue(&port, message[i]));
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 12)));
+
+    LONGS_EQUAL(10, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    CHECK(memcmp(message, received, 10) == 0);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+
+    // released the line
+    BYTES_EQUAL(0, virtualDDRB & _BV(PB1));
+}
+
+#ifndef USI_SERIAL_FIXED_FORMAT
+TEST(USISerialLineSimulatorTests, TransmitWithParity) {
+    init_sim(BAUD_19200, 0, NULL, &format8E1);
+    usi_tx_set_streaming(&port, true);
+
+    // both parities
+    CHECK(usi_tx_enqueue(&port, 'a'));
+    CHECK(usi_tx_enqueue(&port, 'c'));
+    CHECK(usi_tx_enqueue(&port, 0x00));
+    CHECK(usi_tx_enqueue(&port, 0xff));
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 12)));
+
+    LONGS_EQUAL(4, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    BYTES_EQUAL('a',  received[0]);
+    BYTES_EQUAL('c',  received[1]);
+    BYTES_EQUAL(0x00, received[2]);
+    BYTES_EQUAL(0xff, received[3]);
+
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->parity_errors);
+}
+
+/*
+ * Sends frames to the driver, and back again, in the given format.
+ */
+static void check_frame_format(const USISerialFrameFormat *format) {
+    const uint8_t data_mask = 0xff >> (8 - format->data_bits);
+    const uint8_t frame_bits = 1 + format->data_bits +
+        ((format->parity != USI_SERIAL_PARITY_NONE) ? 1 : 0) + format->stop_bits;
+
+    // ----- receive
+    received_count = 0;
+
+    init_sim(BAUD_19200, 0, NULL, format);
+    lsim_set_main_loop(&drain_rx);
+
+    lsim_remote_send(LSIM_USI_LINE, frames, sizeof(frames));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 12)));
+
+    LONGS_EQUAL(sizeof(frames), received_count);
+
+    for (uint8_t i = 0; i < sizeof(frames); i++) {
+        BYTES_EQUAL(frames[i] & data_mask, received[i]);
+    }
+
+    // ----- transmit, back-to-back
+    init_sim(BAUD_19200, 0, NULL, format);
+    usi_tx_set_streaming(&port, true);
+
+    for (uint8_t i = 0; i < sizeof(frames); i++) {
+        CHECK(usi_tx_enqueue(&port, frames[i]));
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 12)));
+
+    LONGS_EQUAL(sizeof(frames), lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+
+    for (uint8_t i = 0; i < sizeof(frames); i++) {
+        BYTES_EQUAL(frames[i] & data_mask, received[i]);
+    }
+
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->parity_errors);
+
+    // no more stop bits than asked for: two bit periods before the first
+    // start bit, every frame but the last stop bit of the last, and half of
+    // that stop bit for the remote end to sample it
+    DOUBLES_EQUAL(
+        (sizeof(frames) * frame_bits) + 1.5,
+        lsim_stats()->cycles / ((double) F_CPU / BAUD_19200),
+        0.5
+    );
+}
+
+TEST(USISerialLineSimulatorTests, FrameFormats) {
+    const uint8_t data_bits[] = { 7, 8 };
+    const uint8_t stop_bits[] = { 1, 2 };
+    const USISerialParity parities[] = {
+        USI_SERIAL_PARITY_NONE,
+        USI_SERIAL_PARITY_EVEN,
+        USI_SERIAL_PARITY_ODD,
+        USI_SERIAL_PARITY_MARK,
+        USI_SERIAL_PARITY_SPACE,
+    };
+
+    for (uint8_t i = 0; i < sizeof(data_bits); i++) {
+        for (uint8_t j = 0; j < (sizeof(parities)/sizeof(parities[0])); j++) {
+            for (uint8_t k = 0; k < sizeof(stop_bits); k++) {
+                USISerialFrameFormat format;
+
+                format.data_bits = data_bits[i];
+                format.parity = parities[j];
+                format.stop_bits = stop_bits[k];
+
+                check_frame_format(&format);
+            }
+        }
+    }
+}
+#endif
+
+TEST(USISerialLineSimulatorTests, TransmitDeferredUntilReceiveComplete) {
+    init_sim(BAUD_9600, 0, NULL, &format8N1);
+    lsim_set_main_loop(&drain_rx);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) "a", 1);
+
+    // into the middle of the frame
+    lsim_run(5 * (F_CPU / 9600));
+    CHECK(usi_tx_enqueue(&port, 'b'));
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 12)));
+
+    LONGS_EQUAL(1, received_count);
+    BYTES_EQUAL('a', received[0]);
+
+    LONGS_EQUAL(1, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    BYTES_EQUAL('b', received[0]);
+}
+
+static uint8_t tx_count;
+
+// drains the receive buffer and keeps the transmit queue topped up with the
+// message
+static void echo_message(void) {
+    drain_rx();
+
+    while ((tx_count < strlen(message)) && usi_tx_enqueue(&port, message[tx_count])) {
+        tx_count += 1;
+    }
+}
+
+static void check_full_duplex(const BaudRate baud_rate, const int16_t skew) {
+    received_count = 0;
+    tx_count = 0;
+
+    init_sim(baud_rate, skew, NULL, &format8N1);
+    CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+    usi_tx_set_streaming(&port, true);
+    lsim_set_main_loop(&echo_message);
+
+    send_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(baud_rate, strlen(message), 12)));
+
+    // both directions intact
+    LONGS_EQUAL(strlen(message), received_count);
+    CHECK(memcmp(message, received, strlen(message)) == 0);
+    LONGS_EQUAL(0, usi_rx_overrun_count(&port));
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+
+    uint8_t sent[64];
+
+    LONGS_EQUAL(strlen(message), lsim_remote_read(LSIM_USI_LINE, sent, sizeof(sent)));
+    CHECK(memcmp(message, sent, strlen(message)) == 0);
+
+    const LineSimStats *stats = lsim_stats();
+    const LineSimLineStats *line_stats = lsim_line_stats(LSIM_USI_LINE);
+
+    LONGS_EQUAL(0, line_stats->framing_errors);
+
+    // received on timer1, a compare for each data bit and the stop bit; the
+    // USI only transmits
+    LONGS_EQUAL(9 * strlen(message), stats->timer1_compa_count);
+    LONGS_EQUAL(0, stats->timer0_compa_count);
+
+    // sampled early, or late behind a transmit ISR
+    CHECK(line_stats->max_sample_offset < 0.45);
+}
+
+TEST(USISerialLineSimulatorTests, FullDuplex) {
+    check_full_duplex(BAUD_4800, 0);
+    check_full_duplex(BAUD_9600, 0);
+    check_full_duplex(BAUD_19200, 0);
+}
+
+TEST(USISerialLineSimulatorTests, FullDuplexWithSkew) {
+    check_full_duplex(BAUD_19200, 200);
+    check_full_duplex(BAUD_19200, -200);
+}
+
+TEST(USISerialLineSimulatorTests, FullDuplexTransmitsWhileReceiving) {
+    init_sim(BAUD_9600, 0, NULL, &format8N1);
+    CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+    lsim_set_main_loop(&drain_rx);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) "a", 1);
+
+    // into the middle of the frame; the transmission starts straight away
+    lsim_run(5 * (F_CPU / 9600));
+    CHECK(usi_tx_enqueue(&port, 'b'));
+
+    lsim_run(2 * (F_CPU / 9600));
+    CHECK(virtualDDRB & _BV(PB1));
+    LONGS_EQUAL(0, received_count);
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 12)));
+
+    LONGS_EQUAL(1, received_count);
+    BYTES_EQUAL('a', received[0]);
+
+    LONGS_EQUAL(1, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    BYTES_EQUAL('b', received[0]);
+}
+
+TEST(USISerialLineSimulatorTests, InitReturnsToHalfDuplex) {
+    init_sim(BAUD_9600, 0, NULL, &format8N1);
+    CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_9600, &format8N1);
+    lsim_set_main_loop(&drain_rx);
+
+    send_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 12)));
+
+    LONGS_EQUAL(strlen(message), received_count);
+    LONGS_EQUAL(0, lsim_stats()->timer1_compa_count);
+}
+
+TEST(USISerialLineSimulatorTests, FullDuplexRefusedAtHighRate) {
+    init_sim(BAUD_38400, 0, NULL, &format8N1);
+    CHECK(! usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+    lsim_set_main_loop(&drain_rx);
+
+    // still receiving with the USI
+    send_message();
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_38400, strlen(message), 12)));
+
+    LONGS_EQUAL(strlen(message), received_count);
+    LONGS_EQUAL(0, lsim_stats()->timer1_compa_count);
+}
@@ -0,0 +1,235 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * A USI-backed port and a bit-banged port, on the line simulator.
+ */
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+static const USISerialFrameFormat format7E2 = USI_SERIAL_FRAME_FORMAT(7, EVEN, 2);
+static const USISerialFrameFormat format7O2 = USI_SERIAL_FRAME_FORMAT(7, ODD, 2);
+
+// the bit-banged port's pins
+#define SOFT_RX_PIN PB3
+#define SOFT_TX_PIN PB4
+
+static USISerialPort usi;
+static USISerialPort soft;
+static uint8_t soft_line;
+
+static uint8_t usi_received[64];
+static uint8_t usi_received_count;
+static uint8_t soft_received[64];
+static uint8_t soft_received_count;
+
+static void drain_both(void) {
+    usi_received_count += usi_rx_read_block(
+        &usi,
+        usi_received + usi_received_count,
+        sizeof(usi_received) - usi_received_count
+    );
+
+    soft_received_count += usi_rx_read_block(
+        &soft,
+        soft_received + soft_received_count,
+        sizeof(soft_received) - soft_received_count
+    );
+}
+
+// forwards everything received on either port out of the other
+static void bridge(void) {
+    while (usi_rx_available(&usi) && usi_tx_space_available(&soft)) {
+        usi_tx_enqueue(&soft, usi_rx_read(&usi));
+    }
+
+    while (usi_rx_available(&soft) && usi_tx_space_available(&usi)) {
+        usi_tx_enqueue(&usi, usi_rx_read(&soft));
+    }
+}
+
+// the remote end of the bit-banged port's line sends soft_line_format
+static void init_ports(const BaudRate usi_baud, const USISerialFrameFormat *usi_format,
+                       const BaudRate soft_baud, const USISerialFrameFormat *soft_format,
+                       const USISerialFrameFormat *soft_line_format)
+{
+    LineSimConfig cfg;
+
+    lsim_init_usi_port(&usi, NULL, NULL, usi_baud, usi_format);
+
+    lsim_default_config(&cfg, soft_baud);
+    cfg.format = *soft_line_format;
+    cfg.rx_pin = SOFT_RX_PIN;
+    cfg.tx_pin = SOFT_TX_PIN;
+    soft_line = lsim_add_line(&cfg);
+
+    CHECK(usi_serial_init_bit_banged(&soft, &lsim_usi_regs, &lsim_timer1_regs,
+                                     SOFT_RX_PIN, SOFT_TX_PIN,
+                                     NULL, soft_baud, soft_format));
+}
+
+TEST_GROUP(USISerialMultiPortTests) {
+    void setup() {
+        usi_received_count = 0;
+        soft_received_count = 0;
+    }
+
+    // timer1's free for the next test
+    void teardown() {
+        if (soft.bit_banged) {
+            usi_serial_close_bit_banged(&soft);
+        }
+    }
+};
+
+TEST(USISerialMultiPortTests, BitBangedReceive) {
+    init_ports(BAUD_9600, &format8N1, BAUD_9600, &format8N1, &format8N1);
+    lsim_set_main_loop(&drain_both);
+
+    lsim_remote_send(soft_line, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 14)));
+
+    LONGS_EQUAL(strlen(message), soft_received_count);
+    CHECK(memcmp(message, soft_received, strlen(message)) == 0);
+    LONGS_EQUAL(0, usi_received_count);
+
+    // sampled on timer1: the data bits and the stop bit
+    LONGS_EQUAL(9 * strlen(message), lsim_stats()->timer1_compa_count);
+    LONGS_EQUAL(0, lsim_stats()->usi_ovf_count);
+
+    CHECK(lsim_line_stats(soft_line)->max_sample_offset < 0.1);
+}
+
+TEST(USISerialMultiPortTests, BitBangedTransmit) {
+    init_ports(BAUD_9600, &format8N1, BAUD_19200, &format8N1, &format8N1);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        CHECK(usi_tx_enqueue(&soft, message[i]));
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 14)));
+
+    LONGS_EQUAL(10, lsim_remote_read(soft_line, soft_received, sizeof(soft_received)));
+    CHECK(memcmp(message, soft_received, 10) == 0);
+    LONGS_EQUAL(0, lsim_line_stats(soft_line)->framing_errors);
+
+    // nothing on the USI's line
+    LONGS_EQUAL(0, lsim_remote_read(LSIM_USI_LINE, usi_received, sizeof(usi_received)));
+
+    // idle high
+    CHECK(virtualPORTB & _BV(SOFT_TX_PIN));
+}
+
+#ifndef USI_SERIAL_FIXED_FORMAT
+TEST(USISerialMultiPortTests, BitBangedStreaming) {
+    init_ports(BAUD_9600, &format8N1, BAUD_19200, &format7E2, &format7E2);
+    usi_tx_set_streaming(&soft, true);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        CHECK(usi_tx_enqueue(&soft, message[i]));
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 14)));
+
+    LONGS_EQUAL(10, lsim_remote_read(soft_line, soft_received, sizeof(soft_received)));
+    CHECK(memcmp(message, soft_received, 10) == 0);
+    LONGS_EQUAL(0, lsim_line_stats(soft_line)->framing_errors);
+    LONGS_EQUAL(0, lsim_line_stats(soft_line)->parity_errors);
+
+    // back-to-back 11-bit frames, the timer stopped at the end of the last
+    // stop bit
+    DOUBLES_EQUAL(
+        10 * 11,
+        lsim_stats()->cycles / ((double) F_CPU / BAUD_19200),
+        0.5
+    );
+}
+
+TEST(USISerialMultiPortTests, PortsReceiveSideBySide) {
+    // different rates and formats.  Either port's start bit can wait behind
+    // the other's PCINT0 ISR, so both are slow enough for that to be well
+    // under half a bit.
+    init_ports(BAUD_9600, &format8N1, BAUD_4800, &format7E2, &format7E2);
+    lsim_set_main_loop(&drain_both);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+    lsim_remote_send(soft_line, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_4800, strlen(message), 14)));
+
+    LONGS_EQUAL(strlen(message), usi_received_count);
+    CHECK(memcmp(message, usi_received, strlen(message)) == 0);
+
+    // all 7-bit ASCII
+    LONGS_EQUAL(strlen(message), soft_received_count);
+    CHECK(memcmp(message, soft_received, strlen(message)) == 0);
+
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&usi));
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&soft));
+    LONGS_EQUAL(0, usi_rx_parity_error_count(&soft));
+}
+
+TEST(USISerialMultiPortTests, ErrorsCountedPerPort) {
+    init_ports(BAUD_9600, &format8N1, BAUD_9600, &format7E2, &format7O2);
+    lsim_set_main_loop(&drain_both);
+
+    lsim_remote_send(soft_line, (const uint8_t *) "a", 1);
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) "a", 1);
+    CHECK(lsim_run_until_idle(20 * (F_CPU / 9600)));
+
+    LONGS_EQUAL(1, usi_rx_parity_error_count(&soft));
+    LONGS_EQUAL(0, usi_rx_parity_error_count(&usi));
+
+    LONGS_EQUAL(1, usi_received_count);
+    BYTES_EQUAL('a', usi_received[0]);
+}
+#endif
+
+TEST(USISerialMultiPortTests, BitBangedRefusedAtHighRate) {
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, BAUD_9600);
+    lsim_init(&cfg);
+
+    CHECK(! usi_serial_init_bit_banged(&soft, &lsim_usi_regs, &lsim_timer1_regs,
+                                       SOFT_RX_PIN, SOFT_TX_PIN,
+                                       NULL, BAUD_28800, &format8N1));
+    CHECK(usi_serial_init_bit_banged(&soft, &lsim_usi_regs, &lsim_timer1_regs,
+                                     SOFT_RX_PIN, SOFT_TX_PIN,
+                                     NULL, BAUD_19200, &format8N1));
+}
+
+TEST(USISerialMultiPortTests, Bridge) {
+    uint8_t forwarded[64];
+
+    init_ports(BAUD_9600, &format8N1, BAUD_9600, &format8N1, &format8N1);
+    lsim_set_main_loop(&bridge);
+
+    // USI to bit-banged
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 14)));
+
+    LONGS_EQUAL(strlen(message), lsim_remote_read(soft_line, forwarded, sizeof(forwarded)));
+    CHECK(memcmp(message, forwarded, strlen(message)) == 0);
+
+    // and back
+    lsim_remote_send(soft_line, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 14)));
+
+    LONGS_EQUAL(strlen(message), lsim_remote_read(LSIM_USI_LINE, forwarded, sizeof(forwarded)));
+    CHECK(memcmp(message, forwarded, strlen(message)) == 0);
+
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+    LONGS_EQUAL(0, lsim_line_stats(soft_line)->framing_errors);
+}
@@ -0,0 +1,203 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "8bit_binary.h"
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    void ISR_PCINT0_vect(void);
+    void ISR_TIMER0_COMPA_vect(void);
+    void ISR_USI_OVF_vect(void);
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include "CppUTest/TestHarness.h"
+
+static const USISerialRegisters usiRegs = {
+    &virtualPORTB,
+    &virtualPINB,
+    &virtualDDRB,
+    &virtualUSIBR,
+    &virtualUSICR,
+    &virtualUSIDR,
+    &virtualUSISR,
+    &virtualGIFR,
+    &virtualGIMSK,
+    &virtualPCMSK,
+    &virtualTCNT0,
+    &virtualMCUCR,
+};
+
+static const Timer0Registers timer0Regs = {
+    &virtualGTCCR,
+    &virtualTCCR0A,
+    &virtualTCCR0B,
+    &virtualOCR0A,
+    &virtualTIMSK,
+    &virtualTIFR,
+    &virtualTCNT0,
+};
+
+static USISerialPort port;
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+// Reverses the order of bits in a byte, as the USI shifts them in.
+static uint8_t reversed(uint8_t b) {
+    uint8_t r = 0;
+
+    for (uint8_t i = 0; i < 8; i++) {
+        r = (r << 1) | ((b >> i) & 1);
+    }
+
+    return r;
+}
+
+// start bit, the 8 data bits shifted in by the USI, then the stop bit
+static void receive_frame(uint8_t b, uint8_t stop_bit) {
+    virtualPINB = B11111110;
+    ISR_PCINT0_vect();
+
+    ISR_TIMER0_COMPA_vect();
+
+    virtualUSIBR = reversed(b);
+    ISR_USI_OVF_vect();
+
+    virtualUSIBR = (reversed(b) << 1) | stop_bit;
+    ISR_USI_OVF_vect();
+}
+
+static void receive_byte(uint8_t b) {
+    receive_frame(b, 1);
+}
+
+TEST_GROUP(USISerialRXBufferTests) {
+    void setup() {
+        virtualPORTB = 0;
+        virtualPINB = 0xff;
+        virtualDDRB = 0xff;
+        virtualUSIBR = 0;
+        virtualUSICR = 0xff;
+        virtualUSISR = 0xff;
+        virtualGIFR = 0;
+        virtualGIMSK = 0;
+        virtualPCMSK = 0;
+
+        virtualGTCCR = 0;
+        virtualTCCR0A = 0;
+        virtualTCCR0B = 0;
+        virtualOCR0A = 0;
+        virtualTIMSK = 0;
+        virtualTIFR = 0;
+        virtualTCNT0 = 0;
+
+        // must initialize Timer0 first
+        timer0_init(&timer0Regs, TIMER0_PRESCALE_8);
+
+        // no handler; buffered receive
+        usi_serial_init(&port, &usiRegs, NULL, BAUD_9600, &format8N1);
+    }
+};
+
+TEST(USISerialRXBufferTests, EmptyAfterInit) {
+    BYTES_EQUAL(0, usi_rx_available(&port));
+    BYTES_EQUAL(0, usi_rx_read(&port));
+    LONGS_EQUAL(0, usi_rx_overrun_count(&port));
+}
+
+TEST(USISerialRXBufferTests, ReceivedByteIsBuffered) {
+    receive_byte('a');
+
+    BYTES_EQUAL(1, usi_rx_available(&port));
+    BYTES_EQUAL('a', usi_rx_read(&port));
+    BYTES_EQUAL(0, usi_rx_available(&port));
+
+    // ready for the next start bit
+    BYTES_EQUAL(0,         virtualUSICR); // USI disabled
+    BYTES_EQUAL(B00000001, virtualPCMSK); // PCINT0 re-enabled
+}
+
+TEST(USISerialRXBufferTests, ReadsInOrderAcrossWrap) {
+    // push the indices past the end of the buffer a couple of times
+    for (uint16_t i = 0; i < (USI_SERIAL_RX_BUFFER_SIZE * 2) + 3; i++) {
+        receive_byte(i);
+        receive_byte(i + 100);
+
+        BYTES_EQUAL(2, usi_rx_available(&port));
+        BYTES_EQUAL(i, usi_rx_read(&port));
+        BYTES_EQUAL(i + 100, usi_rx_read(&port));
+    }
+
+    BYTES_EQUAL(0, usi_rx_available(&port));
+}
+
+TEST(USISerialRXBufferTests, ReadBlock) {
+    const char *msg = "hello";
+
+    for (uint8_t i = 0; i < 5; i++) {
+        receive_byte(msg[i]);
+    }
+
+    uint8_t buf[8];
+
+    // partial read
+    BYTES_EQUAL(2, usi_rx_read_block(&port, buf, 2));
+    BYTES_EQUAL('h', buf[0]);
+    BYTES_EQUAL('e', buf[1]);
+
+    // asks for more than is available
+    BYTES_EQUAL(3, usi_rx_read_block(&port, buf, sizeof(buf)));
+    BYTES_EQUAL('l', buf[0]);
+    BYTES_EQUAL('l', buf[1]);
+    BYTES_EQUAL('o', buf[2]);
+
+    BYTES_EQUAL(0, usi_rx_read_block(&port, buf, sizeof(buf)));
+}
+
+TEST(USISerialRXBufferTests, ErrorsFlaggedInBuffer) {
+    uint8_t status;
+
+    receive_byte('a');
+    receive_frame('b', 0);
+    receive_byte('c');
+
+    BYTES_EQUAL(3, usi_rx_available(&port));
+    LONGS_EQUAL(1, usi_rx_framing_error_count(&port));
+
+    BYTES_EQUAL('a', usi_rx_read_with_status(&port, &status));
+    BYTES_EQUAL(0, status);
+
+    BYTES_EQUAL('b', usi_rx_read_with_status(&port, &status));
+    BYTES_EQUAL(USI_SERIAL_RX_FRAMING_ERROR, status);
+
+    BYTES_EQUAL('c', usi_rx_read_with_status(&port, &status));
+    BYTES_EQUAL(0, status);
+
+    // empty
+    BYTES_EQUAL(0, usi_rx_read_with_status(&port, &status));
+    BYTES_EQUAL(0, status);
+}
+
+TEST(USISerialRXBufferTests, OverrunDropsNewestBytes) {
+    for (uint8_t i = 0; i < USI_SERIAL_RX_BUFFER_SIZE + 3; i++) {
+        receive_byte(i);
+    }
+
+    BYTES_EQUAL(USI_SERIAL_RX_BUFFER_SIZE, usi_rx_available(&port));
+    LONGS_EQUAL(3, usi_rx_overrun_count(&port));
+
+    // buffered bytes are intact
+    for (uint8_t i = 0; i < USI_SERIAL_RX_BUFFER_SIZE; i++) {
+        BYTES_EQUAL(i, usi_rx_read(&port));
+    }
+
+    // room again
+    receive_byte('z');
+    BYTES_EQUAL(1, usi_rx_available(&port));
+    BYTES_EQUAL('z', usi_rx_read(&port));
+    LONGS_EQUAL(3, usi_rx_overrun_count(&port));
+
+    usi_rx_reset_error_counts(&port);
+    LONGS_EQUAL(0, usi_rx_overrun_count(&port));
+}
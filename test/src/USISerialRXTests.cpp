@@ -33,6 +33,8 @@ static const USISerialRegisters usiRegs = {
     &virtualGIFR,
     &virtualGIMSK,
     &virtualPCMSK,
+    &virtualTCNT0,
+    &virtualMCUCR,
 };
 
 static const Timer0Registers timer0Regs = {
@@ -45,6 +47,11 @@ static const Timer0Registers timer0Regs = {
     &virtualTCNT0,
 };
 
+static USISerialPort port;
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+static const USISerialFrameFormat format8E1 = USI_SERIAL_FRAME_FORMAT(8, EVEN, 1);
+
 TEST_GROUP(USISerialRXTests) {
     void setup() {
         virtualPORTB = 0;
@@ -70,7 +77,7 @@ TEST_GROUP(USISerialRXTests) {
         
         // must initialize Timer0 first
         timer0_init(&timer0Regs, TIMER0_PRESCALE_8);
-        usi_serial_init(&usiRegs, &brs_receive_byte, BAUD_9600, true);
+        usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format8E1);
     }
 };
 
@@ -88,7 +95,7 @@ TEST(USISerialRXTests, Initialization) {
     virtualPCMSK = 0;
     virtualTCCR0B = 0xff;
     
-    usi_serial_init(&usiRegs, &brs_receive_byte, BAUD_9600, true);
+    usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format8E1);
 
     // see comment in usi_serial_init re: reasoning for DO as input
     BYTES_EQUAL(B00000011, virtualPORTB); // DI, DO pull-ups enabled
@@ -125,16 +132,17 @@ TEST(USISerialRXTests, HandleStartBit) {
     BYTES_EQUAL(B00010000, virtualTIMSK);  // OCR0A compare interrupt enabled
     
     // check Timer0 configured to compare with OCR0A at 1.5 times the bit 
-    // period, plus the interrupt latency
+    // period, plus the interrupt latency; the first match is OCR0A+1 ticks
+    // after starting
 
     // 9600: 104.16666666666667; *1.5: 156.25; cast to uint8_t: 156
-    BYTES_EQUAL(156 - PCINT_STARTUP_DELAY, virtualOCR0A);
+    BYTES_EQUAL(156 - USI_SERIAL_PCINT_STARTUP_TICKS(BAUD_9600) - 1, virtualOCR0A);
 
     // float bit_period = 1e6/_BAUD_RATE;
     // DOUBLES_EQUAL(
-    //     (bit_period * 1.5) - PCINT_STARTUP_DELAY,
+    //     (bit_period * 1.5) - USI_SERIAL_PCINT_STARTUP_TICKS(BAUD_9600),
     //     virtualOCR0A,
-    //     ((bit_period * 1.5) - PCINT_STARTUP_DELAY)*0.02 // 2%
+    //     ((bit_period * 1.5) - USI_SERIAL_PCINT_STARTUP_TICKS(BAUD_9600))*0.02 // 2%
     // );
     
     // ----- check USI config
@@ -157,16 +165,18 @@ TEST(USISerialRXTests, HandleStartBit) {
 TEST(USISerialRXTests, BaudRateChecks) {
     BaudRate baud_rates[] = {
         BAUD_9600,
+        BAUD_14400,
         BAUD_19200,
-        // BAUD_28800, fails DOUBLES_EQUAL
+        BAUD_28800,
         BAUD_38400,
     };
     
     // (1e6/BAUD_x)*1.5
     uint8_t bit_periods[] = {
         156,
+        104,
         78,
-        // 52,
+        52,
         39,
     };
     
@@ -175,7 +185,10 @@ TEST(USISerialRXTests, BaudRateChecks) {
         
         virtualTCCR0B = 0;
 
-        usi_serial_init(&usiRegs, &brs_receive_byte, baud_rate, true);
+        // all of these use prescale 8
+        BYTES_EQUAL(8, USI_SERIAL_PRESCALE(baud_rate));
+
+        usi_serial_init(&port, &usiRegs, &brs_receive_byte, baud_rate, &format8E1);
 
         /*
         the DI line idles high; need to trigger the pin-change interrupt, 
@@ -198,20 +211,23 @@ TEST(USISerialRXTests, BaudRateChecks) {
         BYTES_EQUAL(B00010000, virtualTIMSK);  // OCR0A compare interrupt enabled
         
         // check Timer0 configured to compare with OCR0A at 1.5 times the bit 
-        // period, plus the interrupt latency
+        // period, plus the interrupt latency; the first match is OCR0A+1
+        // ticks after starting
         float bit_period = (1e6/((float) baud_rate));
+        float startup_delay = USI_SERIAL_PCINT_STARTUP_TICKS(baud_rate);
         DOUBLES_EQUAL(
-            (bit_period * 1.5) - PCINT_STARTUP_DELAY,
-            virtualOCR0A,
-            ((bit_period * 1.5) - PCINT_STARTUP_DELAY)*0.02 // 2%
+            (bit_period * 1.5) - startup_delay,
+            virtualOCR0A + 1,
+            ((bit_period * 1.5) - startup_delay)*0.02 // 2%
         );
         
         // further sanity check with hand-calculated values, so I can remove
         // the floating point stuff in the main code
-        BYTES_EQUAL(bit_periods[br_ind] - PCINT_STARTUP_DELAY, virtualOCR0A);
+        BYTES_EQUAL(bit_periods[br_ind] - startup_delay - 1, virtualOCR0A);
     }
 }
 
+#ifndef USI_SERIAL_FIXED_FORMAT
 TEST(USISerialRXTests, HandleByteReceivedPlusParityBit) {
     ISR_PCINT0_vect();
     
@@ -222,8 +238,8 @@ TEST(USISerialRXTests, HandleByteReceivedPlusParityBit) {
     
     ISR_TIMER0_COMPA_vect();
     
-    // parameterize prescale if necessary
-    BYTES_EQUAL((uint8_t)(F_CPU/_BAUD_RATE/8), virtualOCR0A);
+    // parameterize prescale if necessary; timer0 matches every OCR0A+1 ticks
+    BYTES_EQUAL((uint8_t)(F_CPU/_BAUD_RATE/8) - 1, virtualOCR0A);
     BYTES_EQUAL(B11101111, virtualTIMSK); // OCR0A compare interrupt disabled
     
     // assume USI is configured correctly and has received 8 bits, in reverse
@@ -234,29 +250,34 @@ TEST(USISerialRXTests, HandleByteReceivedPlusParityBit) {
     virtualPCMSK = 0;
     ISR_USI_OVF_vect();
     
-    BYTES_EQUAL(1, brs_get_invocation_count());
-    BYTES_EQUAL('a', brs_get_received_byte());
+    // not until the frame's been checked
+    BYTES_EQUAL(0, brs_get_invocation_count());
     
-    // ----- check config for/before "consuming" parity bit
+    // ----- check config for/before "consuming" parity and stop bits
     BYTES_EQUAL(0xff, virtualTCCR0B); // no change, yet
     BYTES_EQUAL(0,    virtualPCMSK); // no change, yet
     
     // clear USI status interrupt flags; don't care about bit 4 (USIDC)
     BYTES_EQUAL(0x0f, virtualUSISR >> 4); 
-    BYTES_EQUAL(15,   0x0f & virtualUSISR);  // just one bit left to consume
+    BYTES_EQUAL(14,   0x0f & virtualUSISR);  // parity and stop bits to consume
     
+    // parity bit; odd number of 1s in 'a'.  Stop bit.
+    virtualUSIBR = B00011011;
     ISR_USI_OVF_vect();
     
-    BYTES_EQUAL(1, brs_get_invocation_count()); // still called just once
+    BYTES_EQUAL(1, brs_get_invocation_count());
+    BYTES_EQUAL('a', brs_get_received_byte());
+    BYTES_EQUAL(0, brs_get_received_status());
     
     BYTES_EQUAL(B11111000, virtualTCCR0B); // timer0 prescaler cleared
     BYTES_EQUAL(0,         virtualUSICR); // USI disabled
     BYTES_EQUAL(B00000001, virtualPCMSK); // PCINT0 re-enabled
     // @todo confirm other register settings
 }
+#endif
 
 TEST(USISerialRXTests, HandleByteReceivedNoParity) {
-    usi_serial_init(&usiRegs, &brs_receive_byte, BAUD_9600, false);
+    usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format8N1);
     
     // signal start bit has … uh … started
     ISR_PCINT0_vect();
@@ -268,8 +289,8 @@ TEST(USISerialRXTests, HandleByteReceivedNoParity) {
     
     ISR_TIMER0_COMPA_vect();
     
-    // parameterize prescale if necessary
-    BYTES_EQUAL((uint8_t)(F_CPU/_BAUD_RATE/8), virtualOCR0A);
+    // parameterize prescale if necessary; timer0 matches every OCR0A+1 ticks
+    BYTES_EQUAL((uint8_t)(F_CPU/_BAUD_RATE/8) - 1, virtualOCR0A);
     BYTES_EQUAL(B11101111, virtualTIMSK); // OCR0A compare interrupt disabled
     
     // assume USI is configured correctly and has received 8 bits, in reverse
@@ -280,8 +301,16 @@ TEST(USISerialRXTests, HandleByteReceivedNoParity) {
     virtualPCMSK = 0;
     ISR_USI_OVF_vect();
     
+    BYTES_EQUAL(0, brs_get_invocation_count());
+    BYTES_EQUAL(15, 0x0f & virtualUSISR); // just the stop bit to consume
+    
+    // stop bit
+    virtualUSIBR = B00001101;
+    ISR_USI_OVF_vect();
+    
     BYTES_EQUAL(1, brs_get_invocation_count());
     BYTES_EQUAL('a', brs_get_received_byte());
+    BYTES_EQUAL(0, brs_get_received_status());
     
     // ----- check config; no parity bit. timer and USI should be disabled
     BYTES_EQUAL(B11111000, virtualTCCR0B); // timer0 prescaler cleared
@@ -289,3 +318,156 @@ TEST(USISerialRXTests, HandleByteReceivedNoParity) {
     BYTES_EQUAL(B00000001, virtualPCMSK); // PCINT0 re-enabled
     // @todo confirm other register settings
 }
+
+#ifndef USI_SERIAL_FIXED_FORMAT
+TEST(USISerialRXTests, ParityError) {
+    ISR_PCINT0_vect();
+    ISR_TIMER0_COMPA_vect();
+    
+    virtualUSIBR = B10000110; // 'a' reversed
+    ISR_USI_OVF_vect();
+    
+    // parity bit should be 1; stop bit
+    virtualUSIBR = B00011001;
+    ISR_USI_OVF_vect();
+    
+    // passed on anyway, flagged
+    BYTES_EQUAL(1, brs_get_invocation_count());
+    BYTES_EQUAL('a', brs_get_received_byte());
+    BYTES_EQUAL(USI_SERIAL_RX_PARITY_ERROR, brs_get_received_status());
+    
+    LONGS_EQUAL(1, usi_rx_parity_error_count(&port));
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+    
+    // ready for the next start bit
+    BYTES_EQUAL(0,         virtualUSICR); // USI disabled
+    BYTES_EQUAL(B00000001, virtualPCMSK); // PCINT0 re-enabled
+}
+
+TEST(USISerialRXTests, FramingError) {
+    ISR_PCINT0_vect();
+    ISR_TIMER0_COMPA_vect();
+    
+    virtualUSIBR = B10000110; // 'a' reversed
+    ISR_USI_OVF_vect();
+    
+    // parity bit; no stop bit
+    virtualUSIBR = B00011010;
+    ISR_USI_OVF_vect();
+    
+    BYTES_EQUAL(1, brs_get_invocation_count());
+    BYTES_EQUAL(USI_SERIAL_RX_FRAMING_ERROR, brs_get_received_status());
+    
+    LONGS_EQUAL(0, usi_rx_parity_error_count(&port));
+    LONGS_EQUAL(1, usi_rx_framing_error_count(&port));
+    
+    // and both
+    ISR_PCINT0_vect();
+    ISR_TIMER0_COMPA_vect();
+    
+    virtualUSIBR = B10000110;
+    ISR_USI_OVF_vect();
+    
+    virtualUSIBR = B00000000;
+    ISR_USI_OVF_vect();
+    
+    BYTES_EQUAL(
+        USI_SERIAL_RX_PARITY_ERROR | USI_SERIAL_RX_FRAMING_ERROR,
+        brs_get_received_status()
+    );
+    
+    LONGS_EQUAL(1, usi_rx_parity_error_count(&port));
+    LONGS_EQUAL(2, usi_rx_framing_error_count(&port));
+    
+    usi_rx_reset_error_counts(&port);
+    
+    LONGS_EQUAL(0, usi_rx_parity_error_count(&port));
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+}
+
+TEST(USISerialRXTests, ParityChecksOnlyDataBits) {
+    static const USISerialFrameFormat format7O1 = USI_SERIAL_FRAME_FORMAT(7, ODD, 1);
+    
+    usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format7O1);
+    
+    ISR_PCINT0_vect();
+    ISR_TIMER0_COMPA_vect();
+    
+    // 'a' reversed, in the 7 bits shifted in; the MSB was shifted in before
+    // the start bit and isn't data
+    virtualUSIBR = B11000011;
+    ISR_USI_OVF_vect();
+    
+    // parity bit; odd parity, odd number of 1s in 'a'.  Stop bit.
+    virtualUSIBR = B00000001;
+    ISR_USI_OVF_vect();
+    
+    BYTES_EQUAL('a', brs_get_received_byte());
+    BYTES_EQUAL(0, brs_get_received_status());
+}
+#endif
+
+// ----- frames ending while the handler's still running
+
+static uint8_t handler_depth;
+static uint8_t max_handler_depth;
+static uint8_t handled[4];
+static uint8_t handled_count;
+
+// the whole of an 8N1 frame, reversed data bits first
+static void receive_frame(const uint8_t reversed) {
+    ISR_PCINT0_vect();
+    ISR_TIMER0_COMPA_vect();
+    
+    virtualUSIBR = reversed;
+    ISR_USI_OVF_vect();
+    
+    virtualUSIBR = B00001101; // stop bit
+    ISR_USI_OVF_vect();
+}
+
+static void slow_receive_byte(uint8_t b, uint8_t status) {
+    handler_depth += 1;
+    
+    if (handler_depth > max_handler_depth) {
+        max_handler_depth = handler_depth;
+    }
+    
+    if (handled_count < sizeof(handled)) {
+        handled[handled_count] = b;
+    }
+    
+    handled_count += 1;
+    
+    if (handled_count == 1) {
+        // two more arrive before this one's been dealt with; the second
+        // has nowhere to wait
+        receive_frame(B01000110); // 'b' reversed
+        receive_frame(B11000110); // 'c' reversed
+    }
+    
+    handler_depth -= 1;
+}
+
+TEST(USISerialRXTests, FramesEndingInHandlerDeliveredInTurn) {
+    handler_depth = 0;
+    max_handler_depth = 0;
+    handled_count = 0;
+    
+    usi_serial_init(&port, &usiRegs, &slow_receive_byte, BAUD_9600, &format8N1);
+    
+    receive_frame(B10000110); // 'a' reversed
+    
+    LONGS_EQUAL(1, max_handler_depth);
+    LONGS_EQUAL(2, handled_count);
+    BYTES_EQUAL('a', handled[0]);
+    BYTES_EQUAL('b', handled[1]);
+    LONGS_EQUAL(1, usi_rx_overrun_count(&port));
+    
+    // and the next goes straight through
+    receive_frame(B00100110); // 'd' reversed
+    
+    LONGS_EQUAL(3, handled_count);
+    BYTES_EQUAL('d', handled[2]);
+    BYTES_EQUAL(B00000001, virtualPCMSK); // PCINT0 re-enabled
+}
@@ -0,0 +1,164 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * Sleeping between frames, on the line simulator.  The main loop drains the
+ * receive buffer and goes back to sleep, as an application's would.
+ */
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+static const BaudRate rates[] = { BAUD_4800, BAUD_19200, BAUD_38400 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static USISerialPort port;
+
+static uint8_t received[64];
+static uint8_t received_count;
+
+static void drain_rx_and_sleep(void) {
+    received_count += usi_rx_read_block(
+        &port,
+        received + received_count,
+        sizeof(received) - received_count
+    );
+
+    usi_serial_sleep(&port);
+}
+
+static void init_sim(const BaudRate baud_rate, const uint8_t gap_bits) {
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, baud_rate);
+    cfg.gap_bits = gap_bits;
+
+    lsim_init_usi_port(&port, &cfg, NULL, baud_rate, &format8N1);
+    lsim_set_main_loop(&drain_rx_and_sleep);
+
+    received_count = 0;
+}
+
+TEST_GROUP(USISerialSleepTests) {
+    void setup() {
+        received_count = 0;
+    }
+};
+
+TEST(USISerialSleepTests, PowersDownWhileIdle) {
+    const uint16_t power_downs = usi_serial_power_down_sleep_entries();
+
+    init_sim(BAUD_9600, 0);
+    lsim_run(10000);
+
+    // from the main loop's first call on
+    CHECK(lsim_stats()->sleep_cycles >= (10000 - 2 * 16));
+    LONGS_EQUAL(lsim_stats()->sleep_cycles, lsim_stats()->power_down_cycles);
+
+    LONGS_EQUAL(1, (uint16_t) (usi_serial_power_down_sleep_entries() - power_downs));
+    BYTES_EQUAL(0, virtualMCUCR & _BV(SE));
+}
+
+TEST(USISerialSleepTests, WakesOnStartBit) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        const uint16_t idle_sleeps = usi_serial_idle_sleep_entries();
+
+        // a character's idle line between frames
+        init_sim(rates[i], 10);
+
+        lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], strlen(message), 20)));
+
+        LONGS_EQUAL(strlen(message), received_count);
+        CHECK(memcmp(message, received, strlen(message)) == 0);
+        LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+        CHECK(lsim_line_stats(LSIM_USI_LINE)->max_sample_offset < 0.1);
+
+        // idle between each frame's bits, and powered down for most of the
+        // gaps between them
+        CHECK((uint16_t) (usi_serial_idle_sleep_entries() - idle_sleeps) >= strlen(message));
+        CHECK(lsim_stats()->power_down_cycles >
+              (strlen(message) * 8UL * (F_CPU / rates[i])));
+
+        LONGS_EQUAL(10 * strlen(message), usi_serial_active_bits(&port));
+    }
+}
+
+TEST(USISerialSleepTests, IdlesWhileTransmitting) {
+    init_sim(BAUD_19200, 0);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        CHECK(usi_tx_enqueue(&port, message[i]));
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 20)));
+
+    LONGS_EQUAL(10, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    CHECK(memcmp(message, received, 10) == 0);
+    LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+
+    LONGS_EQUAL(100, usi_serial_active_bits(&port));
+}
+
+TEST(USISerialSleepTests, IdlesInFullDuplex) {
+    init_sim(BAUD_19200, 0);
+    CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+
+    for (uint8_t i = 0; i < 10; i++) {
+        CHECK(usi_tx_enqueue(&port, message[i]));
+    }
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, strlen(message), 20)));
+
+    LONGS_EQUAL(strlen(message), received_count);
+    CHECK(memcmp(message, received, strlen(message)) == 0);
+    LONGS_EQUAL(10, lsim_remote_read(LSIM_USI_LINE, received, sizeof(received)));
+    CHECK(memcmp(message, received, 10) == 0);
+
+    LONGS_EQUAL(10 * (strlen(message) + 10), usi_serial_active_bits(&port));
+}
+
+TEST(USISerialSleepTests, PowersDownUntilSyncCharacter) {
+    const uint8_t sync = USI_SERIAL_AUTO_BAUD_SYNC;
+
+    init_sim(BAUD_38400, 0);
+    usi_serial_start_auto_baud(&port);
+
+    lsim_run(10000);
+    LONGS_EQUAL(lsim_stats()->sleep_cycles, lsim_stats()->power_down_cycles);
+
+    // timer0 times the sync character's edges, so it's clocked from the
+    // first on
+    lsim_remote_send(LSIM_USI_LINE, &sync, 1);
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_38400, strlen(message), 20)));
+
+    LONGS_EQUAL(BAUD_38400, usi_serial_baud_rate(&port));
+    LONGS_EQUAL(strlen(message), received_count);
+    CHECK(memcmp(message, received, strlen(message)) == 0);
+}
+
+TEST(USISerialSleepTests, ActiveBitsResetByInit) {
+    init_sim(BAUD_9600, 0);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) "a", 1);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 20)));
+    LONGS_EQUAL(10, usi_serial_active_bits(&port));
+
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_9600, &format8N1);
+    LONGS_EQUAL(0, usi_serial_active_bits(&port));
+}
@@ -0,0 +1,284 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * The driver's counters, on the line simulator.  The test itself stands in
+ * for the application where it calls usi_tx_byte(), so its waits are
+ * simulated.
+ */
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+static const USISerialFrameFormat format8E1 = USI_SERIAL_FRAME_FORMAT(8, EVEN, 1);
+
+static USISerialPort port;
+static USISerialStats stats;
+
+#ifdef USI_SERIAL_TIMESTAMPS
+static uint8_t message_buf[64];
+
+// a clock the handlers wind on, to time them by
+static USISerialTimestamp fake_time;
+
+static USISerialTimestamp fake_clock(void) {
+    return fake_time;
+}
+
+// takes 500 ticks over a 'q', 10 over anything else
+static void receive_byte(uint8_t b, uint8_t status) {
+    fake_time += (b == 'q') ? 500 : 10;
+}
+
+static void receive_message(uint8_t *m, uint8_t len, uint8_t status) {
+    fake_time += 700;
+}
+#endif
+
+static void init_sim(const USISerialFrameFormat *remote_format,
+                     void (*handler)(uint8_t, uint8_t))
+{
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, BAUD_19200);
+    cfg.format = *remote_format;
+    lsim_init_usi_port(&port, &cfg, handler, BAUD_19200, &format8N1);
+}
+
+TEST_GROUP(USISerialStatsTests) {
+    void setup() {
+        #ifdef USI_SERIAL_TIMESTAMPS
+        fake_time = 0;
+        #endif
+        memset(&stats, 0xff, sizeof(stats));
+    }
+};
+
+TEST(USISerialStatsTests, ZeroAfterInit) {
+    init_sim(&format8N1, NULL);
+
+    usi_serial_read_stats(&port, &stats);
+
+    LONGS_EQUAL(0, stats.rx_frames);
+    LONGS_EQUAL(0, stats.tx_frames);
+    LONGS_EQUAL(0, stats.tx_sleep_entries);
+    LONGS_EQUAL(0, stats.tx_held_by_rx);
+    LONGS_EQUAL(0, stats.rx_missed);
+    LONGS_EQUAL(0, stats.rx_overruns);
+    LONGS_EQUAL(0, stats.rx_parity_errors);
+    LONGS_EQUAL(0, stats.rx_framing_errors);
+    #ifdef USI_SERIAL_TIMESTAMPS
+    LONGS_EQUAL(0, stats.max_handler_time);
+    #endif
+}
+
+TEST(USISerialStatsTests, FramesCounted) {
+    init_sim(&format8N1, NULL);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 10);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 12, 11)));
+
+    for (uint8_t i = 0; i < 5; i++) {
+        CHECK(usi_tx_enqueue(&port, message[i]));
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 7, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+
+    LONGS_EQUAL(10, stats.rx_frames);
+    LONGS_EQUAL(5, stats.tx_frames);
+    LONGS_EQUAL(0, stats.tx_held_by_rx);
+    LONGS_EQUAL(0, stats.rx_missed);
+    LONGS_EQUAL(0, stats.rx_parity_errors);
+}
+
+#ifndef USI_SERIAL_FIXED_FORMAT
+TEST(USISerialStatsTests, ParityErrorsCounted) {
+    static const USISerialFrameFormat format8O1 = USI_SERIAL_FRAME_FORMAT(8, ODD, 1);
+
+    init_sim(&format8E1, NULL);
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_19200, &format8O1);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 10);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 12, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+
+    LONGS_EQUAL(10, stats.rx_frames);
+    LONGS_EQUAL(10, stats.rx_parity_errors);
+    LONGS_EQUAL(0, stats.rx_framing_errors);
+}
+#endif
+
+TEST(USISerialStatsTests, TXHeldByRX) {
+    init_sim(&format8N1, NULL);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 1);
+
+    // part way into the frame
+    lsim_run(5 * (F_CPU / BAUD_19200));
+
+    CHECK(usi_tx_enqueue(&port, 'x'));
+    CHECK(usi_tx_enqueue(&port, 'y'));
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 8, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+
+    LONGS_EQUAL(2, stats.tx_held_by_rx);
+    LONGS_EQUAL(1, stats.rx_frames);
+    LONGS_EQUAL(2, stats.tx_frames);
+    LONGS_EQUAL(2, lsim_line_stats(LSIM_USI_LINE)->frames_received);
+}
+
+TEST(USISerialStatsTests, RXMissedWhileSending) {
+    static const uint8_t zeros[2] = { 0, 0 };
+
+    init_sim(&format8N1, NULL);
+
+    CHECK(usi_tx_enqueue(&port, 'x'));
+
+    // starting while the driver's transmitting, with the RX PCINT off, and
+    // still in the second frame's low data bits when it's done
+    lsim_remote_send(LSIM_USI_LINE, zeros, sizeof(zeros));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 6, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+
+    LONGS_EQUAL(1, stats.tx_frames);
+    LONGS_EQUAL(1, stats.rx_missed);
+}
+
+TEST(USISerialStatsTests, RXNotMissedInFullDuplex) {
+    static const uint8_t zeros[2] = { 0, 0 };
+
+    init_sim(&format8N1, NULL);
+    CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+
+    CHECK(usi_tx_enqueue(&port, 'x'));
+
+    lsim_remote_send(LSIM_USI_LINE, zeros, sizeof(zeros));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 6, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+
+    LONGS_EQUAL(1, stats.tx_frames);
+    LONGS_EQUAL(2, stats.rx_frames);
+    LONGS_EQUAL(0, stats.rx_missed);
+    LONGS_EQUAL(0, stats.tx_held_by_rx);
+}
+
+TEST(USISerialStatsTests, TXSleepEntriesCounted) {
+    init_sim(&format8N1, NULL);
+
+    // fits in the queue
+    for (uint8_t i = 0; i < USI_SERIAL_TX_BUFFER_SIZE; i++) {
+        usi_tx_byte(&port, message[i]);
+    }
+
+    usi_serial_read_stats(&port, &stats);
+    LONGS_EQUAL(0, stats.tx_sleep_entries);
+
+    // and each one beyond waits for a frame to finish
+    for (uint8_t i = 0; i < 5; i++) {
+        usi_tx_byte(&port, message[i]);
+    }
+
+    usi_serial_read_stats(&port, &stats);
+    CHECK(stats.tx_sleep_entries >= 5);
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, USI_SERIAL_TX_BUFFER_SIZE + 2, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+    LONGS_EQUAL(USI_SERIAL_TX_BUFFER_SIZE + 5, stats.tx_frames);
+}
+
+#ifdef USI_SERIAL_TIMESTAMPS
+TEST(USISerialStatsTests, MaxHandlerTimeFromByteHandler) {
+    init_sim(&format8N1, &receive_byte);
+
+    // no clock, nothing timed
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 10);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 12, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+    LONGS_EQUAL(0, stats.max_handler_time);
+
+    usi_serial_set_clock(&port, &fake_clock);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 10);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 12, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+    LONGS_EQUAL(500, stats.max_handler_time);
+    LONGS_EQUAL(20, stats.rx_frames);
+}
+
+TEST(USISerialStatsTests, MaxHandlerTimeFromMessageHandler) {
+    init_sim(&format8N1, NULL);
+    usi_serial_set_clock(&port, &fake_clock);
+    CHECK(usi_serial_set_idle_timeout(&port, 35, message_buf, sizeof(message_buf),
+                                      &receive_message));
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 10);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 12, 11) + 35 * (F_CPU / BAUD_19200)));
+
+    usi_serial_read_stats(&port, &stats);
+    LONGS_EQUAL(700, stats.max_handler_time);
+}
+#endif
+
+TEST(USISerialStatsTests, Reset) {
+    #ifdef USI_SERIAL_TIMESTAMPS
+    init_sim(&format8E1, &receive_byte);
+    usi_serial_set_clock(&port, &fake_clock);
+    #else
+    init_sim(&format8E1, NULL);
+    #endif
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 10);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 12, 11)));
+
+    for (uint8_t i = 0; i < USI_SERIAL_TX_BUFFER_SIZE + 2; i++) {
+        usi_tx_byte(&port, message[i]);
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, USI_SERIAL_TX_BUFFER_SIZE + 4, 11)));
+
+    usi_serial_read_stats(&port, &stats);
+    CHECK(stats.rx_frames != 0);
+    CHECK(stats.tx_frames != 0);
+    CHECK(stats.tx_sleep_entries != 0);
+    CHECK(stats.rx_framing_errors != 0);
+    #ifdef USI_SERIAL_TIMESTAMPS
+    CHECK(stats.max_handler_time != 0);
+    #endif
+
+    usi_serial_reset_stats(&port);
+    usi_serial_read_stats(&port, &stats);
+
+    LONGS_EQUAL(0, stats.rx_frames);
+    LONGS_EQUAL(0, stats.tx_frames);
+    LONGS_EQUAL(0, stats.tx_sleep_entries);
+    LONGS_EQUAL(0, stats.tx_held_by_rx);
+    LONGS_EQUAL(0, stats.rx_missed);
+    LONGS_EQUAL(0, stats.rx_overruns);
+    LONGS_EQUAL(0, stats.rx_parity_errors);
+    LONGS_EQUAL(0, stats.rx_framing_errors);
+    #ifdef USI_SERIAL_TIMESTAMPS
+    LONGS_EQUAL(0, stats.max_handler_time);
+    #endif
+    LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+}
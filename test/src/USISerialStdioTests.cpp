@@ -0,0 +1,197 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "usi_serial_stdio.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * The stdio stream, on the line simulator.  The test itself stands in for
+ * the application, so the blocking calls' waits are simulated.
+ */
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+static USISerialPort port;
+static USISerialStdio stream;
+static FILE *file;
+
+static uint8_t sent[512];
+
+// frames go out with an idle bit between them
+static uint32_t frame_cycles(const uint16_t frames) {
+    return frames * 11UL * ((F_CPU / BAUD_9600) + 1);
+}
+
+static void init_sim(const uint8_t flags) {
+    lsim_init_usi_port(&port, NULL, NULL, BAUD_9600, &format8N1);
+
+    file = usi_serial_stdio_open(&stream, &port, flags);
+    CHECK(file != NULL);
+}
+
+TEST_GROUP(USISerialStdioTests) {
+    void teardown() {
+        usi_serial_stdio_close(&stream);
+    }
+};
+
+TEST(USISerialStdioTests, PrintfReturnsWithoutWaiting) {
+    init_sim(0);
+
+    // fits in the transmit queue, so no time passes
+    LONGS_EQUAL(14, fprintf(file, "t=%u v=%d\r\n", 1234, -56));
+    LONGS_EQUAL(0, lsim_stats()->cycles);
+    LONGS_EQUAL(USI_SERIAL_TX_BUFFER_SIZE - 13, usi_tx_space_available(&port));
+
+    CHECK(lsim_run_until_idle(frame_cycles(16)));
+
+    LONGS_EQUAL(14, lsim_remote_read(LSIM_USI_LINE, sent, sizeof(sent)));
+    CHECK(memcmp("t=1234 v=-56\r\n", sent, 14) == 0);
+}
+
+TEST(USISerialStdioTests, WaitsForRoomInQueue) {
+    char line[100];
+
+    init_sim(0);
+
+    for (uint8_t i = 0; i < sizeof(line) - 1; i++) {
+        line[i] = 'a' + (i % 26);
+    }
+
+    line[sizeof(line) - 1] = '\0';
+
+    CHECK(fputs(line, file) >= 0);
+
+    // only the last queue's worth is left
+    CHECK(lsim_stats()->cycles > frame_cycles(sizeof(line) - 1 - USI_SERIAL_TX_BUFFER_SIZE - 2));
+    CHECK(usi_serial_idle_sleep_entries() > 0);
+
+    CHECK(lsim_run_until_idle(frame_cycles(USI_SERIAL_TX_BUFFER_SIZE + 2)));
+
+    LONGS_EQUAL(sizeof(line) - 1, lsim_remote_read(LSIM_USI_LINE, sent, sizeof(sent)));
+    CHECK(memcmp(line, sent, sizeof(line) - 1) == 0);
+    LONGS_EQUAL(0, usi_serial_stdio_dropped_count(&stream));
+}
+
+TEST(USISerialStdioTests, WritesLongBlockWhole) {
+    char block[300];
+
+    init_sim(0);
+
+    for (uint16_t i = 0; i < sizeof(block); i++) {
+        block[i] = 'a' + (i % 26);
+    }
+
+    // more than a uint8_t length's worth, in one write to the stream
+    LONGS_EQUAL(sizeof(block), fwrite(block, 1, sizeof(block), file));
+
+    CHECK(lsim_run_until_idle(frame_cycles(USI_SERIAL_TX_BUFFER_SIZE + 2)));
+
+    LONGS_EQUAL(sizeof(block), lsim_remote_read(LSIM_USI_LINE, sent, sizeof(sent)));
+    CHECK(memcmp(block, sent, sizeof(block)) == 0);
+}
+
+TEST(USISerialStdioTests, NonBlockingDropsWhenFull) {
+    init_sim(USI_SERIAL_STDIO_NONBLOCKING);
+
+    for (uint8_t i = 0; i < 4; i++) {
+        fprintf(file, "%02u:0123456789\n", i);
+    }
+
+    LONGS_EQUAL(0, lsim_stats()->cycles);
+
+    CHECK(lsim_run_until_idle(frame_cycles(64)));
+
+    const uint16_t n = lsim_remote_read(LSIM_USI_LINE, sent, sizeof(sent));
+
+    // the queue's worth, and the frame that had already started
+    LONGS_EQUAL(USI_SERIAL_TX_BUFFER_SIZE + 1, n);
+    LONGS_EQUAL(4 * 14 - n, usi_serial_stdio_dropped_count(&stream));
+    CHECK(memcmp("00:0123456789\n01:", sent, n) == 0);
+}
+
+TEST(USISerialStdioTests, ReadsReceivedCharacters) {
+    const char *input = "42 volts\n";
+    unsigned int value;
+    char unit[8];
+
+    init_sim(0);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) input, strlen(input));
+
+    // waits for each character as it arrives
+    LONGS_EQUAL(2, fscanf(file, "%u %7s", &value, unit));
+    LONGS_EQUAL(42, value);
+    STRCMP_EQUAL("volts", unit);
+    CHECK(lsim_stats()->cycles > frame_cycles(8) - frame_cycles(1));
+
+    LONGS_EQUAL('\n', fgetc(file));
+}
+
+TEST(USISerialStdioTests, ReadWaitsWithoutPoweringDown) {
+    init_sim(0);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) "ok", 2);
+
+    // the line's idle up to the start bit, but the application's timers
+    // must keep running
+    LONGS_EQUAL('o', fgetc(file));
+    LONGS_EQUAL('k', fgetc(file));
+
+    CHECK(lsim_stats()->sleep_cycles > 0);
+    LONGS_EQUAL(0, lsim_stats()->power_down_cycles);
+}
+
+TEST(USISerialStdioTests, NonBlockingReadsEOFWhenEmpty) {
+    init_sim(USI_SERIAL_STDIO_NONBLOCKING);
+
+    LONGS_EQUAL(EOF, fgetc(file));
+    CHECK(feof(file));
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) "ok", 2);
+    CHECK(lsim_run_until_idle(frame_cycles(4)));
+
+    clearerr(file);
+    LONGS_EQUAL('o', fgetc(file));
+    LONGS_EQUAL('k', fgetc(file));
+    LONGS_EQUAL(EOF, fgetc(file));
+}
+
+TEST(USISerialStdioTests, FlushAndDrain) {
+    init_sim(0);
+
+    fputs("0123456789", file);
+
+    // handed over, the last still on its way
+    usi_tx_flush(&port);
+    LONGS_EQUAL(USI_SERIAL_TX_BUFFER_SIZE, usi_tx_space_available(&port));
+    CHECK(lsim_line_stats(LSIM_USI_LINE)->frames_received < 10);
+    CHECK(virtualUSICR != 0);
+
+    // and all the way out, the TX pin holding up the last stop bit with the
+    // USI and timer0 stopped
+    usi_tx_drain(&port);
+    LONGS_EQUAL(0, virtualUSICR);
+    LONGS_EQUAL(0, virtualTCCR0B & 0x07);
+    BYTES_EQUAL(_BV(PB1), virtualPORTB & _BV(PB1));
+
+    lsim_run(F_CPU / BAUD_9600);
+    LONGS_EQUAL(10, lsim_line_stats(LSIM_USI_LINE)->frames_received);
+
+    // nothing to wait for
+    const uint32_t cycles = lsim_stats()->cycles;
+
+    usi_tx_flush(&port);
+    usi_tx_drain(&port);
+    LONGS_EQUAL(cycles, lsim_stats()->cycles);
+}
@@ -0,0 +1,341 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "8bit_binary.h"
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "ByteReceiverSpy.h"
+
+    void ISR_PCINT0_vect(void);
+    void ISR_TIMER0_COMPA_vect(void);
+    void ISR_USI_OVF_vect(void);
+}
+
+#include <stdint.h>
+#include "CppUTest/TestHarness.h"
+
+static const USISerialRegisters usiRegs = {
+    &virtualPORTB,
+    &virtualPINB,
+    &virtualDDRB,
+    &virtualUSIBR,
+    &virtualUSICR,
+    &virtualUSIDR,
+    &virtualUSISR,
+    &virtualGIFR,
+    &virtualGIMSK,
+    &virtualPCMSK,
+    &virtualTCNT0,
+    &virtualMCUCR,
+};
+
+static const Timer0Registers timer0Regs = {
+    &virtualGTCCR,
+    &virtualTCCR0A,
+    &virtualTCCR0B,
+    &virtualOCR0A,
+    &virtualTIMSK,
+    &virtualTIFR,
+    &virtualTCNT0,
+};
+
+static USISerialPort port;
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+// bits shifted out of DO, in the order they appear on the line
+static uint8_t line_bits[4096];
+static uint16_t line_bit_count;
+
+/*
+ * Plays the role of the USI hardware for one overflow period: the bits
+ * clocked out before the next overflow are bits 6..n of USIDR (bit 7 is
+ * already on the line).
+ *
+ * @return the number of bit-times until the overflow
+ */
+static uint8_t clock_usi_until_overflow() {
+    uint8_t count = 16 - (virtualUSISR & 0x0f);
+
+    for (uint8_t i = 0; i < count; i++) {
+        line_bits[line_bit_count++] = (virtualUSIDR >> (6 - i)) & 1;
+    }
+
+    ISR_USI_OVF_vect();
+
+    return count;
+}
+
+/*
+ * Runs the USI until it is disabled.
+ *
+ * @return number of overflow interrupts serviced
+ */
+static uint16_t run_usi_until_idle() {
+    uint16_t overflows = 0;
+
+    while (virtualUSICR != 0) {
+        clock_usi_until_overflow();
+        overflows += 1;
+    }
+
+    return overflows;
+}
+
+/*
+ * Transmits len bytes, topping up the queue after every overflow, the way a
+ * main loop would.
+ *
+ * @return the number of bit-times the USI was running for
+ */
+static uint16_t transmit_burst(const uint16_t len) {
+    uint16_t queued = 0;
+    uint16_t bit_times = 0;
+
+    while ((queued < len) && usi_tx_enqueue(&port, queued & 0xff)) {
+        queued += 1;
+    }
+
+    while (virtualUSICR != 0) {
+        bit_times += clock_usi_until_overflow();
+
+        while ((queued < len) && usi_tx_enqueue(&port, queued & 0xff)) {
+            queued += 1;
+        }
+    }
+
+    return bit_times;
+}
+
+// decodes 8N1 frames from line_bits; returns the number of bytes decoded
+static uint16_t decode_line(uint8_t *decoded) {
+    uint16_t count = 0;
+    uint16_t i = 0;
+
+    while (i < line_bit_count) {
+        if (line_bits[i] == 1) {
+            // idle
+            i += 1;
+            continue;
+        }
+
+        // start bit
+        uint8_t b = 0;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            b |= line_bits[i + 1 + bit] << bit;
+        }
+
+        // stop bit
+        CHECK_EQUAL(1, line_bits[i + 9]);
+
+        decoded[count++] = b;
+        i += 10;
+    }
+
+    return count;
+}
+
+TEST_GROUP(USISerialTXQueueTests) {
+    void setup() {
+        virtualPORTB = 0;
+        virtualPINB = 0xff;
+        virtualDDRB = 0xff;
+        virtualUSIBR = 0;
+        virtualUSICR = 0xff;
+        virtualUSISR = 0xff;
+        virtualGIFR = 0;
+        virtualGIMSK = 0;
+        virtualPCMSK = 0;
+
+        virtualGTCCR = 0;
+        virtualTCCR0A = 0;
+        virtualTCCR0B = 0;
+        virtualOCR0A = 0;
+        virtualTIMSK = 0;
+        virtualTIFR = 0;
+        virtualTCNT0 = 0;
+
+        line_bit_count = 0;
+
+        // init byte receiver spy
+        brs_init();
+
+        // must initialize Timer0 first
+        timer0_init(&timer0Regs, TIMER0_PRESCALE_8);
+        usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format8N1);
+    }
+};
+
+TEST(USISerialTXQueueTests, EmptyAfterInit) {
+    BYTES_EQUAL(USI_SERIAL_TX_BUFFER_SIZE, usi_tx_space_available(&port));
+}
+
+TEST(USISerialTXQueueTests, EnqueueStartsTransmission) {
+    CHECK(usi_tx_enqueue(&port, 'e'));
+
+    // byte moved straight out of the queue and into the USI
+    BYTES_EQUAL(USI_SERIAL_TX_BUFFER_SIZE, usi_tx_space_available(&port));
+
+    BYTES_EQUAL(0,         virtualPCMSK); // PCINT0 disabled
+    BYTES_EQUAL(B11111110, virtualDDRB);  // PB1 configured as output
+    BYTES_EQUAL(0xff,      virtualUSIDR); // USIDR set
+    BYTES_EQUAL(B01010100, virtualUSICR); // USI enabled
+}
+
+TEST(USISerialTXQueueTests, QueuedBytesGoOutWithoutBlocking) {
+    const char *msg = "hello, world";
+    const uint8_t len = 12;
+
+    // no ISRs fire while queueing; a blocking enqueue would never return
+    for (uint8_t i = 0; i < len; i++) {
+        CHECK(usi_tx_enqueue(&port, msg[i]));
+    }
+
+    // first byte is in flight
+    BYTES_EQUAL(USI_SERIAL_TX_BUFFER_SIZE - (len - 1), usi_tx_space_available(&port));
+
+    // 3 overflows per byte; the ISR moves from one byte to the next without
+    // shutting down the USI
+    LONGS_EQUAL(len * 3, run_usi_until_idle());
+
+    uint8_t decoded[32];
+    BYTES_EQUAL(len, decode_line(decoded));
+
+    for (uint8_t i = 0; i < len; i++) {
+        BYTES_EQUAL(msg[i], decoded[i]);
+    }
+
+    BYTES_EQUAL(USI_SERIAL_TX_BUFFER_SIZE, usi_tx_space_available(&port));
+
+    // USI shut down, back to idle
+    BYTES_EQUAL(0,         virtualUSICR); // USI disabled
+    BYTES_EQUAL(B00000001, virtualPCMSK); // PCINT0 enabled
+    BYTES_EQUAL(B11111100, virtualDDRB);  // PB1 configured as input
+}
+
+TEST(USISerialTXQueueTests, EnqueueFailsWhenFull) {
+    // first byte goes straight to the USI
+    CHECK(usi_tx_enqueue(&port, 0));
+
+    for (uint8_t i = 0; i < USI_SERIAL_TX_BUFFER_SIZE; i++) {
+        CHECK(usi_tx_enqueue(&port, i + 1));
+    }
+
+    BYTES_EQUAL(0, usi_tx_space_available(&port));
+    CHECK(! usi_tx_enqueue(&port, 0xaa));
+
+    run_usi_until_idle();
+
+    uint8_t decoded[USI_SERIAL_TX_BUFFER_SIZE + 1];
+    BYTES_EQUAL(USI_SERIAL_TX_BUFFER_SIZE + 1, decode_line(decoded));
+
+    for (uint8_t i = 0; i <= USI_SERIAL_TX_BUFFER_SIZE; i++) {
+        BYTES_EQUAL(i, decoded[i]);
+    }
+}
+
+TEST(USISerialTXQueueTests, EnqueueDuringReceiveDefersTransmission) {
+    // start bit
+    virtualPINB = B11111110;
+    ISR_PCINT0_vect();
+
+    CHECK(usi_tx_enqueue(&port, 'e'));
+
+    // still receiving; byte waits in the queue
+    BYTES_EQUAL(USI_SERIAL_TX_BUFFER_SIZE - 1, usi_tx_space_available(&port));
+    BYTES_EQUAL(B11111100, virtualDDRB); // PB1 still an input
+
+    // complete the received byte (no parity)
+    virtualUSIBR = B10000110; // 'a' reversed
+    ISR_USI_OVF_vect();
+
+    // still receiving the stop bit
+    BYTES_EQUAL(B11111100, virtualDDRB);
+
+    virtualUSIBR = B00001101;
+    ISR_USI_OVF_vect();
+
+    BYTES_EQUAL(1, brs_get_invocation_count());
+    BYTES_EQUAL('a', brs_get_received_byte());
+
+    // queued byte now transmitting
+    BYTES_EQUAL(USI_SERIAL_TX_BUFFER_SIZE, usi_tx_space_available(&port));
+    BYTES_EQUAL(B11111110, virtualDDRB);  // PB1 configured as output
+    BYTES_EQUAL(0,         virtualPCMSK); // PCINT0 disabled
+    BYTES_EQUAL(B01010100, virtualUSICR); // USI enabled
+
+    run_usi_until_idle();
+
+    uint8_t decoded[1];
+    BYTES_EQUAL(1, decode_line(decoded));
+    BYTES_EQUAL('e', decoded[0]);
+}
+
+TEST(USISerialTXQueueTests, StreamingChainsFramesWithoutIdleBit) {
+    usi_tx_set_streaming(&port, true);
+
+    CHECK(usi_tx_enqueue(&port, 'e'));
+    CHECK(usi_tx_enqueue(&port, 'g'));
+
+    // initial idle bit, then 'e'
+    clock_usi_until_overflow();
+    clock_usi_until_overflow();
+    BYTES_EQUAL(B00110111, virtualUSIDR); // second half of 'e', stop bit
+
+    // stop bit of 'e' on the line; first half of 'g' loaded immediately
+    clock_usi_until_overflow();
+    BYTES_EQUAL(B10111001, virtualUSIDR);
+    BYTES_EQUAL(B11111011, virtualUSISR); // flags cleared, overflow after 5 bits
+    BYTES_EQUAL(B01010100, virtualUSICR); // USI still running
+
+    run_usi_until_idle();
+
+    // 1 idle bit followed by 2 frames, no gap
+    LONGS_EQUAL(1 + 20, line_bit_count);
+
+    uint8_t decoded[2];
+    BYTES_EQUAL(2, decode_line(decoded));
+    BYTES_EQUAL('e', decoded[0]);
+    BYTES_EQUAL('g', decoded[1]);
+}
+
+/*
+ * Compares the time on the wire for a 256-byte burst with and without
+ * streaming.  Each 8N1 frame is 10 bit-times; without streaming every frame is
+ * preceded by an idle bit, capping throughput at 10/11 of the line rate.
+ */
+TEST(USISerialTXQueueTests, StreamingBurstHasNoIdleBitTimes) {
+    const uint16_t burst_len = 256;
+    const uint16_t frame_bits = burst_len * 10;
+
+    uint16_t bit_times = transmit_burst(burst_len);
+    uint16_t idle_bit_times = bit_times - frame_bits;
+
+    LONGS_EQUAL(burst_len, idle_bit_times);
+
+    uint8_t *decoded = new uint8_t[burst_len];
+    LONGS_EQUAL(burst_len, decode_line(decoded));
+
+    for (uint16_t i = 0; i < burst_len; i++) {
+        BYTES_EQUAL(i, decoded[i]);
+    }
+
+    // ----- and again, streaming
+    line_bit_count = 0;
+    usi_tx_set_streaming(&port, true);
+
+    bit_times = transmit_burst(burst_len);
+    idle_bit_times = bit_times - frame_bits;
+
+    // just the bit before the first start bit
+    LONGS_EQUAL(1, idle_bit_times);
+
+    LONGS_EQUAL(burst_len, decode_line(decoded));
+
+    for (uint16_t i = 0; i < burst_len; i++) {
+        BYTES_EQUAL(i, decoded[i]);
+    }
+
+    delete [] decoded;
+}
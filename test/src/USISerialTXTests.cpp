@@ -29,6 +29,8 @@ static const USISerialRegisters usiRegs = {
     &virtualGIFR,
     &virtualGIMSK,
     &virtualPCMSK,
+    &virtualTCNT0,
+    &virtualMCUCR,
 };
 
 static const Timer0Registers timer0Regs = {
@@ -41,6 +43,12 @@ static const Timer0Registers timer0Regs = {
     &virtualTCNT0,
 };
 
+static USISerialPort port;
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+static const USISerialFrameFormat format8E1 = USI_SERIAL_FRAME_FORMAT(8, EVEN, 1);
+static const USISerialFrameFormat format7O2 = USI_SERIAL_FRAME_FORMAT(7, ODD, 2);
+
 TEST_GROUP(USISerialTXTests) {
     void setup() {
         virtualPORTB = 0;
@@ -65,7 +73,7 @@ TEST_GROUP(USISerialTXTests) {
         
         // must initialize Timer0 first
         timer0_init(&timer0Regs, TIMER0_PRESCALE_8);
-        usi_serial_init(&usiRegs, &brs_receive_byte, BAUD_9600, false);
+        usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format8N1);
     }
 };
 
@@ -103,7 +111,7 @@ TEST(USISerialTXTests, TransmitByte) {
     // 'e'
     //           B01100101, 101, 0x65
     // reversed: B10100110, 166, 0xA6
-    CHECK_EQUAL(0, usi_tx_byte('e'));
+    CHECK_EQUAL(0, usi_tx_byte(&port, 'e'));
     
     BYTES_EQUAL(B11111110, virtualPCMSK); // PCINT0 disabled
     BYTES_EQUAL(B00000010, virtualDDRB);  // PB1 configured as output
@@ -115,8 +123,9 @@ TEST(USISerialTXTests, TransmitByte) {
     
     BYTES_EQUAL(0,         virtualTCNT0); // timer0 cleared
     
-    // check Timer0 configured to compare with OCR0A at the bit period
-    DOUBLES_EQUAL(bit_period, virtualOCR0A, bit_period*0.02 /* 2% */);
+    // check Timer0 configured to compare with OCR0A at the bit period; timer0
+    // matches every OCR0A+1 ticks
+    DOUBLES_EQUAL(bit_period, virtualOCR0A + 1, bit_period*0.02 /* 2% */);
     
     BYTES_EQUAL(0, virtualGTCCR >> 7); // confirm timer0 started
     
@@ -165,13 +174,14 @@ TEST(USISerialTXTests, TransmitByte) {
     BYTES_EQUAL(B00000010, virtualPORTB); // PB1 internal pull-up enabled
 }
 
+#ifndef USI_SERIAL_FIXED_FORMAT
 TEST(USISerialTXTests, TransmitByteWithParity) {
-    usi_serial_init(&usiRegs, &brs_receive_byte, BAUD_9600, true);
+    usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format8E1);
     
     // 'e'
     //           B01100101, 101, 0x65
     // reversed: B10100110, 166, 0xA6
-    CHECK_EQUAL(0, usi_tx_byte('e'));
+    CHECK_EQUAL(0, usi_tx_byte(&port, 'e'));
     
     // -- ok, now the first timer tick and overflow; first half-frame
     virtualUSIDR = 0;
@@ -220,12 +230,12 @@ TEST(USISerialTXTests, TransmitByteWithParity) {
 }
 
 TEST(USISerialTXTests, TransmitByteWithParityOddOnes) {
-    usi_serial_init(&usiRegs, &brs_receive_byte, BAUD_9600, true);
+    usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format8E1);
     
     // 'g'
     //           B01100111, 103, 0x67
     // reversed: B11100110, 230, 0xE6
-    CHECK_EQUAL(0, usi_tx_byte('g'));
+    CHECK_EQUAL(0, usi_tx_byte(&port, 'g'));
     
     // -- ok, now the first timer tick and overflow; first half-frame
     virtualUSIDR = 0;
@@ -272,3 +282,43 @@ TEST(USISerialTXTests, TransmitByteWithParityOddOnes) {
     BYTES_EQUAL(B11111101, virtualDDRB);  // PB1 configured as input
     BYTES_EQUAL(B00000010, virtualPORTB); // PB1 internal pull-up enabled
 }
+
+TEST(USISerialTXTests, TransmitByteSevenDataBitsOddParityTwoStopBits) {
+    usi_serial_init(&port, &usiRegs, &brs_receive_byte, BAUD_9600, &format7O2);
+    
+    // 'g' with the MSB set, which is dropped
+    //           B1100111, 103, 0x67
+    // reversed: B11100110, 230, 0xE6
+    CHECK_EQUAL(0, usi_tx_byte(&port, 'g' | 0x80));
+    
+    // -- first half-frame
+    virtualUSIDR = 0;
+    virtualUSISR = 0;
+
+    ISR_USI_OVF_vect();
+    
+    // USIDR should have:
+    //  1 (line idling high)
+    //  0 (start bit)
+    //  111001 (bits 0..5 of the letter 'g')
+    BYTES_EQUAL(B10111001, virtualUSIDR);
+    
+    BYTES_EQUAL(B11111011, virtualUSISR); // flags cleared, overflow after 5 bits
+    
+    // -- 2nd half-frame
+    virtualUSIDR = 0;
+    virtualUSISR = 0;
+    
+    ISR_USI_OVF_vect();
+    
+    // USIDR should have:
+    //  0011 (bits 3..6 of the letter 'g')
+    //  0 (parity bit; odd number of 1s in 'g')
+    //  11 (stop bits)
+    //  1 (padding)
+    BYTES_EQUAL(B00110111, virtualUSIDR);
+    
+    // the overflow comes as the second stop bit goes on the line
+    BYTES_EQUAL(B11111010, virtualUSISR); // flags cleared, overflow after 6 bits
+}
+#endif
@@ -0,0 +1,239 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * A USI-backed port with its bits clocked by timer1, on the line simulator,
+ * leaving timer0 to an application that's using it for something else.
+ */
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+static const BaudRate rates[] = { BAUD_9600, BAUD_19200, BAUD_28800, BAUD_38400 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// the application's use of timer0: running at prescale 64, without its
+// compare interrupt
+#define APP_OCR0A 123
+
+static USISerialPort port;
+static uint8_t app_tccr0b;
+
+static uint8_t message_buf[64];
+
+static uint8_t received[64];
+static uint8_t received_count;
+
+static void receive_byte(uint8_t b, uint8_t status) {
+    if (received_count < sizeof(received)) {
+        received[received_count++] = b;
+    }
+}
+
+static void init_sim(const BaudRate baud_rate) {
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, baud_rate);
+    lsim_init(&cfg);
+
+    timer0_init(&lsim_timer0_regs, TIMER0_PRESCALE_64);
+    timer0_set_ocra(APP_OCR0A);
+    timer0_start();
+    app_tccr0b = virtualTCCR0B;
+
+    CHECK(usi_serial_init_timer1(&port, &lsim_usi_regs, &lsim_timer1_regs, &receive_byte,
+                                 baud_rate, &format8N1));
+
+    received_count = 0;
+}
+
+static void check_timer0_untouched(void) {
+    BYTES_EQUAL(app_tccr0b, virtualTCCR0B);
+    BYTES_EQUAL(APP_OCR0A, virtualOCR0A);
+    BYTES_EQUAL(0, virtualTIMSK & _BV(OCIE0A));
+    BYTES_EQUAL(0, virtualUSICR & (_BV(USICS1) | _BV(USICS0)));
+}
+
+TEST_GROUP(USISerialTimer1ClockTests) {
+};
+
+TEST(USISerialTimer1ClockTests, ReceivesAtEachRate) {
+    const uint8_t len = strlen(message);
+
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i]);
+
+        lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, len);
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], len, 10)));
+
+        LONGS_EQUAL(len, received_count);
+        CHECK(memcmp(message, received, len) == 0);
+        LONGS_EQUAL(0, usi_rx_framing_error_count(&port));
+
+        // every sample within a quarter of a bit of the middle
+        CHECK(lsim_line_stats(LSIM_USI_LINE)->max_sample_offset < 0.25);
+
+        check_timer0_untouched();
+    }
+}
+
+TEST(USISerialTimer1ClockTests, TransmitsAtEachRate) {
+    const uint8_t len = 20;
+    uint8_t sent[20];
+
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i]);
+
+        for (uint8_t j = 0; j < len; j++) {
+            usi_tx_byte(&port, message[j]);
+            lsim_run(10 * (F_CPU / rates[i]));
+        }
+
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], len, 10)));
+
+        LONGS_EQUAL(len, lsim_remote_read(LSIM_USI_LINE, sent, sizeof(sent)));
+        CHECK(memcmp(message, sent, len) == 0);
+        LONGS_EQUAL(0, lsim_line_stats(LSIM_USI_LINE)->framing_errors);
+
+        check_timer0_untouched();
+    }
+}
+
+TEST(USISerialTimer1ClockTests, FinerPrescalerThanTimer0) {
+    init_sim(BAUD_19200);
+
+    CHECK(usi_tx_enqueue(&port, 'x'));
+    lsim_run(F_CPU / BAUD_19200);
+
+    // 416.7 cycles a bit: 104 ticks at prescale 4, not 52 at timer0's 8
+    BYTES_EQUAL(USI_SERIAL_TIMER1_CLOCK_SELECT(19200) - 1, virtualTCCR1 & 0x0f);
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 1, 10)));
+    LONGS_EQUAL(0, virtualTCCR1 & 0x0f);
+}
+
+TEST(USISerialTimer1ClockTests, CloserThanTimer0WhenUndithered) {
+    double timer0_offset;
+
+    // 104.17 ticks a bit at prescale 8: timer0 rounds it to 104
+    CHECK(! USI_SERIAL_DITHERED(9600));
+
+    lsim_init_usi_port(&port, NULL, NULL, BAUD_9600, &format8N1);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 10)));
+    timer0_offset = lsim_line_stats(LSIM_USI_LINE)->max_sample_offset;
+
+    init_sim(BAUD_9600);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, strlen(message));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, strlen(message), 10)));
+    LONGS_EQUAL(strlen(message), received_count);
+
+    CHECK(lsim_line_stats(LSIM_USI_LINE)->max_sample_offset < timer0_offset);
+}
+
+TEST(USISerialTimer1ClockTests, TimerZeroFeaturesRefused) {
+    init_sim(BAUD_19200);
+
+    CHECK(! usi_serial_set_idle_timeout(&port, 35, message_buf, sizeof(message_buf), NULL));
+
+    usi_serial_start_auto_baud(&port);
+    LONGS_EQUAL(BAUD_19200, usi_serial_baud_rate(&port));
+
+    usi_serial_calibrate(&port);
+    CHECK(! usi_serial_calibrating(&port));
+
+    // still half duplex, on timer1
+    CHECK(! usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 5);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 5, 10)));
+    LONGS_EQUAL(5, received_count);
+
+    check_timer0_untouched();
+}
+
+TEST(USISerialTimer1ClockTests, InitReturnsToTimer0) {
+    init_sim(BAUD_19200);
+
+    timer0_init(&lsim_timer0_regs, USI_SERIAL_TIMER0_PRESCALE(BAUD_19200));
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_19200, &format8N1);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 5);
+    lsim_run(5 * (F_CPU / BAUD_19200));
+
+    // mid-frame, on timer0
+    LONGS_EQUAL(0, virtualTCCR1 & 0x0f);
+    CHECK((virtualTCCR0B & 0x07) != 0);
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 5, 10)));
+    LONGS_EQUAL(5, usi_rx_available(&port));
+}
+
+TEST(USISerialTimer1ClockTests, BitBangedPortRefused) {
+    static USISerialPort soft;
+
+    init_sim(BAUD_19200);
+
+    CHECK(! usi_serial_init_bit_banged(&soft, &lsim_usi_regs, &lsim_timer1_regs, PB3, PB4,
+                                       NULL, BAUD_19200, &format8N1));
+    BYTES_EQUAL(0, virtualPCMSK & (_BV(PB3) | _BV(PB4)));
+
+    // still on timer1, both ways
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 5);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 5, 10)));
+    LONGS_EQUAL(5, received_count);
+
+    CHECK(usi_tx_enqueue(&port, 'x'));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 1, 10)));
+    LONGS_EQUAL(1, lsim_line_stats(LSIM_USI_LINE)->frames_received);
+
+    check_timer0_untouched();
+}
+
+TEST(USISerialTimer1ClockTests, RefusedWhileBitBangedPortHasTimer1) {
+    static USISerialPort soft;
+
+    lsim_init_usi_port(&port, NULL, NULL, BAUD_19200, &format8N1);
+    CHECK(usi_serial_init_bit_banged(&soft, &lsim_usi_regs, &lsim_timer1_regs, PB3, PB4,
+                                     NULL, BAUD_9600, &format8N1));
+
+    CHECK(! usi_serial_init_timer1(&port, &lsim_usi_regs, &lsim_timer1_regs, &receive_byte,
+                                   BAUD_19200, &format8N1));
+
+    // both still as they were: the USI port on timer0, the other on timer1
+    CHECK(usi_tx_enqueue(&port, 'x'));
+    CHECK(usi_tx_enqueue(&soft, 'y'));
+    lsim_run(F_CPU / BAUD_9600);
+
+    CHECK((virtualTCCR0B & 0x07) != 0);
+    CHECK((virtualTCCR1 & 0x0f) != 0);
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_9600, 1, 10)));
+    LONGS_EQUAL(1, lsim_line_stats(LSIM_USI_LINE)->frames_received);
+
+    // closed, it's timer1's no longer
+    usi_serial_close_bit_banged(&soft);
+    BYTES_EQUAL(0, virtualPCMSK & _BV(PB3));
+
+    CHECK(usi_serial_init_timer1(&port, &lsim_usi_regs, &lsim_timer1_regs, &receive_byte,
+                                 BAUD_19200, &format8N1));
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 5);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 5, 10)));
+    LONGS_EQUAL(5, received_count);
+}
@@ -0,0 +1,248 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * Frame timestamps, on the line simulator, with the simulated cycle count as
+ * the clock: each received frame's should follow the last by a frame's
+ * worth of cycles, to within the simulator's cycle, and each sent one's to
+ * within the timer ticks the bit clock's dithered by.
+ *
+ * Left out when the tests are built with TIMESTAMPS=N.
+ */
+
+#ifdef USI_SERIAL_TIMESTAMPS
+
+static const char *message = "The quick brown fox jumps over the lazy dog";
+
+static const USISerialFrameFormat format8N1 = USI_SERIAL_FRAME_FORMAT(8, NONE, 1);
+
+static const BaudRate rates[] = { BAUD_9600, BAUD_19200, BAUD_28800, BAUD_38400 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+#define BURST_LEN 40
+
+static USISerialPort port;
+
+static uint8_t received[BURST_LEN];
+static USISerialTimestamp times[BURST_LEN];
+static uint8_t received_count;
+
+static uint8_t message_buf[64];
+static USISerialTimestamp message_time;
+
+static USISerialTimestamp sim_clock(void) {
+    return lsim_stats()->cycles;
+}
+
+static void receive_byte(uint8_t b, uint8_t status) {
+    if (received_count < BURST_LEN) {
+        times[received_count] = usi_serial_rx_timestamp(&port);
+        received[received_count++] = b;
+    }
+}
+
+static void read_buffer(void) {
+    uint8_t status;
+
+    while (usi_rx_available(&port) && (received_count < BURST_LEN)) {
+        received[received_count] = usi_rx_read_with_timestamp(&port, &status,
+                                                              &times[received_count]);
+        received_count += 1;
+    }
+}
+
+static void receive_message(uint8_t *m, uint8_t len, uint8_t status) {
+    message_time = usi_serial_rx_timestamp(&port);
+}
+
+static void init_sim(const BaudRate baud_rate, void (*handler)(uint8_t, uint8_t)) {
+    lsim_init_usi_port(&port, NULL, handler, baud_rate, &format8N1);
+    lsim_set_main_loop(handler ? NULL : &read_buffer);
+    usi_serial_set_clock(&port, &sim_clock);
+
+    received_count = 0;
+}
+
+// each timestamp follows the last by frame_bits bit periods, give or take
+// tolerance cycles
+static void check_spacing(const USISerialTimestamp *t, const uint8_t len,
+                          const BaudRate baud_rate, const uint8_t frame_bits,
+                          const double tolerance)
+{
+    const double frame_cycles = frame_bits * ((double) F_CPU / baud_rate);
+
+    for (uint8_t i = 1; i < len; i++) {
+        CHECK(t[i] > t[i - 1]);
+
+        const double error = (t[i] - t[i - 1]) - frame_cycles;
+
+        CHECK((error > -tolerance) && (error < tolerance));
+    }
+}
+
+static void check_rx_spacing(const BaudRate baud_rate) {
+    check_spacing(times, BURST_LEN, baud_rate, 10, 2);
+}
+
+// a frame's end is only as exact as the timer's ticks
+static void check_tx_spacing(const uint8_t len, const BaudRate baud_rate, const uint8_t frame_bits) {
+    check_spacing(times, len, baud_rate, frame_bits, 2 * USI_SERIAL_PRESCALE(baud_rate));
+}
+
+TEST_GROUP(USISerialTimestampTests) {
+};
+
+TEST(USISerialTimestampTests, ReceivedBurstToHandler) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i], &receive_byte);
+
+        lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, BURST_LEN);
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], BURST_LEN, 11)));
+
+        LONGS_EQUAL(BURST_LEN, received_count);
+        CHECK(memcmp(message, received, BURST_LEN) == 0);
+
+        // the first start bit was at cycle 0; stamped once the PCINT0 ISR
+        // has started the timer
+        CHECK(times[0] > 0);
+        CHECK(times[0] < (F_CPU / 2UL) / rates[i]);
+
+        check_rx_spacing(rates[i]);
+    }
+}
+
+TEST(USISerialTimestampTests, ReceivedBurstToBuffer) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        init_sim(rates[i], NULL);
+
+        lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, BURST_LEN);
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], BURST_LEN, 11)));
+
+        LONGS_EQUAL(BURST_LEN, received_count);
+        check_rx_spacing(rates[i]);
+    }
+}
+
+TEST(USISerialTimestampTests, ReceivedBurstInFullDuplex) {
+    // full duplex is refused beyond 19200
+    for (uint8_t i = 0; (i < COUNT(rates)) && (rates[i] <= BAUD_19200); i++) {
+        init_sim(rates[i], &receive_byte);
+        CHECK(usi_serial_enable_full_duplex(&port, &lsim_timer1_regs));
+
+        lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, BURST_LEN);
+        CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], BURST_LEN, 11)));
+
+        LONGS_EQUAL(BURST_LEN, received_count);
+        check_rx_spacing(rates[i]);
+    }
+}
+
+TEST(USISerialTimestampTests, SentFrames) {
+    for (uint8_t i = 0; i < COUNT(rates); i++) {
+        for (uint8_t streaming = 0; streaming < 2; streaming++) {
+            USISerialTimestamp t;
+
+            init_sim(rates[i], &receive_byte);
+            usi_tx_set_streaming(&port, streaming);
+
+            for (uint8_t j = 0; j < 10; j++) {
+                CHECK(usi_tx_enqueue(&port, message[j]));
+            }
+
+            CHECK(lsim_run_until_idle(lsim_frames_cycles(rates[i], 10, 11)));
+
+            for (uint8_t j = 0; j < 10; j++) {
+                CHECK(usi_tx_read_timestamp(&port, &times[j]));
+            }
+
+            CHECK(! usi_tx_read_timestamp(&port, &t));
+
+            // the first as its stop bit starts, after the start bit, the
+            // data bits and the bit or two start_tx() holds the line high
+            // for
+            const double bit_cycles = (double) F_CPU / rates[i];
+
+            CHECK(times[0] > 10 * bit_cycles);
+            CHECK(times[0] < 12 * bit_cycles);
+
+            // with the idle bit between unless streaming
+            check_tx_spacing(10, rates[i], streaming ? 10 : 11);
+        }
+    }
+}
+
+TEST(USISerialTimestampTests, OldestSentOverwritten) {
+    USISerialTimestamp t;
+
+    init_sim(BAUD_19200, &receive_byte);
+    usi_tx_set_streaming(&port, true);
+
+    for (uint8_t j = 0; j < USI_SERIAL_TX_BUFFER_SIZE + 3; j++) {
+        while (! usi_tx_enqueue(&port, message[j])) {
+            lsim_run(F_CPU / BAUD_19200);
+        }
+    }
+
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, USI_SERIAL_TX_BUFFER_SIZE, 11)));
+
+    LONGS_EQUAL(3, usi_tx_timestamp_lost_count(&port));
+
+    for (uint8_t j = 0; j < USI_SERIAL_TX_BUFFER_SIZE; j++) {
+        CHECK(usi_tx_read_timestamp(&port, &times[j]));
+    }
+
+    CHECK(! usi_tx_read_timestamp(&port, &t));
+    check_tx_spacing(USI_SERIAL_TX_BUFFER_SIZE, BAUD_19200, 10);
+}
+
+TEST(USISerialTimestampTests, MessageStampedWithFirstFrame) {
+    init_sim(BAUD_19200, NULL);
+    CHECK(usi_serial_set_idle_timeout(&port, 35, message_buf, sizeof(message_buf),
+                                      &receive_message));
+
+    lsim_run(1000);
+
+    const uint32_t start = lsim_stats()->cycles;
+
+    message_time = 0;
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 10);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 10, 11) + 35 * (F_CPU / BAUD_19200)));
+
+    CHECK(message_time > start);
+    CHECK(message_time < start + (F_CPU / 2UL) / BAUD_19200);
+}
+
+TEST(USISerialTimestampTests, ZeroWithoutClock) {
+    uint8_t status;
+    USISerialTimestamp t = 1;
+
+    init_sim(BAUD_19200, NULL);
+    lsim_set_main_loop(NULL);
+    usi_serial_set_clock(&port, NULL);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) message, 2);
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 2, 11)));
+
+    BYTES_EQUAL(message[0], usi_rx_read_with_timestamp(&port, &status, &t));
+    LONGS_EQUAL(0, t);
+
+    CHECK(usi_tx_enqueue(&port, 'x'));
+    CHECK(lsim_run_until_idle(lsim_frames_cycles(BAUD_19200, 1, 11)));
+
+    CHECK(usi_tx_read_timestamp(&port, &t));
+    LONGS_EQUAL(0, t);
+}
+
+#endif
@@ -0,0 +1,166 @@
+extern "C" {
+    #include "usi_serial.h"
+}
+
+#include <stdint.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * Checks the compile-time timing calculations in usi_serial_timing.h for
+ * clocks other than the one the tests are built for.  Expected values are
+ * hand-calculated for the default 224-cycle PCINT startup delay; error is in
+ * basis points.
+ */
+
+TEST_GROUP(USISerialTimingTests) {
+};
+
+TEST(USISerialTimingTests, StartupDelay) {
+    LONGS_EQUAL(224, USI_SERIAL_PCINT_STARTUP_CYCLES);
+    LONGS_EQUAL(28,  USI_SERIAL_PCINT_STARTUP_TICKS_F(8000000UL, 9600));
+    LONGS_EQUAL(4,   USI_SERIAL_PCINT_STARTUP_TICKS_F(8000000UL, 2400)); // 3.5
+    LONGS_EQUAL(224, USI_SERIAL_PCINT_STARTUP_TICKS_F(8000000UL, 57600));
+
+    // the same, to 1/256th of a tick, for calibration
+    LONGS_EQUAL(12 * 256,  USI_SERIAL_CYCLES_TICKS_256_F(8000000UL, 9600, 96));
+    LONGS_EQUAL(384,       USI_SERIAL_CYCLES_TICKS_256_F(8000000UL, 2400, 96));
+    LONGS_EQUAL(96 * 256,  USI_SERIAL_CYCLES_TICKS_256_F(8000000UL, 57600, 96));
+    LONGS_EQUAL(2 * 256,   USI_SERIAL_CYCLES_TICKS_256_F(8000000UL, 9600, 16));
+}
+
+TEST(USISerialTimingTests, OneMHz) {
+    LONGS_EQUAL(8,  USI_SERIAL_PRESCALE_F(1000000UL, 2400));
+    LONGS_EQUAL(51, USI_SERIAL_TIMER0_SEED_F(1000000UL, 2400)); // 52 ticks
+    LONGS_EQUAL(49, USI_SERIAL_INITIAL_TIMER0_SEED_F(1000000UL, 2400));
+    LONGS_EQUAL(16, USI_SERIAL_TIMING_ERROR_F(1000000UL, 2400));
+    CHECK(USI_SERIAL_TIMING_OK_F(1000000UL, 2400));
+
+    // fast enough for prescale 1, but the start-bit delay is longer than 1.5
+    // bit periods
+    LONGS_EQUAL(1,   USI_SERIAL_PRESCALE_F(1000000UL, 9600));
+    LONGS_EQUAL(103, USI_SERIAL_TIMER0_SEED_F(1000000UL, 9600));
+    CHECK(! USI_SERIAL_STARTUP_FITS_F(1000000UL, 9600));
+    CHECK(! USI_SERIAL_TIMING_OK_F(1000000UL, 9600));
+    CHECK(! USI_SERIAL_STARTUP_FITS_F(1000000UL, 19200));
+    CHECK(! USI_SERIAL_TIMING_OK_F(1000000UL, 19200));
+    CHECK(! USI_SERIAL_TIMING_OK_F(1000000UL, 115200));
+}
+
+TEST(USISerialTimingTests, EightMHz) {
+    // too slow for prescale 8
+    LONGS_EQUAL(64, USI_SERIAL_PRESCALE_F(8000000UL, 2400));
+    LONGS_EQUAL(51, USI_SERIAL_TIMER0_SEED_F(8000000UL, 2400));
+    LONGS_EQUAL(74, USI_SERIAL_INITIAL_TIMER0_SEED_F(8000000UL, 2400));
+    LONGS_EQUAL(64, USI_SERIAL_PRESCALE_F(8000000UL, 4800));
+
+    LONGS_EQUAL(8,   USI_SERIAL_PRESCALE_F(8000000UL, 9600));
+    LONGS_EQUAL(103, USI_SERIAL_TIMER0_SEED_F(8000000UL, 9600));
+    LONGS_EQUAL(127, USI_SERIAL_INITIAL_TIMER0_SEED_F(8000000UL, 9600));
+    LONGS_EQUAL(16,  USI_SERIAL_TIMING_ERROR_F(8000000UL, 9600));
+    CHECK(! USI_SERIAL_DITHERED_F(8000000UL, 9600));
+    LONGS_EQUAL(0,   USI_SERIAL_TIMER0_FRACTION_F(8000000UL, 9600));
+
+    // 34.72 ticks; rounding to 35 is 0.8% out, so it's dithered
+    CHECK(USI_SERIAL_DITHERED_F(8000000UL, 28800));
+    LONGS_EQUAL(80,  USI_SERIAL_ROUNDING_ERROR_F(8000000UL, 28800));
+    LONGS_EQUAL(33,  USI_SERIAL_TIMER0_SEED_F(8000000UL, 28800)); // 34 ticks
+    LONGS_EQUAL(185, USI_SERIAL_TIMER0_FRACTION_F(8000000UL, 28800));
+    LONGS_EQUAL(23,  USI_SERIAL_INITIAL_TIMER0_SEED_F(8000000UL, 28800));
+    LONGS_EQUAL(0,   USI_SERIAL_TIMING_ERROR_F(8000000UL, 28800));
+
+    // the last prescale 8 rate; timer0 starts 10 ticks before the middle of
+    // the first data bit
+    LONGS_EQUAL(8,   USI_SERIAL_PRESCALE_F(8000000UL, 38400));
+    LONGS_EQUAL(10,  USI_SERIAL_INITIAL_TIMER0_SEED_F(8000000UL, 38400));
+    CHECK(USI_SERIAL_TIMING_OK_F(8000000UL, 38400));
+
+    // prescale 1, with an accurate bit period, but the middle of the first
+    // data bit's 208 cycles after the start bit: before the ISR's started
+    // timer0
+    LONGS_EQUAL(1,   USI_SERIAL_PRESCALE_F(8000000UL, 57600));
+    LONGS_EQUAL(138, USI_SERIAL_TIMER0_SEED_F(8000000UL, 57600));
+    LONGS_EQUAL(8,   USI_SERIAL_TIMING_ERROR_F(8000000UL, 57600));
+    CHECK(! USI_SERIAL_DITHERED_F(8000000UL, 57600));
+    CHECK(! USI_SERIAL_STARTUP_FITS_F(8000000UL, 57600));
+    CHECK(! USI_SERIAL_TIMING_OK_F(8000000UL, 57600));
+
+    // 69.44 ticks
+    LONGS_EQUAL(1,   USI_SERIAL_PRESCALE_F(8000000UL, 115200));
+    CHECK(USI_SERIAL_DITHERED_F(8000000UL, 115200));
+    LONGS_EQUAL(68,  USI_SERIAL_TIMER0_SEED_F(8000000UL, 115200));
+    LONGS_EQUAL(114, USI_SERIAL_TIMER0_FRACTION_F(8000000UL, 115200));
+    CHECK(! USI_SERIAL_TIMING_OK_F(8000000UL, 115200));
+}
+
+TEST(USISerialTimingTests, SixteenMHz) {
+    LONGS_EQUAL(64,  USI_SERIAL_PRESCALE_F(16000000UL, 9600));
+    LONGS_EQUAL(25,  USI_SERIAL_TIMER0_SEED_F(16000000UL, 9600));
+    LONGS_EQUAL(8,   USI_SERIAL_PRESCALE_F(16000000UL, 14400));
+    LONGS_EQUAL(138, USI_SERIAL_TIMER0_SEED_F(16000000UL, 14400));
+    LONGS_EQUAL(179, USI_SERIAL_INITIAL_TIMER0_SEED_F(16000000UL, 14400));
+
+    LONGS_EQUAL(33,  USI_SERIAL_TIMER0_SEED_F(16000000UL, 57600));
+    LONGS_EQUAL(185, USI_SERIAL_TIMER0_FRACTION_F(16000000UL, 57600));
+    CHECK(USI_SERIAL_TIMING_OK_F(16000000UL, 57600));
+
+    LONGS_EQUAL(23,  USI_SERIAL_INITIAL_TIMER0_SEED_F(16000000UL, 57600));
+
+    // as 57600 at 8MHz
+    LONGS_EQUAL(1,   USI_SERIAL_PRESCALE_F(16000000UL, 115200));
+    LONGS_EQUAL(138, USI_SERIAL_TIMER0_SEED_F(16000000UL, 115200));
+    CHECK(! USI_SERIAL_TIMING_OK_F(16000000UL, 115200));
+}
+
+TEST(USISerialTimingTests, TwentyMHz) {
+    LONGS_EQUAL(64,  USI_SERIAL_PRESCALE_F(20000000UL, 2400));
+    LONGS_EQUAL(129, USI_SERIAL_TIMER0_SEED_F(20000000UL, 2400));
+    LONGS_EQUAL(191, USI_SERIAL_INITIAL_TIMER0_SEED_F(20000000UL, 2400));
+
+    // 1.37% out when rounded to 22 ticks
+    LONGS_EQUAL(8,   USI_SERIAL_PRESCALE_F(20000000UL, 115200));
+    LONGS_EQUAL(137, USI_SERIAL_ROUNDING_ERROR_F(20000000UL, 115200));
+    LONGS_EQUAL(20,  USI_SERIAL_TIMER0_SEED_F(20000000UL, 115200));
+    LONGS_EQUAL(180, USI_SERIAL_TIMER0_FRACTION_F(20000000UL, 115200));
+    LONGS_EQUAL(4,   USI_SERIAL_INITIAL_TIMER0_SEED_F(20000000UL, 115200));
+    CHECK(USI_SERIAL_TIMING_OK_F(20000000UL, 115200));
+}
+
+TEST(USISerialTimingTests, KeepingUp) {
+    // 69.44 cycles a bit, with a compare interrupt in each
+    CHECK(! USI_SERIAL_LOAD_OK_F(8000000UL, 115200));
+    CHECK(USI_SERIAL_LOAD_OK_F(20000000UL, 115200));
+
+    // not dithered
+    CHECK(USI_SERIAL_LOAD_OK_F(16000000UL, 115200));
+
+    // prescale 1, timer0 starting 15 cycles before the first data bit: the
+    // compare ISR, held off by the PCINT0 ISR, can't reload OCR0A in time
+    LONGS_EQUAL(1,  USI_SERIAL_PRESCALE_F(18432000UL, 115200));
+    LONGS_EQUAL(15, USI_SERIAL_INITIAL_TIMER0_SEED_F(18432000UL, 115200));
+    CHECK(USI_SERIAL_STARTUP_FITS_F(18432000UL, 115200));
+    CHECK(! USI_SERIAL_RELOAD_FITS_F(18432000UL, 115200));
+    CHECK(! USI_SERIAL_TIMING_OK_F(18432000UL, 115200));
+    CHECK(USI_SERIAL_RELOAD_FITS_F(20000000UL, 115200));
+
+    // 408 cycles a bit for full duplex and bit-banged ports
+    LONGS_EQUAL(408, USI_SERIAL_TIMER1_MIN_BIT_CYCLES);
+    CHECK(USI_SERIAL_TIMER1_RATE_OK_F(8000000UL, 19200));
+    CHECK(! USI_SERIAL_TIMER1_RATE_OK_F(8000000UL, 28800));
+    CHECK(USI_SERIAL_TIMER1_RATE_OK_F(16000000UL, 38400));
+}
+
+TEST(USISerialTimingTests, DefaultBaudRatesAtEightMHz) {
+    // every standard rate that's usable at 8MHz, which with the default
+    // startup delay stops at 38400
+    LONGS_EQUAL(2400,   BAUD_2400);
+    LONGS_EQUAL(4800,   BAUD_4800);
+    LONGS_EQUAL(9600,   BAUD_9600);
+    LONGS_EQUAL(14400,  BAUD_14400);
+    LONGS_EQUAL(19200,  BAUD_19200);
+    LONGS_EQUAL(28800,  BAUD_28800);
+    LONGS_EQUAL(38400,  BAUD_38400);
+
+    #define COUNT_RATE(baud) + 1
+    LONGS_EQUAL(7, 0 USI_SERIAL_BAUD_RATES(COUNT_RATE));
+    #undef COUNT_RATE
+}
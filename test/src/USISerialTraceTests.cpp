@@ -0,0 +1,266 @@
+extern "C" {
+    #include <avr/io.h>
+
+    #include "8bit_binary.h"
+    #include "usi_serial.h"
+    #include "8bit_tiny_timer0.h"
+
+    #include "LineSimulator.h"
+    #include "TraceDecoder.h"
+
+    void ISR_PCINT0_vect(void);
+    void ISR_TIMER0_COMPA_vect(void);
+    void ISR_USI_OVF_vect(void);
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include "CppUTest/TestHarness.h"
+
+/*
+ * The trace is enabled for the tests by USI_SERIAL_TRACE in test/Makefile,
+ * unless they're built with TRACE=N.
+ */
+
+#ifdef USI_SERIAL_TRACE
+
+static const USISerialRegisters usiRegs = {
+    &virtualPORTB,
+    &virtualPINB,
+    &virtualDDRB,
+    &virtualUSIBR,
+    &virtualUSICR,
+    &virtualUSIDR,
+    &virtualUSISR,
+    &virtualGIFR,
+    &virtualGIMSK,
+    &virtualPCMSK,
+    &virtualTCNT0,
+    &virtualMCUCR,
+};
+
+static const Timer0Registers timer0Regs = {
+    &virtualGTCCR,
+    &virtualTCCR0A,
+    &virtualTCCR0B,
+    &virtualOCR0A,
+    &virtualTIMSK,
+    &virtualTIFR,
+    &virtualTCNT0,
+};
+
+static USISerialPort port;
+
+static const USISerialFrameFormat format8E1 = USI_SERIAL_FRAME_FORMAT(8, EVEN, 1);
+
+static USITraceEntry events[USI_SERIAL_TRACE_SIZE];
+static uint8_t event_count;
+
+static void read_trace() {
+    event_count = usi_trace_read(events, USI_SERIAL_TRACE_SIZE);
+}
+
+static void check_event(const uint8_t index,
+                        const USITraceEvent event,
+                        const uint8_t value)
+{
+    CHECK(index < event_count);
+    LONGS_EQUAL(event, events[index].event);
+    BYTES_EQUAL(value, events[index].value);
+}
+
+TEST_GROUP(USISerialTraceTests) {
+    void setup() {
+        virtualPORTB = 0;
+        virtualPINB = 0xff;
+        virtualDDRB = 0xff;
+        virtualUSIBR = 0;
+        virtualUSICR = 0xff;
+        virtualUSISR = 0xff;
+        virtualGIFR = 0;
+        virtualGIMSK = 0;
+        virtualPCMSK = 0;
+
+        virtualGTCCR = 0;
+        virtualTCCR0A = 0;
+        virtualTCCR0B = 0;
+        virtualOCR0A = 0;
+        virtualTIMSK = 0;
+        virtualTIFR = 0;
+        virtualTCNT0 = 0;
+
+        event_count = 0;
+
+        timer0_init(&timer0Regs, TIMER0_PRESCALE_8);
+        usi_serial_init(&port, &usiRegs, NULL, BAUD_9600, &format8E1);
+    }
+};
+
+TEST(USISerialTraceTests, EmptyAfterInit) {
+    read_trace();
+
+    LONGS_EQUAL(0, event_count);
+    LONGS_EQUAL(0, usi_trace_lost_count());
+}
+
+#ifndef USI_SERIAL_FIXED_FORMAT
+TEST(USISerialTraceTests, ByteReceivedWithParity) {
+    // start bit
+    virtualPINB = B11111110;
+    ISR_PCINT0_vect();
+
+    ISR_TIMER0_COMPA_vect();
+
+    // data bits; 'a' reversed
+    virtualTCNT0 = 3;
+    virtualUSIBR = B10000110;
+    ISR_USI_OVF_vect();
+
+    // parity and stop bits
+    virtualTCNT0 = 4;
+    virtualUSIBR = B00011011;
+    ISR_USI_OVF_vect();
+
+    read_trace();
+    LONGS_EQUAL(6, event_count);
+
+    check_event(0, USI_TRACE_PCINT0,   B11111110);
+    check_event(1, USI_TRACE_RX_STATE, USIRX_STATE_RECEIVING);
+    check_event(2, USI_TRACE_USI_OVF,  B10000110);
+    check_event(3, USI_TRACE_RX_STATE, USIRX_STATE_WAITING_FOR_PARITY_BIT);
+    check_event(4, USI_TRACE_USI_OVF,  B00011011);
+    check_event(5, USI_TRACE_RX_STATE, USIRX_STATE_IDLE);
+
+    // timer0 was reset by the PCINT0 ISR
+    BYTES_EQUAL(0, events[0].tcnt0);
+    BYTES_EQUAL(3, events[2].tcnt0);
+    BYTES_EQUAL(3, events[3].tcnt0);
+    BYTES_EQUAL(4, events[4].tcnt0);
+
+    // drained
+    read_trace();
+    LONGS_EQUAL(0, event_count);
+}
+
+TEST(USISerialTraceTests, ByteReceivedWithParityOnTheLine) {
+    LineSimConfig cfg;
+
+    lsim_default_config(&cfg, BAUD_9600);
+    cfg.format = format8E1;
+    lsim_init(&cfg);
+
+    timer0_init(&lsim_timer0_regs, USI_SERIAL_TIMER0_PRESCALE(BAUD_9600));
+    usi_serial_init(&port, &lsim_usi_regs, NULL, BAUD_9600, &cfg.format);
+
+    lsim_remote_send(LSIM_USI_LINE, (const uint8_t *) "a", 1);
+    CHECK(lsim_run_until_idle(20 * (F_CPU / 9600)));
+
+    read_trace();
+    LONGS_EQUAL(6, event_count);
+
+    check_event(0, USI_TRACE_PCINT0,   B11111110);
+    check_event(1, USI_TRACE_RX_STATE, USIRX_STATE_RECEIVING);
+    check_event(2, USI_TRACE_USI_OVF,  B10000110);
+    check_event(3, USI_TRACE_RX_STATE, USIRX_STATE_WAITING_FOR_PARITY_BIT);
+    check_event(4, USI_TRACE_USI_OVF,  B00011011);
+    check_event(5, USI_TRACE_RX_STATE, USIRX_STATE_IDLE);
+
+    // the overflows are serviced just after the compare match that clocked
+    // the USI cleared timer0
+    CHECK(events[2].tcnt0 < 4);
+    CHECK(events[4].tcnt0 < 4);
+
+    BYTES_EQUAL('a', usi_rx_read(&port));
+}
+#endif
+
+TEST(USISerialTraceTests, ByteTransmitted) {
+    CHECK(usi_tx_enqueue(&port, 'a'));
+
+    // idle bit, two half-frames
+    ISR_USI_OVF_vect();
+    ISR_USI_OVF_vect();
+    ISR_USI_OVF_vect();
+
+    read_trace();
+    LONGS_EQUAL(7, event_count);
+
+    check_event(0, USI_TRACE_TX_STATE, USITX_STATE_READY_FOR_FIRST_HALF_FRAME);
+    CHECK_EQUAL(USI_TRACE_USI_OVF, events[1].event);
+    check_event(2, USI_TRACE_TX_STATE, USITX_STATE_READY_FOR_SECOND_HALF_FRAME);
+    CHECK_EQUAL(USI_TRACE_USI_OVF, events[3].event);
+    check_event(4, USI_TRACE_TX_STATE, USITX_STATE_COMPLETE);
+    CHECK_EQUAL(USI_TRACE_USI_OVF, events[5].event);
+    check_event(6, USI_TRACE_TX_STATE, USITX_STATE_IDLE);
+}
+
+TEST(USISerialTraceTests, OverwritesOldestEvents) {
+    // one event for each PCINT0 that isn't a start bit
+    virtualPINB = 0xff;
+
+    for (uint8_t i = 0; i < USI_SERIAL_TRACE_SIZE + 5; i++) {
+        virtualTCNT0 = i;
+        ISR_PCINT0_vect();
+    }
+
+    LONGS_EQUAL(5, usi_trace_lost_count());
+
+    read_trace();
+    LONGS_EQUAL(USI_SERIAL_TRACE_SIZE, event_count);
+
+    // oldest remaining first
+    BYTES_EQUAL(5, events[0].tcnt0);
+    BYTES_EQUAL(USI_SERIAL_TRACE_SIZE + 4, events[USI_SERIAL_TRACE_SIZE - 1].tcnt0);
+}
+
+TEST(USISerialTraceTests, DecodeEvents) {
+    char line[64];
+    USITraceEntry entry;
+
+    entry.tcnt0 = 12;
+    entry.event = USI_TRACE_PCINT0;
+    entry.value = B11111110;
+    trace_format(line, sizeof(line), &entry);
+    STRCMP_EQUAL("TCNT0  12  PCINT0   PB0 low", line);
+
+    entry.event = USI_TRACE_USI_OVF;
+    entry.value = B10000110;
+    trace_format(line, sizeof(line), &entry);
+    STRCMP_EQUAL("TCNT0  12  USI_OVF  USIBR 0x86", line);
+
+    entry.event = USI_TRACE_RX_STATE;
+    entry.value = USIRX_STATE_WAITING_FOR_PARITY_BIT;
+    trace_format(line, sizeof(line), &entry);
+    STRCMP_EQUAL("TCNT0  12  RX       WAITING_FOR_PARITY_BIT", line);
+
+    entry.event = USI_TRACE_TX_STATE;
+    entry.value = USITX_STATE_COMPLETE;
+    trace_format(line, sizeof(line), &entry);
+    STRCMP_EQUAL("TCNT0  12  TX       COMPLETE", line);
+
+    // unknown state
+    entry.value = 9;
+    trace_format(line, sizeof(line), &entry);
+    STRCMP_EQUAL("TCNT0  12  TX       ?", line);
+}
+
+TEST(USISerialTraceTests, PrintTimeline) {
+    virtualPINB = B11111110;
+    ISR_PCINT0_vect();
+
+    read_trace();
+
+    FILE *out = tmpfile();
+    char line[64];
+
+    trace_print(out, events, event_count);
+    rewind(out);
+
+    STRCMP_EQUAL("  0  TCNT0   0  PCINT0   PB0 low\n", fgets(line, sizeof(line), out));
+    STRCMP_EQUAL("  1  TCNT0   0  RX       RECEIVING\n", fgets(line, sizeof(line), out));
+    CHECK(fgets(line, sizeof(line), out) == NULL);
+
+    fclose(out);
+}
+
+#endif